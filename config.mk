@@ -1,7 +1,10 @@
-CONFIG_NR_CPUS := 8
+CONFIG_NR_CPUS := 1024
 CONFIG_LOG2_CPU_CACHELINE_SIZE := 6
 CONFIG_LOG2_CPU_PAGE_SIZE := 12
+CONFIG_LOG2_HUGE_PAGE_SIZE := 21
 
 CPPFLAGS_CONFIG = \
+	-DCONFIG_NR_CPUS=$(CONFIG_NR_CPUS) \
 	-DCONFIG_LOG2_CPU_CACHELINE_SIZE=$(CONFIG_LOG2_CPU_CACHELINE_SIZE) \
-	-DCONFIG_LOG2_CPU_PAGE_SIZE=$(CONFIG_LOG2_CPU_PAGE_SIZE)
+	-DCONFIG_LOG2_CPU_PAGE_SIZE=$(CONFIG_LOG2_CPU_PAGE_SIZE) \
+	-DCONFIG_LOG2_HUGE_PAGE_SIZE=$(CONFIG_LOG2_HUGE_PAGE_SIZE)
@@ -8,6 +8,9 @@
 #define LG2_PAGE_SIZE CONFIG_LOG2_CPU_PAGE_SIZE
 #define PAGE_SIZE (1 << LG2_PAGE_SIZE)
 
+#define LG2_HUGE_PAGE_SIZE CONFIG_LOG2_HUGE_PAGE_SIZE
+#define HUGE_PAGE_SIZE (1UL << LG2_HUGE_PAGE_SIZE)
+
 #define NR_CPUS CONFIG_NR_CPUS
 
 /* common macros */
@@ -25,6 +28,13 @@
 #define PACKED __attribute__((packed))
 #define CACHE_ALIGNED __attribute__((aligned(CACHELINE_SIZE)))
 
+/* accesses the thread sanitizer leaves unchecked, for races known benign */
+#ifdef __SANITIZE_THREAD__
+#define NO_SANITIZE_THREAD __attribute__((no_sanitize_thread))
+#else
+#define NO_SANITIZE_THREAD
+#endif
+
 /* silence warnings about void const */
 #define VOIDPTR(ptr)\
     (void *)(uintptr_t)(ptr)
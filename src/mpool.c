@@ -1,332 +1,4403 @@
+#define _GNU_SOURCE /* sched_getcpu() */
 #include <assert.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
 #include "common.h"
+/* the library finds its own thread caches wherever it is loaded */
+#define MPOOL_TLS_MODEL "global-dynamic"
 #include "mpool.h"
+#include "mpool_large.h"
 #include "mpool_memcheck.h"
+#include "mpool_numa.h"
+#include "mpool_rseq.h"
+
+/* thread caches refill and flush their size class by batches which size
+ * adapts, per class and per thread, between these bounds */
+#define MPOOL_CACHE_MIN_BYTES 1024
+#define MPOOL_CACHE_MAX_BYTES (64 << 10)
+#define MPOOL_CACHE_MIN_BATCH 2
+#define MPOOL_CACHE_MAX_BATCH 256
+
+/* per-CPU caches refill and flush by batches of about this many bytes, and
+ * hold up to twice that per size class */
+#define MPOOL_PERCPU_BYTES (16 << 10)
+
+/* default cap on the bytes all the thread caches of an instance may grow by */
+#define MPOOL_CACHE_LIMIT (64UL << 20)
 
-#define MPOOL_CACHE_SIZE 10
+/* the thread caches of a size class grow by at most 1/2^LG2_CACHE_CLASS_SHARE
+ * of its chunks: what the caches of threads done with the class hold leaves
+ * the other threads the rest of it */
+#define LG2_CACHE_CLASS_SHARE 7
 
-#define NUM_POOLS (LG2_PAGE_SIZE - LG2_CACHELINE_SIZE + 1)
-#if NUM_POOLS > 7
-#error NUM_POOLS > 7
+/* batches are referenced by their offset to the pool arena, in units of the
+ * smallest chunk alignment, so that a reference and an ABA tag fit in the
+ * single word updated by the pool free list CAS */
+#define LG2_BATCH_REF_UNIT 4
+
+/* weights are given per doubling of the chunk size, from the cacheline size
+ * up to the page size. Each doubling above the cacheline size is split in
+ * CLASS_STEPS evenly spaced size classes */
+#define NUM_BINS (LG2_PAGE_SIZE - LG2_CACHELINE_SIZE + 1)
+#define LG2_CLASS_STEPS 2
+#define CLASS_STEPS (1 << LG2_CLASS_STEPS)
+#if LG2_CLASS_STEPS > LG2_CACHELINE_SIZE - LG2_BATCH_REF_UNIT
+#error size classes must be multiples of the batch reference unit
 #endif
 
+/* opt-in tiny size classes below the cacheline size, by steps of the smallest
+ * chunk able to hold a batch header. They come first */
+#define LG2_TINY_CLASS_SIZE LG2_BATCH_REF_UNIT
+#define NUM_TINY_CLASSES ((CACHELINE_SIZE >> LG2_TINY_CLASS_SIZE) - 1)
+
+#define NUM_POOLS (NUM_TINY_CLASSES + 1 + (NUM_BINS - 1) * CLASS_STEPS)
+
+/* the size class lookup table has an entry per granule up to the page size */
+#define LG2_SIZE_GRANULE LG2_BATCH_REF_UNIT
+#define NUM_SIZE_GRANULES ((PAGE_SIZE >> LG2_SIZE_GRANULE) + 1)
+
+/* the weight following the size class ones is the large tier's */
+#define LARGE_WEIGHT_INDEX NUM_BINS
+
+/* growable instances commit their reserve by segments */
+#define LG2_SEGMENT_SIZE 21
+#define SEGMENT_SIZE (1UL << LG2_SEGMENT_SIZE)
+
+/* maximum number of live mpool instances, a NUMA instance takes one more per
+ * node */
+#define MPOOL_MAX_CTX 16
+
+/* threads count their local and remote frees of NUMA instances, and add them
+ * to the instance counters by this many */
+#define MPOOL_NUMA_FREES_BATCH 128
+
+/* threads allocating from MPOOL_REMOTE_FREE instances take one of these owner
+ * slots, slot 0 stands for chunks of no known owner */
+#define MPOOL_MAX_OWNERS 64
+
+/* owners are tracked per page: a chunk freed to the last thread allocating
+ * from its page rather than to its own is only a missed hint */
+#define LG2_OWNER_GRANULE LG2_PAGE_SIZE
+
+/* threads count their allocations and frees per size class, and add them to
+ * the size class counters by this many */
+#define MPOOL_STATS_BATCH 256
+
+/* maximum number of live object caches */
+#define MPOOL_MAX_OBJCACHES 64
+
+/* object caches take slabs of at least this size, holding at least
+ * MPOOL_OBJCACHE_MIN_OBJS objects, from the large tier */
+#define MPOOL_OBJCACHE_SLAB_SIZE (64 << 10)
+#define MPOOL_OBJCACHE_MIN_OBJS 8
+#define MPOOL_OBJCACHE_MAX_SIZE (1 << 20)
+
+/* latency histograms are log-linear: LAT_STEPS buckets per doubling of the
+ * tick count, up to 2^34 ticks */
+#define LG2_LAT_STEPS 3
+#define LAT_STEPS (1 << LG2_LAT_STEPS)
+#define NUM_LAT_BUCKETS 256
+
+_Static_assert(NUM_POOLS <= MPOOL_STATS_MAX_CLASSES,
+        "struct mpool_stats holds every size class");
+
 
 struct chunk_list {
     struct chunk_list * next;
 };
 
+/* a batch of free chunks on a pool free list, the header lives in the first
+ * chunk of the batch */
+struct chunk_batch {
+    struct chunk_list list;
+    uint32_t next_batch;
+    uint32_t num;
+};
+
+_Static_assert(sizeof(struct chunk_batch) <= 1 << LG2_TINY_CLASS_SIZE,
+        "the smallest chunks must hold a batch header");
+
+/* the carving region of a pool, between two offsets to its arena in batch
+ * reference units */
+#define CARVE_NEXT(carve) ((uint32_t) ((carve) >> 32))
+#define CARVE_END(carve) ((uint32_t) (carve))
+#define CARVE(next, end) (((uint64_t) (next) << 32) | (end))
+
+/* a run of free chunks which pages were purged. The header lives in its first
+ * chunk, the page holding it is not purged */
+struct chunk_span {
+    struct chunk_span * next;
+    size_t size;
+};
+
+_Static_assert(sizeof(struct chunk_span) <= 1 << LG2_TINY_CLASS_SIZE,
+        "the smallest chunks must hold a span header");
+
+/* counters of a size class, or of the large tier, updated on the slow paths.
+ * Building with MPOOL_NO_STATS removes them, and the ones the threads keep */
+struct mpool_counters {
+    size_t allocs;
+    size_t frees;
+    size_t misses;
+    size_t refills;
+    size_t flushes;
+    size_t contended;
+    size_t enomem;
+    size_t high_water;
+};
+
+#ifndef MPOOL_NO_STATS
+#define MPOOL_STAT_ADD(counters, field, n) \
+    __atomic_fetch_add(&(counters)->field, (n), __ATOMIC_RELAXED)
+#define MPOOL_COUNT_ALLOCS(pool, cache, n) mpool_count_allocs(pool, cache, n)
+#define MPOOL_COUNT_FREES(pool, cache, n) mpool_count_frees(pool, cache, n)
+#define MPOOL_STATS_FOLD(pool, cache) mpool_stats_fold(pool, cache)
+#define MPOOL_PERCPU_COUNT(ctx, field, pool_index, n) \
+    __atomic_fetch_add(&mpool_percpu_row(ctx)->field[pool_index], (n), \
+            __ATOMIC_RELAXED)
+#else
+#define MPOOL_STAT_ADD(counters, field, n) ((void) (n))
+#define MPOOL_COUNT_ALLOCS(pool, cache, n) ((void) (n))
+#define MPOOL_COUNT_FREES(pool, cache, n) ((void) (n))
+#define MPOOL_STATS_FOLD(pool, cache)
+#define MPOOL_PERCPU_COUNT(ctx, field, pool_index, n) ((void) (n))
+#endif
+
+/* builds with MPOOL_LATENCY time the exported alloc, free and realloc calls,
+ * the slow paths flag the ones which refilled or flushed a cache */
+#ifdef MPOOL_LATENCY
+#define MPOOL_LAT_SLOW_PATH() (pool_lat_slow = 1)
+#define MPOOL_LAT_TIME(call, index, expr) \
+    do { \
+        uint64_t lat_start, lat_ticks; \
+        lat_start = mpool_lat_start(); \
+        expr; \
+        lat_ticks = mpool_ticks() - lat_start; \
+        mpool_lat_record(call, index, lat_ticks); \
+    } while (0)
+#define MPOOL_LAT_RELEASE() mpool_lat_release()
+#define MPOOL_LAT_FORK_CHILD() mpool_lat_fork_child()
+#else
+#define MPOOL_LAT_SLOW_PATH()
+#define MPOOL_LAT_TIME(call, index, expr) expr
+#define MPOOL_LAT_RELEASE()
+#define MPOOL_LAT_FORK_CHILD()
+#endif
+
+/* last slow path taken by a thread cache */
+enum {
+    MPOOL_CACHE_REFILL = 1,
+    MPOOL_CACHE_FLUSH,
+};
+
+/* the fields leading to gen are struct mpool_tcache, which the inline fast
+ * path of mpool.h pops and pushes */
 struct mpool_cpu_cache {
-    size_t elem_size;
     struct chunk_list * free;
     unsigned int num_free;
+    unsigned int batch; /* refill and flush size, flushed above twice that */
+
+    /* allocations and frees not added to the size class counters yet. The
+     * inline fast path counts them in builds without counters as well */
+    unsigned int num_allocs;
+    unsigned int num_frees;
+
+    unsigned int gen; /* generation of the instance the cache belongs to */
+    unsigned int last;
+
+    /* chunks of another thread freed by this one, to go back to their owner
+     * by whole batches */
+    struct chunk_list * remote;
+    unsigned int num_remote;
+    unsigned int remote_owner;
 };
 
+_Static_assert(  offsetof(struct mpool_cpu_cache, free)
+              == offsetof(struct mpool_tcache, free)
+              && offsetof(struct mpool_cpu_cache, num_free)
+              == offsetof(struct mpool_tcache, num_free)
+              && offsetof(struct mpool_cpu_cache, batch)
+              == offsetof(struct mpool_tcache, batch)
+              && offsetof(struct mpool_cpu_cache, num_allocs)
+              == offsetof(struct mpool_tcache, num_allocs)
+              && offsetof(struct mpool_cpu_cache, num_frees)
+              == offsetof(struct mpool_tcache, num_frees),
+        "thread caches start with the fields of the inline fast path");
+_Static_assert(MPOOL_INLINE_MAX_SIZE <= PAGE_SIZE
+               && MPOOL_INLINE_GRANULES
+                  == (MPOOL_INLINE_MAX_SIZE >> LG2_SIZE_GRANULE) + 1,
+        "the inline fast path is indexed by size granules");
+
 struct mpool {
+#ifdef MPOOL_CENTRAL_LOCK
     pthread_mutex_t lock;
+    uint32_t free;
+#else
+    uint64_t free; /* (ABA tag << 32) | batch reference */
+#endif
 
     unsigned int num_free;
-    struct chunk_list * free;
+    uint64_t carve; /* (next << 32) | end of the never used chunks, as arena
+                     * offsets in batch reference units */
+    struct chunk_span * spans; /* carved again once the region is used up */
+    size_t num_purged; /* chunks in spans */
+    int purging; /* a purge holds chunks taken off the free list */
+    size_t cache_chunks; /* chunks the thread caches grew by */
 
-    size_t elem_size;
+    size_t elem_size CACHE_ALIGNED;
+    unsigned int min_batch;
+    unsigned int max_batch;
+    unsigned int percpu_batch;
     size_t arena_size;
-    uint8_t * arena CACHE_ALIGNED;
+    size_t num_chunks;
+    uint8_t * arena; /* base of the batch references */
+
+#ifndef MPOOL_NO_STATS
+    struct mpool_counters counters CACHE_ALIGNED;
+#endif
 };
 
-struct mpool_glob {
+/* the per-CPU caches of a CPU. Without restartable sequences they are used
+ * under the row lock */
+struct mpool_percpu_row {
+    struct mpool_percpu_stack stacks[NUM_POOLS];
+    int lock;
+#ifndef MPOOL_NO_STATS
+    /* counted by the threads running on the CPU, rather than in thread caches
+     * these instances do not have */
+    size_t allocs[NUM_POOLS];
+    size_t frees[NUM_POOLS];
+#endif
+} __attribute__((aligned(PERCPU_ROW_SIZE)));
+
+_Static_assert(sizeof(struct mpool_percpu_row) == PERCPU_ROW_SIZE,
+        "the rows of the CPUs are PERCPU_ROW_SIZE apart");
+
+/* batches of chunks freed by other threads to an owner, per size class. Only
+ * the owner pops them, a batch cannot be popped and pushed back under it
+ * (ABA) */
+struct mpool_inbox {
+    uint32_t batches[NUM_POOLS];
+} CACHE_ALIGNED;
+
+struct mpool_ctx {
     struct mpool pools[NUM_POOLS];
+    uint8_t pool_index[NUM_SIZE_GRANULES]; /* NUM_POOLS past the page size */
+    struct mpool_large large;
+    int has_large;
+#ifndef MPOOL_NO_STATS
+    struct mpool_counters large_counters;
+#endif
+    int flags;
+
+    size_t cache_limit;
+    size_t cache_size; /* bytes the thread caches grew by */
+
+    /* per-CPU caches replace the thread caches of MPOOL_PERCPU instances */
+    struct mpool_percpu_row * percpu;
+    size_t percpu_size;
+    int percpu_rows; /* configured CPUs, up to NR_CPUS */
+    int percpu_locked;
+
+    /* MPOOL_REMOTE_FREE instances stamp the page a chunk starts in with the
+     * owner slot of the thread it is allocated to. The inboxes of the
+     * MPOOL_MAX_OWNERS slots lead the owner map */
+    struct mpool_inbox * inbox;
+    uint8_t * owner_map;
+    size_t remote_size;
+
+    /* purges are serialized, the span stacks of the pools locked. A span is
+     * only carved under the grow lock, taken before the span lock */
+    pthread_mutex_t purge_lock;
+    pthread_mutex_t span_lock;
+    uint64_t decay; /* purge period in ns, 0 for none */
+    uint64_t next_purge;
+    size_t purged; /* bytes */
+
+    /* address space reserved by growable instances. The grow lock also
+     * serializes the refills of the carving regions of the pools */
+    pthread_mutex_t grow_lock;
+    uint8_t * reserve;
+    size_t reserve_size;
+    size_t reserve_used;
+
+    /* address to size class lookup, NUM_POOLS stands for the large tier.
+     * Fixed arenas are split in slices ending at slice_end[], in size class
+     * order, the large tier last. Growable instances map each segment of
+     * their reserve to its size class */
+    uintptr_t base;
+    uintptr_t slice_end[NUM_POOLS + 1];
+    uint8_t * segment_pool;
+
+    /* NUMA instances only dispatch to an instance per node */
+    int num_nodes;
+    int fake_numa;
+    struct mpool_ctx * nodes[MPOOL_MAX_NODES];
+    size_t local_frees;
+    size_t remote_frees;
+
+    unsigned int id;  /* index of the instance thread caches */
+    unsigned int gen; /* bumped on every create, 0 is never a valid value */
+    int in_use;
 };
 
-static __thread struct mpool_cpu_cache pool_cache[NUM_POOLS] = {{0}};
-static struct mpool_glob pool_glob = {0};
+/* a slab of an object cache, a run of the large tier. The header takes its
+ * first cacheline, the objects follow */
+struct mpool_slab {
+    struct mpool_slab * next;
+};
 
+/* the free objects of an object cache keep their constructed state: the free
+ * list link of the objects with a constructor or a destructor follows them
+ * rather than living in their first bytes. Its batches are referenced from
+ * the base of the instance, which large tier holds the slabs */
+struct mpool_objcache {
+    struct mpool pool;
+    struct mpool_ctx * ctx;
+    char name[MPOOL_OBJCACHE_NAME_LEN];
+    size_t obj_size;
+    size_t link;   /* offset of the free list link in the object */
+    size_t offset; /* of the first object in its slab */
+    size_t slab_size;
+    size_t slab_objs;
+    void (* ctor)(void * obj);
+    void (* dtor)(void * obj);
 
-static void
-mpool_init_arena(struct mpool * pool, size_t elem_size, size_t arena_size,
-        int pool_index)
-{
-    void * tmp;
-    uint8_t * ptr, * arena_end;
+    /* slabs are added one at a time, the newest first is being carved */
+    pthread_mutex_t grow_lock;
+    struct mpool_slab * slabs;
+    size_t num_slabs;
+    size_t cache_size; /* bytes its thread caches grew the instance ones by */
 
-    assert(pool != NULL);
+    unsigned int id;  /* index of the object cache thread caches */
+    unsigned int gen; /* from the instance generations */
+    int in_use;
+};
 
-    pool->arena_size = arena_size;
-    pool->elem_size = elem_size;
-    pthread_mutex_init(&pool->lock, NULL);
-    memset(pool->arena, 0, pool->arena_size);
+struct mpool_glob {
+    pthread_mutex_t lock;
+    pthread_once_t once;
+    pthread_key_t cache_key; /* flushes the caches of exiting threads */
+    unsigned int gen;
+    unsigned int next_node; /* fake NUMA nodes are handed round robin */
+    uint8_t owner_used[MPOOL_MAX_OWNERS];
+    struct mpool_ctx ctx[MPOOL_MAX_CTX];
+    struct mpool_ctx * default_ctx;
+    struct mpool_objcache objcache[MPOOL_MAX_OBJCACHES];
+};
 
-    arena_end = ((uint8_t *) pool->arena) + pool->arena_size;
-    arena_end -= (elem_size - 1);
-    for (ptr = pool->arena ; ptr < arena_end ; ptr += pool->elem_size) {
-        tmp = pool->free;
-        pool->free = VOIDPTR(ptr);
-        pool->free->next = tmp;
-        pool->num_free += 1;
-    }
+struct mpool_numa_frees {
+    unsigned int local;
+    unsigned int remote;
+    unsigned int gen;
+};
+
+#ifdef MPOOL_LATENCY
+struct mpool_lat_hist {
+    uint32_t buckets[NUM_LAT_BUCKETS];
+    uint64_t max;
+};
+
+/* the histograms of a thread, per call, fast or slow path and size class, the
+ * large tier last. They are never unmapped: the ones of exited threads are
+ * taken over by new threads, and keep counting */
+struct mpool_lat_thread {
+    struct mpool_lat_hist hist[MPOOL_LATENCY_CALLS][2][NUM_POOLS + 1];
+    struct mpool_lat_thread * next;
+    int in_use;
+};
+#endif
+
+/* the caches of a thread are mapped on first use, a block per instance slot
+ * and one for all the object caches, and unmapped on thread exit. Until then
+ * they point at pool_cache_none, which generation matches none, and which is
+ * never written to */
+static struct mpool_cpu_cache pool_cache_none[MAX(NUM_POOLS,
+                                                  MPOOL_MAX_OBJCACHES)];
+__extension__ static __thread struct mpool_cpu_cache * pool_cache[MPOOL_MAX_CTX]
+        = { [0 ... MPOOL_MAX_CTX - 1] = pool_cache_none };
+static __thread struct mpool_cpu_cache * pool_objcache = pool_cache_none;
+static __thread struct mpool_numa_frees pool_numa_frees[MPOOL_MAX_CTX];
+static __thread int pool_node; /* node of the thread + 1, 0 until known */
+static __thread struct mpool_rseq * pool_rseq; /* NULL until registered */
+static __thread int pool_owner = -1; /* owner slot, 0 for none, -1 until taken */
+static struct mpool_rseq pool_rseq_none;
+__thread struct mpool_inline_caches mpool_inline_caches;
+unsigned int mpool_inline_gen = MPOOL_INLINE_NONE;
+#ifdef MPOOL_LATENCY
+static __thread struct mpool_lat_thread * pool_lat; /* NULL until taken */
+static __thread int pool_lat_slow; /* the timed call took a slow path */
+static struct mpool_lat_thread * pool_lat_threads;
+#endif
+static struct mpool_glob pool_glob = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT,
+};
 
-    MPOOL_CREATE_MEMPOOL(MPOOL_GET(pool_index), 0, 0);
+#ifndef MPOOL_NO_STATS
 
-    /* init pool cache */
-    pool_cache[pool_index].elem_size = elem_size;
+/* add the allocations and frees a thread counted to its size class */
+static NOINLINE void
+mpool_stats_fold(struct mpool * pool, struct mpool_cpu_cache * cache)
+{
+    MPOOL_STAT_ADD(&pool->counters, allocs, cache->num_allocs);
+    MPOOL_STAT_ADD(&pool->counters, frees, cache->num_frees);
+    cache->num_allocs = 0;
+    cache->num_frees = 0;
 }
 
 
-static void *
-mpool_cache_align_ptr(void * ptr)
+/* threads which could not map their caches count straight to the size class */
+static ALWAYS_INLINE void
+mpool_count_allocs(struct mpool * pool, struct mpool_cpu_cache * cache,
+        unsigned int n)
 {
-    uint8_t * _ptr;
-    _ptr = (uint8_t *) (((uintptr_t) ptr) & ~((1ULL <<
-                                               CONFIG_LOG2_CPU_CACHELINE_SIZE) -
-                                              1ULL));
+    if (unlikely(cache == NULL)) {
+        MPOOL_STAT_ADD(&pool->counters, allocs, n);
+        return;
+    }
 
-    if (ptr == _ptr)
-        return ptr;
-    else
-        return _ptr + CACHELINE_SIZE;
+    cache->num_allocs += n;
+    if (unlikely(cache->num_allocs >= MPOOL_STATS_BATCH))
+        mpool_stats_fold(pool, cache);
 }
 
 
-NOINLINE int
-mpool_create(void * arena, size_t total_size,
-        unsigned int * weights, int weights_len)
+static ALWAYS_INLINE void
+mpool_count_frees(struct mpool * pool, struct mpool_cpu_cache * cache,
+        unsigned int n)
 {
-    int i;
-    uint8_t * arena_ptr;
-    size_t elem_size, arena_size, total_weight;
-    struct mpool * pool;
+    if (unlikely(cache == NULL)) {
+        MPOOL_STAT_ADD(&pool->counters, frees, n);
+        return;
+    }
 
-    assert(total_size >= CACHELINE_SIZE);
-    assert(weights_len <= NUM_POOLS);
+    cache->num_frees += n;
+    if (unlikely(cache->num_frees >= MPOOL_STATS_BATCH))
+        mpool_stats_fold(pool, cache);
+}
 
-    total_weight = 0;
-    for (i = 0 ; i < weights_len ; i++)
-        total_weight += (1 << i) * CACHELINE_SIZE * weights[i];
+#endif /* MPOOL_NO_STATS */
 
-    assert(total_weight > 0);
+#ifdef MPOOL_LATENCY
 
-    arena_ptr = mpool_cache_align_ptr(arena);
-    total_size -= (size_t) (arena_ptr - (uint8_t *) arena);
+static ALWAYS_INLINE uint64_t
+mpool_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
 
-    if (  weights_len > NUM_POOLS || total_weight <= 0
-       || total_size < CACHELINE_SIZE)
-        return -1;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+#endif
+}
 
-    for (i = 0 ; i < weights_len ; i++) {
-        if (weights[i] == 0)
-            continue;
 
-        elem_size = (1 << i) * CACHELINE_SIZE;
-        arena_size = ((elem_size * total_size * weights[i]) / total_weight);
-        pool = &pool_glob.pools[i];
-        pool->arena = arena_ptr;
-        arena_ptr += arena_size;
+static ALWAYS_INLINE uint64_t
+mpool_lat_start(void)
+{
+    pool_lat_slow = 0;
+    return mpool_ticks();
+}
 
-        mpool_init_arena(pool, elem_size, arena_size, i);
-    }
 
-    return 0;
+static ALWAYS_INLINE unsigned int
+mpool_lat_bucket(uint64_t ticks)
+{
+    unsigned int lg2, i;
+
+    if (ticks < LAT_STEPS)
+        return (unsigned int) ticks;
+
+    lg2 = 63 - (unsigned int) __builtin_clzll(ticks);
+    i = ((lg2 - LG2_LAT_STEPS + 1) << LG2_LAT_STEPS)
+        + (unsigned int) ((ticks >> (lg2 - LG2_LAT_STEPS)) & (LAT_STEPS - 1));
+
+    return MIN(i, NUM_LAT_BUCKETS - 1);
 }
 
 
-NOINLINE
-void mpool_destroy(void)
+/* the most ticks a bucket counts */
+static uint64_t
+mpool_lat_bucket_max(unsigned int i)
 {
-    int i;
-    struct mpool * pool;
+    unsigned int lg2;
 
-    for (i = 0 ; i < NUM_POOLS ; i++) {
-        pool = &pool_glob.pools[i];
-        if (pool->arena != NULL) {
-            MPOOL_DESTROY_MEMPOOL(MPOOL_GET(i));
-        }
-    }
+    if (i < LAT_STEPS)
+        return i;
+
+    lg2 = (i >> LG2_LAT_STEPS) + LG2_LAT_STEPS - 1;
+
+    return ((uint64_t) (LAT_STEPS + (i & (LAT_STEPS - 1)) + 1)
+            << (lg2 - LG2_LAT_STEPS)) - 1;
 }
 
 
-static ALWAYS_INLINE int
-mpool_get_pool_index(size_t _size)
+/* take the histograms an exited thread left, or map new ones */
+static struct mpool_lat_thread *
+mpool_lat_claim(void)
 {
-    uint64_t size = _size;
+    int in_use;
+    struct mpool_lat_thread * lat;
 
-    if (size <= CACHELINE_SIZE)
-        return 0;
+    for (lat = __atomic_load_n(&pool_lat_threads, __ATOMIC_ACQUIRE) ;
+         lat != NULL ; lat = lat->next) {
+        in_use = 0;
+        if (__atomic_compare_exchange_n(&lat->in_use, &in_use, 1, 0,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return lat;
+    }
 
-    return 64 - LG2_CACHELINE_SIZE - __builtin_clzll(size - 1);
+    lat = mmap(NULL, sizeof(*lat), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (lat == MAP_FAILED)
+        return NULL;
+
+    lat->in_use = 1;
+    lat->next = __atomic_load_n(&pool_lat_threads, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&pool_lat_threads, &lat->next, lat, 0,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+
+    return lat;
 }
 
 
-static int
-mpool_fill_cache(struct mpool_cpu_cache * cache, struct mpool * pool)
+static NOINLINE void
+mpool_lat_record(int call, int pool_index, uint64_t ticks)
 {
-    int i;
-    void * ptr, * tmp;
+    unsigned int i;
+    struct mpool_lat_hist * hist;
 
-    assert(pool != NULL);
-    assert(cache != NULL);
-    assert(cache->free == NULL);
+    if (unlikely(pool_index < 0))
+        return;
 
-    if (pthread_mutex_lock(&pool->lock) != 0)
-        return -1;
+    if (unlikely(pool_lat == NULL)) {
+        pool_lat = mpool_lat_claim();
+        if (pool_lat == NULL)
+            return;
 
-    if (unlikely(pool->num_free < MPOOL_CACHE_SIZE)) {
-        pthread_mutex_unlock(&pool->lock);
-        return ENOMEM;
+        /* to give them up on exit */
+        if (pthread_getspecific(pool_glob.cache_key) == NULL)
+            pthread_setspecific(pool_glob.cache_key, pool_cache);
     }
 
-    for (i = 0 ; i < MPOOL_CACHE_SIZE ; i++) {
-        ptr = pool->free;
-        pool->free = pool->free->next;
+    hist = &pool_lat->hist[call][pool_lat_slow][pool_index];
+    i = mpool_lat_bucket(ticks);
+    __atomic_store_n(&hist->buckets[i],
+            __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED) + 1,
+            __ATOMIC_RELAXED);
+    if (ticks > __atomic_load_n(&hist->max, __ATOMIC_RELAXED))
+        __atomic_store_n(&hist->max, ticks, __ATOMIC_RELAXED);
+}
 
-        tmp = cache->free;
-        cache->free = ptr;
-        cache->free->next = tmp;
-    }
 
-    pool->num_free -= MPOOL_CACHE_SIZE;
-    cache->num_free += MPOOL_CACHE_SIZE;
+static void
+mpool_lat_release(void)
+{
+    if (pool_lat == NULL)
+        return;
 
-    pthread_mutex_unlock(&pool->lock);
-    return 0;
+    __atomic_store_n(&pool_lat->in_use, 0, __ATOMIC_RELEASE);
+    pool_lat = NULL;
 }
 
 
-__attribute__((malloc))
-__attribute__((alloc_size(1)))
-void *
-mpool_alloc(size_t size, int flags)
+/* the threads which did not follow in the child leave their histograms */
+static void
+mpool_lat_fork_child(void)
 {
-    void * ptr;
-    int pool_index;
-    struct mpool_cpu_cache * cache;
+    struct mpool_lat_thread * lat;
 
-    (void) flags; /* for later user */
+    for (lat = pool_lat_threads ; lat != NULL ; lat = lat->next) {
+        if (lat != pool_lat)
+            lat->in_use = 0;
+    }
+}
 
-    pool_index = mpool_get_pool_index(size);
-    if (unlikely(pool_index >= NUM_POOLS))
-        return NULL;
+#endif /* MPOOL_LATENCY */
 
-    cache = &pool_cache[pool_index];
 
-    if (cache->num_free == 0) {
-        if (unlikely(mpool_fill_cache(cache, &pool_glob.pools[pool_index])))
-            return NULL;
+static ALWAYS_INLINE uint32_t
+mpool_batch_ref(struct mpool const * pool, struct chunk_batch const * batch)
+{
+    if (batch == NULL)
+        return 0;
 
-        assert(cache->num_free == MPOOL_CACHE_SIZE);
-    }
+    return (uint32_t) (((uint8_t const *) batch - pool->arena)
+                       >> LG2_BATCH_REF_UNIT) + 1;
+}
 
-    ptr = cache->free;
-    cache->free = cache->free->next;
-    cache->num_free -= 1;
 
-    MPOOL_MEMPOOL_ALLOC(MPOOL_GET(pool_index), ptr, cache->elem_size);
-    MPOOL_MAKE_MEM_UNDEFINED(ptr, size);
-    MPOOL_MAKE_MEM_NOACCESS((uint8_t *) ptr + size, cache->elem_size - size);
+static ALWAYS_INLINE struct chunk_batch *
+mpool_batch_ptr(struct mpool const * pool, uint32_t ref)
+{
+    if (ref == 0)
+        return NULL;
 
-    return ptr;
+    return VOIDPTR(pool->arena + ((size_t) (ref - 1) << LG2_BATCH_REF_UNIT));
 }
 
 
+#ifdef MPOOL_CENTRAL_LOCK
+
 static void
-mpool_empty_cache(struct mpool_cpu_cache * cache, struct mpool * pool)
+mpool_central_init(struct mpool * pool)
 {
-    int i;
-    void * ptr, * tmp;
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->free = 0;
+}
 
-    assert(pool != NULL);
-    assert(cache != NULL);
 
-    if (pthread_mutex_lock(&pool->lock) != 0)
+static void
+mpool_central_lock(struct mpool * pool)
+{
+    if (pthread_mutex_trylock(&pool->lock) == 0)
         return;
 
-    for (i = 0 ; i < MPOOL_CACHE_SIZE ; i++) {
-        ptr = cache->free;
-        cache->free = cache->free->next;
+    MPOOL_STAT_ADD(&pool->counters, contended, 1);
+    pthread_mutex_lock(&pool->lock);
+}
+
+
+static void
+mpool_central_push(struct mpool * pool, struct chunk_batch * batch)
+{
+    mpool_central_lock(pool);
+    batch->next_batch = pool->free;
+    pool->free = mpool_batch_ref(pool, batch);
+    pool->num_free += batch->num;
+    pthread_mutex_unlock(&pool->lock);
+}
 
-        tmp = pool->free;
-        pool->free = ptr;
-        pool->free->next = tmp;
-    }
 
-    cache->num_free -= MPOOL_CACHE_SIZE;
-    pool->num_free += MPOOL_CACHE_SIZE;
+static struct chunk_batch *
+mpool_central_pop(struct mpool * pool)
+{
+    struct chunk_batch * batch;
 
+    mpool_central_lock(pool);
+    batch = mpool_batch_ptr(pool, pool->free);
+    if (batch != NULL) {
+        pool->free = batch->next_batch;
+        pool->num_free -= batch->num;
+    }
     pthread_mutex_unlock(&pool->lock);
+
+    return batch;
 }
 
+#else /* MPOOL_CENTRAL_LOCK */
 
-void mpool_free(void const * ptr, size_t size)
+/*
+ * The pool free list is a Treiber stack of chunk batches. Its head packs a
+ * batch reference with a tag bumped on every update so that a batch popped
+ * and pushed back between the load and the CAS of another thread does not
+ * go unnoticed (ABA).
+ * The next batch reference of a popped batch may be read after another thread
+ * took it, and wrote to it or purged its pages: the read is stale, or zero
+ * past a purge, and the tag makes the CAS fail in that case. Such a read never
+ * faults: only chunks off the list are purged, and the arena or reserve stays
+ * mapped until the instance is destroyed.
+ */
+#define HEAD_REF(head) ((uint32_t) (head))
+#define HEAD_TAG(head) ((uint32_t) ((head) >> 32))
+#define HEAD(tag, ref) (((uint64_t) (tag) << 32) | (ref))
+
+static void
+mpool_central_init(struct mpool * pool)
 {
-    int pool_index;
-    struct mpool_cpu_cache * cache;
-    struct chunk_list * tmp;
+    pool->free = HEAD(0, 0);
+}
 
-    if (ptr == NULL)
-        return;
 
-    pool_index = mpool_get_pool_index(size);
-    cache = &pool_cache[pool_index];
-    assert(pool_index < NUM_POOLS);
+static void
+mpool_central_push(struct mpool * pool, struct chunk_batch * batch)
+{
+    uint64_t head, new_head;
+    uint32_t ref, num;
+    size_t retries;
 
-    MPOOL_MEMPOOL_FREE(MPOOL_GET(pool_index), ptr);
-    MPOOL_MAKE_MEM_DEFINED(ptr, sizeof(uintptr_t));
+    /* the batch belongs to the thread which pops it once pushed */
+    num = batch->num;
+    ref = mpool_batch_ref(pool, batch);
+    head = __atomic_load_n(&pool->free, __ATOMIC_RELAXED);
+    for (retries = 0 ; ; retries++) {
+        /* atomic as the load of the popping threads */
+        __atomic_store_n(&batch->next_batch, HEAD_REF(head), __ATOMIC_RELAXED);
+        new_head = HEAD(HEAD_TAG(head) + 1, ref);
+        if (__atomic_compare_exchange_n(&pool->free, &head, new_head, 1,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            break;
+    }
 
-    tmp = cache->free;
-    cache->free = VOIDPTR(ptr);
-    cache->free->next = tmp;
-    cache->num_free += 1;
+    __atomic_fetch_add(&pool->num_free, num, __ATOMIC_RELAXED);
+    if (retries > 0)
+        MPOOL_STAT_ADD(&pool->counters, contended, retries);
+}
 
-    if (cache->num_free > 2 * MPOOL_CACHE_SIZE)
-        mpool_empty_cache(cache, &pool_glob.pools[pool_index]);
 
-    return;
+/* next batch reference of a batch seen at the head of the free list, read
+ * while other threads may pop the batch and write to it or purge it. The race
+ * is the stale read above, which the sanitizer cannot tell from a real one */
+static inline NO_SANITIZE_THREAD uint32_t
+mpool_batch_next(struct chunk_batch const * batch)
+{
+    return __atomic_load_n(&batch->next_batch, __ATOMIC_RELAXED);
 }
 
 
-void * mpool_realloc(void const * ptr, size_t old_size, size_t new_size, int
-        flags)
+static struct chunk_batch *
+mpool_central_pop(struct mpool * pool)
 {
-    void * tmp;
+    uint64_t head, new_head;
+    size_t retries;
+    struct chunk_batch * batch;
 
-    assert(ptr != NULL || old_size == 0);
-    if (unlikely(ptr == NULL && old_size != 0))
-        return NULL;
+    head = __atomic_load_n(&pool->free, __ATOMIC_ACQUIRE);
+    for (retries = 0 ; ; retries++) {
+        batch = mpool_batch_ptr(pool, HEAD_REF(head));
+        if (batch == NULL)
+            break;
 
-    if (  ptr != NULL
-       && mpool_get_pool_index(old_size) == mpool_get_pool_index(new_size)) {
-        MPOOL_MAKE_MEM_UNDEFINED((const uint8_t *) ptr + old_size, new_size -
-                old_size);
-        return VOIDPTR(ptr);
+        new_head = HEAD(HEAD_TAG(head) + 1, mpool_batch_next(batch));
+        if (__atomic_compare_exchange_n(&pool->free, &head, new_head, 1,
+                __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+            break;
     }
 
-    tmp = mpool_alloc(new_size, flags);
-    if (likely(tmp != NULL)) {
-        if (ptr != NULL)
-            memcpy(tmp, ptr, MIN(old_size, new_size));
+    if (retries > 0)
+        MPOOL_STAT_ADD(&pool->counters, contended, retries);
 
-        mpool_free(ptr, old_size);
-    }
+    if (batch != NULL)
+        __atomic_fetch_sub(&pool->num_free, batch->num, __ATOMIC_RELAXED);
 
-    return tmp;
+    return batch;
 }
 
+#endif /* MPOOL_CENTRAL_LOCK */
 
-NOINLINE void
-mpool_stats(void)
+
+/* cut list after its first num chunks, and return the remainder */
+static struct chunk_list *
+mpool_list_split(struct chunk_list * list, unsigned int num)
 {
-    int i;
-    size_t num_elem;
-    struct mpool * pool;
+    unsigned int i;
+    struct chunk_list * last, * tail;
 
-    for (i = 0 ; i < NUM_POOLS ; i++) {
-        pool = &pool_glob.pools[i];
-        num_elem = pool->arena_size / pool->elem_size;
-        printf("pool[%zd] %zd/%zd\n", pool->elem_size,
-                num_elem - pool->num_free, num_elem);
-    }
+    assert(num > 0);
+
+    last = list;
+    for (i = 1 ; i < num ; i++)
+        last = last->next;
+
+    tail = last->next;
+    last->next = NULL;
+
+    return tail;
+}
+
+
+/* push a batch to an owner inbox */
+static void
+mpool_inbox_push(struct mpool const * pool, uint32_t * inbox,
+        struct chunk_batch * batch)
+{
+    uint32_t head, ref;
+
+    ref = mpool_batch_ref(pool, batch);
+    head = __atomic_load_n(inbox, __ATOMIC_RELAXED);
+    do {
+        batch->next_batch = head;
+    } while (!__atomic_compare_exchange_n(inbox, &head, ref, 1,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+/* pop a batch from the inbox of the calling thread */
+static struct chunk_batch *
+mpool_inbox_pop(struct mpool const * pool, uint32_t * inbox)
+{
+    uint32_t head;
+    struct chunk_batch * batch;
+
+    head = __atomic_load_n(inbox, __ATOMIC_ACQUIRE);
+    do {
+        batch = mpool_batch_ptr(pool, head);
+        if (batch == NULL)
+            return NULL;
+    } while (!__atomic_compare_exchange_n(inbox, &head, batch->next_batch, 1,
+            __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    return batch;
+}
+
+
+/* hand the chunks a thread cache holds for another thread to their owner. An
+ * owner which exited since they were freed emptied its inboxes for the last
+ * time, they go to the central free list instead */
+static void
+mpool_remote_flush(struct mpool_ctx * ctx, struct mpool_cpu_cache * cache,
+        int pool_index)
+{
+    struct chunk_batch * batch;
+
+    assert(cache->num_remote > 0);
+
+    MPOOL_LAT_SLOW_PATH();
+    batch = (struct chunk_batch *) cache->remote;
+    batch->num = cache->num_remote;
+    if (__atomic_load_n(&pool_glob.owner_used[cache->remote_owner],
+            __ATOMIC_RELAXED))
+        mpool_inbox_push(&ctx->pools[pool_index],
+                &ctx->inbox[cache->remote_owner].batches[pool_index], batch);
+    else
+        mpool_central_push(&ctx->pools[pool_index], batch);
+
+    MPOOL_STAT_ADD(&ctx->pools[pool_index].counters, flushes, 1);
+
+    cache->remote = NULL;
+    cache->num_remote = 0;
+}
+
+
+/* make [start, start + size) the carving region of the pool */
+static void
+mpool_carve_region(struct mpool * pool, uint8_t * start, size_t size)
+{
+    size_t offset;
+
+    assert(start >= pool->arena);
+
+    offset = (size_t) (start - pool->arena);
+    assert((offset + size) >> LG2_BATCH_REF_UNIT < UINT32_MAX);
+
+    __atomic_store_n(&pool->carve, CARVE(offset >> LG2_BATCH_REF_UNIT,
+            (offset + size) >> LG2_BATCH_REF_UNIT), __ATOMIC_RELEASE);
+}
+
+
+/* add [start, start + size) to the pool, to be carved */
+static void
+mpool_add_region(struct mpool * pool, uint8_t * start, size_t size)
+{
+    pool->arena_size += size;
+    __atomic_fetch_add(&pool->num_chunks, size / pool->elem_size,
+            __ATOMIC_RELAXED);
+    mpool_carve_region(pool, start, size);
+}
+
+
+/* chunks of the carving region, never used yet. The region of unused size
+ * classes is empty */
+static size_t
+mpool_num_uncarved(struct mpool const * pool)
+{
+    uint64_t carve;
+
+    carve = __atomic_load_n(&pool->carve, __ATOMIC_RELAXED);
+    if (CARVE_END(carve) == CARVE_NEXT(carve))
+        return 0;
+
+    return ((size_t) (CARVE_END(carve) - CARVE_NEXT(carve))
+            << LG2_BATCH_REF_UNIT) / pool->elem_size;
+}
+
+
+/* chunks out of the pool, allocated or held by caches */
+static size_t
+mpool_num_used(struct mpool const * pool)
+{
+    size_t num_chunks, num_free;
+
+    num_free = __atomic_load_n(&pool->num_free, __ATOMIC_RELAXED)
+               + mpool_num_uncarved(pool)
+               + __atomic_load_n(&pool->num_purged, __ATOMIC_RELAXED);
+    num_chunks = __atomic_load_n(&pool->num_chunks, __ATOMIC_RELAXED);
+
+    /* the counts are not read at once */
+    return num_chunks > num_free ? num_chunks - num_free : 0;
+}
+
+
+static void
+mpool_stats_high_water(struct mpool * pool)
+{
+#ifndef MPOOL_NO_STATS
+    size_t used, high;
+
+    used = mpool_num_used(pool);
+    high = __atomic_load_n(&pool->counters.high_water, __ATOMIC_RELAXED);
+    while (  used > high
+          && !__atomic_compare_exchange_n(&pool->counters.high_water, &high,
+                  used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+#else
+    (void) pool;
+#endif
+}
+
+
+/* take up to num chunks from the front of the carving region, threaded in
+ * address order. Only these chunks are written to, the pages of the region
+ * are faulted in as it gets carved. NULL once it is used up */
+static struct chunk_batch *
+mpool_carve(struct mpool * pool, unsigned int num)
+{
+    uint64_t carve, new_carve;
+    size_t i, n, next, end;
+    struct chunk_list * list, * chunk;
+    struct chunk_batch * batch;
+
+    carve = __atomic_load_n(&pool->carve, __ATOMIC_ACQUIRE);
+    do {
+        next = (size_t) CARVE_NEXT(carve) << LG2_BATCH_REF_UNIT;
+        end = (size_t) CARVE_END(carve) << LG2_BATCH_REF_UNIT;
+        if (end == next)
+            return NULL;
+
+        n = MIN(num, (end - next) / pool->elem_size);
+        if (n == 0)
+            return NULL;
+
+        new_carve = CARVE((next + n * pool->elem_size) >> LG2_BATCH_REF_UNIT,
+                CARVE_END(carve));
+    } while (!__atomic_compare_exchange_n(&pool->carve, &carve, new_carve, 1,
+            __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    list = NULL;
+    for (i = n ; i-- > 0 ; ) {
+        chunk = VOIDPTR(pool->arena + next + i * pool->elem_size);
+        chunk->next = list;
+        list = chunk;
+    }
+
+    batch = (struct chunk_batch *) list;
+    batch->num = (uint32_t) n;
+
+    return batch;
+}
+
+
+static void
+mpool_init_arena(struct mpool * pool, size_t elem_size, size_t arena_size)
+{
+    assert(pool != NULL);
+
+    pool->arena_size = 0;
+    pool->num_chunks = 0;
+    pool->elem_size = elem_size;
+    pool->min_batch = MIN(MAX(MPOOL_CACHE_MIN_BYTES / elem_size,
+            MPOOL_CACHE_MIN_BATCH), MPOOL_CACHE_MAX_BATCH);
+    pool->max_batch = MIN(MAX(MPOOL_CACHE_MAX_BYTES / elem_size,
+            pool->min_batch), MPOOL_CACHE_MAX_BATCH);
+    pool->percpu_batch = MIN(MAX(MPOOL_PERCPU_BYTES / elem_size,
+            pool->min_batch), pool->max_batch);
+    mpool_central_init(pool);
+    pool->carve = CARVE(0, 0);
+    pool->spans = NULL;
+    pool->num_purged = 0;
+    pool->purging = 0;
+    pool->cache_chunks = 0;
+    if (arena_size > 0)
+        mpool_add_region(pool, pool->arena, arena_size);
+
+    MPOOL_CREATE_MEMPOOL(MPOOL_GET(pool), 0, 0);
+}
+
+
+/* reserve the address space of a growable instance. Its front holds the large
+ * tier page map, the rest is committed by segments */
+static int
+mpool_reserve(struct mpool_ctx * ctx, size_t size, int has_large)
+{
+    size_t map_size, num_segments, pages_offset;
+    uint8_t * reserve;
+    uintptr_t start;
+
+    size = (size + SEGMENT_SIZE - 1) & ~(SEGMENT_SIZE - 1);
+    if (size == 0 || size >> LG2_BATCH_REF_UNIT >= UINT32_MAX)
+        return EINVAL;
+
+    /* segment aligned */
+    reserve = mmap(NULL, size + SEGMENT_SIZE, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserve == MAP_FAILED)
+        return ENOMEM;
+
+    start = ((uintptr_t) reserve + SEGMENT_SIZE - 1) & ~(SEGMENT_SIZE - 1);
+    if (start > (uintptr_t) reserve)
+        munmap(reserve, start - (uintptr_t) reserve);
+
+    munmap((uint8_t *) start + size,
+            (uintptr_t) reserve + SEGMENT_SIZE - start);
+
+    ctx->reserve = (uint8_t *) start;
+    ctx->reserve_size = size;
+    ctx->reserve_used = 0;
+
+    /* segment map, then the large tier page map */
+    num_segments = size >> LG2_SEGMENT_SIZE;
+    pages_offset = (num_segments + CACHELINE_SIZE - 1)
+                   & ~((size_t) CACHELINE_SIZE - 1);
+    map_size = pages_offset;
+    if (has_large)
+        map_size += (size >> LG2_PAGE_SIZE) * sizeof(struct mpool_page);
+
+    map_size = (map_size + SEGMENT_SIZE - 1) & ~(SEGMENT_SIZE - 1);
+    if (  map_size >= size
+       || mprotect(ctx->reserve, map_size, PROT_READ | PROT_WRITE) != 0) {
+        munmap(ctx->reserve, size);
+        return ENOMEM;
+    }
+
+    ctx->reserve_used = map_size;
+    ctx->base = start;
+    ctx->segment_pool = ctx->reserve;
+    memset(ctx->segment_pool, UINT8_MAX, num_segments);
+
+    if (has_large) {
+        mpool_large_setup(&ctx->large, VOIDPTR(ctx->reserve + pages_offset),
+                ctx->reserve, size >> LG2_PAGE_SIZE);
+    }
+
+    return 0;
+}
+
+
+/* commit the next segments of the reserve to a size class, or the large tier,
+ * with the grow lock held */
+static void *
+mpool_commit_segments(struct mpool_ctx * ctx, size_t size, int pool_index)
+{
+    uint8_t * ptr;
+
+    size = (size + SEGMENT_SIZE - 1) & ~(SEGMENT_SIZE - 1);
+    if (size > ctx->reserve_size - ctx->reserve_used)
+        return NULL;
+
+    ptr = ctx->reserve + ctx->reserve_used;
+    if (mprotect(ptr, size, PROT_READ | PROT_WRITE) != 0)
+        return NULL;
+
+    memset(ctx->segment_pool + (ctx->reserve_used >> LG2_SEGMENT_SIZE),
+            pool_index, size >> LG2_SEGMENT_SIZE);
+    ctx->reserve_used += size;
+    return ptr;
+}
+
+
+/* give a segment to a size class to carve, unless another thread just did or
+ * a purge just left a span to carve */
+static int
+mpool_grow(struct mpool_ctx * ctx, struct mpool * pool)
+{
+    int rv;
+    uint8_t * segment;
+
+    if (!(ctx->flags & MPOOL_GROW) || pool->elem_size == 0)
+        return ENOMEM;
+
+    rv = 0;
+    pthread_mutex_lock(&ctx->grow_lock);
+    if (  mpool_num_uncarved(pool) == 0
+       && __atomic_load_n(&pool->spans, __ATOMIC_RELAXED) == NULL) {
+        segment = mpool_commit_segments(ctx, SEGMENT_SIZE,
+                (int) (pool - ctx->pools));
+        if (segment != NULL)
+            mpool_add_region(pool, segment, SEGMENT_SIZE);
+        else
+            rv = ENOMEM;
+    }
+
+    pthread_mutex_unlock(&ctx->grow_lock);
+
+    return rv;
+}
+
+
+/* add segments to the large tier, big enough for a size bytes run */
+static int
+mpool_grow_large(struct mpool_ctx * ctx, size_t size)
+{
+    uint8_t * segment;
+
+    if (!(ctx->flags & MPOOL_GROW))
+        return ENOMEM;
+
+    size = (size + SEGMENT_SIZE - 1) & ~(SEGMENT_SIZE - 1);
+
+    pthread_mutex_lock(&ctx->grow_lock);
+    segment = mpool_commit_segments(ctx, size, NUM_POOLS);
+    if (segment != NULL)
+        mpool_large_add(&ctx->large, segment, size);
+
+    pthread_mutex_unlock(&ctx->grow_lock);
+
+    return segment != NULL ? 0 : ENOMEM;
+}
+
+
+static void *
+mpool_cache_align_ptr(void * ptr)
+{
+    uint8_t * _ptr;
+    _ptr = (uint8_t *) (((uintptr_t) ptr) & ~((1ULL <<
+                                               CONFIG_LOG2_CPU_CACHELINE_SIZE) -
+                                              1ULL));
+
+    if (ptr == _ptr)
+        return ptr;
+    else
+        return _ptr + CACHELINE_SIZE;
+}
+
+
+/* set the batch size of a thread cache. A cache holds up to twice its batch,
+ * the growth of all the caches above their minimum size is capped by the
+ * instance cache limit, and by the share of its size class */
+static void
+mpool_cache_resize(struct mpool_ctx * ctx, struct mpool_cpu_cache * cache,
+        struct mpool * pool, unsigned int batch)
+{
+    size_t num, delta;
+
+    if (batch > cache->batch) {
+        num = 2 * (size_t) (batch - cache->batch);
+        delta = num * pool->elem_size;
+        if (  __atomic_add_fetch(&pool->cache_chunks, num, __ATOMIC_RELAXED)
+              > __atomic_load_n(&pool->num_chunks, __ATOMIC_RELAXED)
+                >> LG2_CACHE_CLASS_SHARE) {
+            __atomic_sub_fetch(&pool->cache_chunks, num, __ATOMIC_RELAXED);
+            return;
+        }
+
+        if (  __atomic_add_fetch(&ctx->cache_size, delta, __ATOMIC_RELAXED)
+              > __atomic_load_n(&ctx->cache_limit, __ATOMIC_RELAXED)) {
+            __atomic_sub_fetch(&ctx->cache_size, delta, __ATOMIC_RELAXED);
+            __atomic_sub_fetch(&pool->cache_chunks, num, __ATOMIC_RELAXED);
+            return;
+        }
+    } else {
+        num = 2 * (size_t) (cache->batch - batch);
+        __atomic_sub_fetch(&pool->cache_chunks, num, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&ctx->cache_size, num * pool->elem_size,
+                __ATOMIC_RELAXED);
+    }
+
+    cache->batch = batch;
+}
+
+
+/* the same for the thread cache of an object cache, which keeps count of
+ * what its caches grew the instance ones by */
+static void
+mpool_objcache_resize(struct mpool_objcache * objcache,
+        struct mpool_cpu_cache * cache, unsigned int batch)
+{
+    unsigned int old_batch;
+
+    old_batch = cache->batch;
+    mpool_cache_resize(objcache->ctx, cache, &objcache->pool, batch);
+
+    /* modulo arithmetic, the sum does not go below zero */
+    __atomic_add_fetch(&objcache->cache_size,
+            2 * ((size_t) cache->batch - old_batch)
+            * objcache->pool.elem_size, __ATOMIC_RELAXED);
+}
+
+
+static void
+mpool_numa_flush_frees(struct mpool_ctx * ctx, struct mpool_numa_frees * frees)
+{
+    __atomic_add_fetch(&ctx->local_frees, frees->local, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ctx->remote_frees, frees->remote, __ATOMIC_RELAXED);
+    frees->local = 0;
+    frees->remote = 0;
+}
+
+
+/* the inline fast path serves the default instance when its caches are plain
+ * thread caches, and the library does not watch every chunk */
+static void
+mpool_inline_update(void)
+{
+    unsigned int gen;
+    struct mpool_ctx const * ctx;
+
+    ctx = pool_glob.default_ctx;
+    gen = MPOOL_INLINE_NONE;
+    if (  ctx != NULL && ctx->num_nodes == 0 && ctx->percpu == NULL
+       && ctx->owner_map == NULL)
+        gen = ctx->gen;
+
+#if defined(MEMCHECK) || defined(MPOOL_LATENCY)
+    gen = MPOOL_INLINE_NONE;
+#endif
+
+    __atomic_store_n(&mpool_inline_gen, gen, __ATOMIC_RELAXED);
+}
+
+
+/* map a block of num thread caches, NULL when out of memory */
+static struct mpool_cpu_cache *
+mpool_map_caches(size_t num)
+{
+    void * caches;
+
+    caches = mmap(NULL, num * sizeof(struct mpool_cpu_cache),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return caches != MAP_FAILED ? caches : NULL;
+}
+
+
+static void
+mpool_unmap_caches(struct mpool_cpu_cache ** caches, size_t num)
+{
+    if (*caches == pool_cache_none)
+        return;
+
+    munmap(*caches, num * sizeof(struct mpool_cpu_cache));
+    *caches = pool_cache_none;
+}
+
+
+/* give the chunks cached by an exiting thread back to the pools of the live
+ * instances and object caches they belong to, or to their owners, add up its
+ * NUMA frees, and unmap its caches. The owner slot of the thread is released
+ * once its inboxes are emptied: the few chunks freed to it in the meantime
+ * wait for the next thread taking the slot */
+static void
+mpool_cache_destructor(void * arg)
+{
+    int i, j;
+    struct mpool * pool;
+    struct mpool_ctx * ctx;
+    struct mpool_cpu_cache * cache;
+    struct mpool_objcache * objcache;
+    struct chunk_batch * batch;
+    struct mpool_cpu_cache ** caches = arg;
+
+    pthread_mutex_lock(&pool_glob.lock);
+    for (i = 0 ; i < MPOOL_MAX_CTX ; i++) {
+        ctx = &pool_glob.ctx[i];
+        if (ctx->in_use && pool_numa_frees[i].gen == ctx->gen) {
+            mpool_numa_flush_frees(ctx, &pool_numa_frees[i]);
+            pool_numa_frees[i].gen = 0;
+        }
+
+        for (j = 0 ; ctx->in_use && j < NUM_POOLS ; j++) {
+            cache = &caches[i][j];
+            if (cache->gen != ctx->gen)
+                continue;
+
+            pool = &ctx->pools[j];
+            MPOOL_STATS_FOLD(pool, cache);
+            if (cache->num_free > 0) {
+                batch = (struct chunk_batch *) cache->free;
+                batch->num = cache->num_free;
+                mpool_central_push(pool, batch);
+            }
+
+            if (cache->num_remote > 0)
+                mpool_remote_flush(ctx, cache, j);
+
+            mpool_cache_resize(ctx, cache, pool, pool->min_batch);
+        }
+
+        if (!ctx->in_use || ctx->inbox == NULL || pool_owner <= 0)
+            continue;
+
+        for (j = 0 ; j < NUM_POOLS ; j++) {
+            pool = &ctx->pools[j];
+            if (pool->arena == NULL)
+                continue;
+
+            while ((batch = mpool_inbox_pop(pool,
+                    &ctx->inbox[pool_owner].batches[j])) != NULL)
+                mpool_central_push(pool, batch);
+        }
+    }
+
+    for (i = 0 ; i < MPOOL_MAX_OBJCACHES ; i++) {
+        objcache = &pool_glob.objcache[i];
+        cache = &pool_objcache[i];
+        if (!objcache->in_use || cache->gen != objcache->gen)
+            continue;
+
+        MPOOL_STATS_FOLD(&objcache->pool, cache);
+        if (cache->num_free > 0) {
+            batch = (struct chunk_batch *) cache->free;
+            batch->num = cache->num_free;
+            mpool_central_push(&objcache->pool, batch);
+        }
+
+        mpool_objcache_resize(objcache, cache, objcache->pool.min_batch);
+    }
+
+    if (pool_owner > 0)
+        __atomic_store_n(&pool_glob.owner_used[pool_owner], 0,
+                __ATOMIC_RELAXED);
+
+    pool_owner = -1;
+    MPOOL_LAT_RELEASE();
+
+    /* set up again if the thread keeps going */
+    memset(&mpool_inline_caches, 0, sizeof(mpool_inline_caches));
+    pthread_mutex_unlock(&pool_glob.lock);
+
+    for (i = 0 ; i < MPOOL_MAX_CTX ; i++)
+        mpool_unmap_caches(&caches[i], NUM_POOLS);
+
+    mpool_unmap_caches(&pool_objcache, MPOOL_MAX_OBJCACHES);
+}
+
+
+/* fork() handlers. Every lock is taken before the address space is copied,
+ * in the order they nest: the child gets no lock held by a thread it does not
+ * have. The lists updated with atomic instructions are whole at any time */
+static void
+mpool_fork_prepare(void)
+{
+    int i, j;
+    struct mpool_ctx * ctx;
+    struct mpool_objcache * objcache;
+
+    pthread_mutex_lock(&pool_glob.lock);
+
+    /* object caches grow from the large tier of their instance */
+    for (i = 0 ; i < MPOOL_MAX_OBJCACHES ; i++) {
+        objcache = &pool_glob.objcache[i];
+        if (!objcache->in_use)
+            continue;
+
+        pthread_mutex_lock(&objcache->grow_lock);
+#ifdef MPOOL_CENTRAL_LOCK
+        pthread_mutex_lock(&objcache->pool.lock);
+#endif
+    }
+
+    for (i = 0 ; i < MPOOL_MAX_CTX ; i++) {
+        ctx = &pool_glob.ctx[i];
+        if (!ctx->in_use)
+            continue;
+
+        pthread_mutex_lock(&ctx->purge_lock);
+        pthread_mutex_lock(&ctx->grow_lock);
+        if (ctx->has_large)
+            mpool_large_fork_prepare(&ctx->large);
+
+        pthread_mutex_lock(&ctx->span_lock);
+#ifdef MPOOL_CENTRAL_LOCK
+        for (j = 0 ; j < NUM_POOLS ; j++)
+            pthread_mutex_lock(&ctx->pools[j].lock);
+#endif
+
+        for (j = 0 ; ctx->percpu != NULL && ctx->percpu_locked
+                     && j < ctx->percpu_rows ; j++) {
+            while (__atomic_exchange_n(&ctx->percpu[j].lock, 1,
+                    __ATOMIC_ACQUIRE))
+                sched_yield();
+        }
+    }
+}
+
+
+static void
+mpool_fork_parent(void)
+{
+    int i, j;
+    struct mpool_ctx * ctx;
+    struct mpool_objcache * objcache;
+
+    for (i = MPOOL_MAX_CTX - 1 ; i >= 0 ; i--) {
+        ctx = &pool_glob.ctx[i];
+        if (!ctx->in_use)
+            continue;
+
+        for (j = 0 ; ctx->percpu != NULL && ctx->percpu_locked
+                     && j < ctx->percpu_rows ; j++)
+            __atomic_store_n(&ctx->percpu[j].lock, 0, __ATOMIC_RELEASE);
+
+#ifdef MPOOL_CENTRAL_LOCK
+        for (j = 0 ; j < NUM_POOLS ; j++)
+            pthread_mutex_unlock(&ctx->pools[j].lock);
+#endif
+        pthread_mutex_unlock(&ctx->span_lock);
+        if (ctx->has_large)
+            mpool_large_fork_parent(&ctx->large);
+
+        pthread_mutex_unlock(&ctx->grow_lock);
+        pthread_mutex_unlock(&ctx->purge_lock);
+    }
+
+    for (i = MPOOL_MAX_OBJCACHES - 1 ; i >= 0 ; i--) {
+        objcache = &pool_glob.objcache[i];
+        if (!objcache->in_use)
+            continue;
+
+#ifdef MPOOL_CENTRAL_LOCK
+        pthread_mutex_unlock(&objcache->pool.lock);
+#endif
+        pthread_mutex_unlock(&objcache->grow_lock);
+    }
+
+    pthread_mutex_unlock(&pool_glob.lock);
+}
+
+
+/* chunks a cache of the forking thread grew by */
+static size_t
+mpool_fork_grown(struct mpool_cpu_cache const * cache,
+        struct mpool const * pool, unsigned int gen)
+{
+    if (cache->gen != gen)
+        return 0;
+
+    return 2 * (size_t) (cache->batch - pool->min_batch);
+}
+
+
+/* what the caches of the forking thread grew by, the only ones left, per size
+ * class and in bytes. Those of the object caches of the instance are counted
+ * already */
+static size_t
+mpool_fork_cache_size(struct mpool_ctx * ctx)
+{
+    int j;
+    size_t size;
+    struct mpool * pool;
+    struct mpool_objcache const * objcache;
+
+    size = 0;
+    for (j = 0 ; j < NUM_POOLS ; j++) {
+        pool = &ctx->pools[j];
+        pool->cache_chunks = mpool_fork_grown(&pool_cache[ctx->id][j], pool,
+                ctx->gen);
+        size += pool->cache_chunks * pool->elem_size;
+    }
+
+    for (j = 0 ; j < MPOOL_MAX_OBJCACHES ; j++) {
+        objcache = &pool_glob.objcache[j];
+        if (objcache->in_use && objcache->ctx == ctx)
+            size += objcache->cache_size;
+    }
+
+    return size;
+}
+
+
+/* the child has the locks anew, and only the forking thread: the owner slots
+ * of the other threads are released. The caches of MPOOL_FORK_DROP_CACHES
+ * instances, and of their object caches, are dropped with a new generation,
+ * without touching the chunks they hold, which are lost to the child */
+static void
+mpool_fork_child(void)
+{
+    int i, j;
+    struct mpool_ctx * ctx;
+    struct mpool_objcache * objcache;
+
+    for (i = 0 ; i < MPOOL_MAX_OBJCACHES ; i++) {
+        objcache = &pool_glob.objcache[i];
+        if (!objcache->in_use)
+            continue;
+
+        pthread_mutex_init(&objcache->grow_lock, NULL);
+#ifdef MPOOL_CENTRAL_LOCK
+        pthread_mutex_init(&objcache->pool.lock, NULL);
+#endif
+
+        if (objcache->ctx->flags & MPOOL_FORK_DROP_CACHES) {
+            objcache->gen = ++pool_glob.gen;
+            if (objcache->gen == 0)
+                objcache->gen = ++pool_glob.gen;
+        }
+
+        objcache->pool.cache_chunks = mpool_fork_grown(&pool_objcache[i],
+                &objcache->pool, objcache->gen);
+        objcache->cache_size = objcache->pool.cache_chunks
+                               * objcache->pool.elem_size;
+    }
+
+    for (i = 0 ; i < MPOOL_MAX_CTX ; i++) {
+        ctx = &pool_glob.ctx[i];
+        if (!ctx->in_use)
+            continue;
+
+        pthread_mutex_init(&ctx->purge_lock, NULL);
+        pthread_mutex_init(&ctx->grow_lock, NULL);
+        if (ctx->has_large)
+            mpool_large_fork_child(&ctx->large);
+
+        pthread_mutex_init(&ctx->span_lock, NULL);
+#ifdef MPOOL_CENTRAL_LOCK
+        for (j = 0 ; j < NUM_POOLS ; j++)
+            pthread_mutex_init(&ctx->pools[j].lock, NULL);
+#endif
+
+        for (j = 0 ; ctx->percpu != NULL && ctx->percpu_locked
+                     && j < ctx->percpu_rows ; j++)
+            ctx->percpu[j].lock = 0;
+
+        if (ctx->flags & MPOOL_FORK_DROP_CACHES) {
+            ctx->gen = ++pool_glob.gen;
+            if (ctx->gen == 0)
+                ctx->gen = ++pool_glob.gen;
+        }
+
+        ctx->cache_size = mpool_fork_cache_size(ctx);
+    }
+
+    for (i = 1 ; i < MPOOL_MAX_OWNERS ; i++) {
+        if (i != pool_owner)
+            pool_glob.owner_used[i] = 0;
+    }
+
+    MPOOL_LAT_FORK_CHILD();
+    mpool_inline_update();
+    pthread_mutex_init(&pool_glob.lock, NULL);
+}
+
+
+static void
+mpool_glob_init(void)
+{
+    int rv;
+
+    rv = pthread_key_create(&pool_glob.cache_key, mpool_cache_destructor);
+    assert(rv == 0);
+    rv = pthread_atfork(mpool_fork_prepare, mpool_fork_parent,
+            mpool_fork_child);
+    assert(rv == 0);
+    (void) rv;
+}
+
+
+static struct mpool_ctx *
+mpool_ctx_get_slot(void)
+{
+    int i;
+    struct mpool_ctx * ctx;
+
+    pthread_once(&pool_glob.once, mpool_glob_init);
+
+    ctx = NULL;
+    pthread_mutex_lock(&pool_glob.lock);
+    for (i = 0 ; i < MPOOL_MAX_CTX ; i++) {
+        if (!pool_glob.ctx[i].in_use) {
+            ctx = &pool_glob.ctx[i];
+            memset(ctx->pools, 0, sizeof(ctx->pools));
+            ctx->has_large = 0;
+            ctx->reserve = NULL;
+            ctx->segment_pool = NULL;
+            ctx->percpu = NULL;
+            ctx->inbox = NULL;
+            ctx->owner_map = NULL;
+            pthread_mutex_init(&ctx->purge_lock, NULL);
+            pthread_mutex_init(&ctx->span_lock, NULL);
+            pthread_mutex_init(&ctx->grow_lock, NULL);
+            ctx->decay = 0;
+            ctx->next_purge = 0;
+            ctx->purged = 0;
+            ctx->num_nodes = 0;
+            ctx->local_frees = 0;
+            ctx->remote_frees = 0;
+            ctx->cache_limit = MPOOL_CACHE_LIMIT;
+            ctx->cache_size = 0;
+            ctx->id = (unsigned int) i;
+            ctx->gen = ++pool_glob.gen;
+            if (ctx->gen == 0)
+                ctx->gen = ++pool_glob.gen;
+
+            ctx->in_use = 1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&pool_glob.lock);
+
+    return ctx;
+}
+
+
+static void
+mpool_ctx_put_slot(struct mpool_ctx * ctx)
+{
+    pthread_mutex_lock(&pool_glob.lock);
+    ctx->in_use = 0;
+    pthread_mutex_unlock(&pool_glob.lock);
+}
+
+
+/* chunk size of a size class */
+static size_t
+mpool_class_size(int pool_index)
+{
+    size_t base;
+
+    if (pool_index <= NUM_TINY_CLASSES)
+        return (size_t) (pool_index + 1) << LG2_TINY_CLASS_SIZE;
+
+    pool_index -= NUM_TINY_CLASSES + 1;
+    base = (size_t) CACHELINE_SIZE << (pool_index / CLASS_STEPS);
+    return base + (size_t) (pool_index % CLASS_STEPS + 1)
+           * (base >> LG2_CLASS_STEPS);
+}
+
+
+/* doubling, and weight, a size class belongs to. The tiny classes share the
+ * cacheline size one */
+static int
+mpool_class_bin(int pool_index)
+{
+    if (pool_index <= NUM_TINY_CLASSES)
+        return 0;
+
+    return (pool_index - NUM_TINY_CLASSES - 1) / CLASS_STEPS + 1;
+}
+
+
+/* the tiny classes are only used with MPOOL_TINY_CLASSES, and only the last
+ * class of each doubling with MPOOL_POW2_CLASSES */
+static int
+mpool_class_used(struct mpool_ctx const * ctx, int pool_index)
+{
+    if (pool_index < NUM_TINY_CLASSES)
+        return (ctx->flags & MPOOL_TINY_CLASSES) != 0;
+
+    return !(ctx->flags & MPOOL_POW2_CLASSES)
+           || (pool_index - NUM_TINY_CLASSES) % CLASS_STEPS == 0;
+}
+
+
+static int
+mpool_bin_num_classes(struct mpool_ctx const * ctx, int bin)
+{
+    if (bin == 0)
+        return ctx->flags & MPOOL_TINY_CLASSES ? NUM_TINY_CLASSES + 1 : 1;
+
+    if (ctx->flags & MPOOL_POW2_CLASSES)
+        return 1;
+
+    return CLASS_STEPS;
+}
+
+
+/* map every size granule to the smallest used size class that fits it */
+static void
+mpool_ctx_init_lookup(struct mpool_ctx * ctx)
+{
+    int i;
+    size_t granule;
+
+    i = 0;
+    for (granule = 0 ; granule < NUM_SIZE_GRANULES ; granule++) {
+        while (  mpool_class_size(i) < granule << LG2_SIZE_GRANULE
+              || !mpool_class_used(ctx, i))
+            i++;
+
+        assert(i < NUM_POOLS);
+        ctx->pool_index[granule] = (uint8_t) i;
+    }
+}
+
+
+/* carve the arena in slices for each size class, and the large tier. The
+ * slice of a doubling is split evenly between its size classes */
+static int
+mpool_ctx_init_fixed(struct mpool_ctx * ctx, void * arena, size_t total_size,
+        unsigned int * weights, int weights_len)
+{
+    int i, bin;
+    uint8_t * arena_ptr;
+    size_t elem_size, arena_size, total_weight, pad;
+
+    assert(total_size >= CACHELINE_SIZE);
+
+    /* the large tier weighs as a size class of twice the page size */
+    total_weight = 0;
+    for (i = 0 ; i < weights_len ; i++)
+        total_weight += (1 << i) * CACHELINE_SIZE * weights[i];
+
+    assert(total_weight > 0);
+
+    arena_ptr = mpool_cache_align_ptr(arena);
+    total_size -= (size_t) (arena_ptr - (uint8_t *) arena);
+
+    if (total_weight <= 0 || total_size < CACHELINE_SIZE)
+        return EINVAL;
+
+    ctx->base = (uintptr_t) arena_ptr;
+    for (i = 0 ; i < NUM_POOLS ; i++) {
+        bin = mpool_class_bin(i);
+        if (  bin >= weights_len || weights[bin] == 0
+           || !mpool_class_used(ctx, i)) {
+            ctx->slice_end[i] = (uintptr_t) arena_ptr;
+            continue;
+        }
+
+        arena_size = ((CACHELINE_SIZE << bin) * total_size * weights[bin])
+                     / total_weight / mpool_bin_num_classes(ctx, bin);
+        arena_size &= ~((size_t) CACHELINE_SIZE - 1);
+
+        /* chunks of a power of two size are aligned on it, the slice gives
+         * up its first bytes */
+        elem_size = mpool_class_size(i);
+        if ((elem_size & (elem_size - 1)) == 0) {
+            pad = -(uintptr_t) arena_ptr & (elem_size - 1);
+            pad = MIN(pad, arena_size);
+            arena_ptr += pad;
+            arena_size -= pad;
+        }
+
+        ctx->pools[i].arena = arena_ptr;
+        arena_ptr += arena_size;
+        ctx->slice_end[i] = (uintptr_t) arena_ptr;
+
+        mpool_init_arena(&ctx->pools[i], elem_size, arena_size);
+    }
+
+    ctx->slice_end[NUM_POOLS] = (uintptr_t) arena_ptr;
+    if (weights_len > LARGE_WEIGHT_INDEX && weights[LARGE_WEIGHT_INDEX] != 0) {
+        elem_size = (1 << LARGE_WEIGHT_INDEX) * CACHELINE_SIZE;
+        arena_size = ((elem_size * total_size * weights[LARGE_WEIGHT_INDEX])
+                      / total_weight);
+        if (mpool_large_init(&ctx->large, arena_ptr, arena_size) != 0)
+            return EINVAL;
+
+        ctx->slice_end[NUM_POOLS] += arena_size;
+        ctx->has_large = 1;
+        MPOOL_CREATE_MEMPOOL(MPOOL_GET(&ctx->large), 0, 0);
+    }
+
+    return 0;
+}
+
+
+/* reserve the address space, every size class given a weight starts empty and
+ * takes segments from the reserve on demand */
+static int
+mpool_ctx_init_growable(struct mpool_ctx * ctx, size_t total_size,
+        unsigned int * weights, int weights_len)
+{
+    int i, bin, rv;
+
+    ctx->has_large = weights_len > LARGE_WEIGHT_INDEX
+                     && weights[LARGE_WEIGHT_INDEX] != 0;
+
+    rv = mpool_reserve(ctx, total_size, ctx->has_large);
+    if (rv != 0)
+        return rv;
+
+    for (i = 0 ; i < NUM_POOLS ; i++) {
+        bin = mpool_class_bin(i);
+        if (  bin >= weights_len || weights[bin] == 0
+           || !mpool_class_used(ctx, i))
+            continue;
+
+        ctx->pools[i].arena = ctx->reserve;
+        mpool_init_arena(&ctx->pools[i], mpool_class_size(i), 0);
+    }
+
+    if (ctx->has_large) {
+        MPOOL_CREATE_MEMPOOL(MPOOL_GET(&ctx->large), 0, 0);
+    }
+
+    return 0;
+}
+
+
+static NOINLINE struct mpool_rseq *
+mpool_rseq_init_thread(void)
+{
+    pool_rseq = mpool_rseq_register();
+    if (pool_rseq == NULL)
+        pool_rseq = &pool_rseq_none;
+
+    return pool_rseq;
+}
+
+
+static ALWAYS_INLINE struct mpool_rseq *
+mpool_get_rseq(void)
+{
+    if (unlikely(pool_rseq == NULL))
+        return mpool_rseq_init_thread();
+
+    return pool_rseq;
+}
+
+
+/* a row of stacks per configured CPU, followed by their slots. Restartable
+ * sequences index the rows by CPU number: the stacks are locked instead when
+ * there are more CPUs than NR_CPUS rows, when rseq is not available, or when
+ * MPOOL_PERCPU_LOCKED is set in the environment */
+static int
+mpool_ctx_init_percpu(struct mpool_ctx * ctx)
+{
+    int i, cpu;
+    long num_cpus;
+    size_t num_slots;
+    void ** slots;
+
+    num_slots = 0;
+    for (i = 0 ; i < NUM_POOLS ; i++)
+        num_slots += 2 * ctx->pools[i].percpu_batch;
+
+    num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    ctx->percpu_rows = (int) MIN(MAX(num_cpus, 1), NR_CPUS);
+    ctx->percpu_size = (size_t) ctx->percpu_rows
+                       * (sizeof(struct mpool_percpu_row)
+                          + num_slots * sizeof(void *));
+    ctx->percpu = mmap(NULL, ctx->percpu_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ctx->percpu == MAP_FAILED) {
+        ctx->percpu = NULL;
+        return ENOMEM;
+    }
+
+    slots = (void **) &ctx->percpu[ctx->percpu_rows];
+    for (cpu = 0 ; cpu < ctx->percpu_rows ; cpu++) {
+        for (i = 0 ; i < NUM_POOLS ; i++) {
+            ctx->percpu[cpu].stacks[i].slots = slots;
+            slots += 2 * ctx->pools[i].percpu_batch;
+        }
+    }
+
+    ctx->percpu_locked = !MPOOL_HAS_RSEQ
+                         || num_cpus > NR_CPUS
+                         || getenv("MPOOL_PERCPU_LOCKED") != NULL
+                         || mpool_get_rseq() == &pool_rseq_none;
+
+    return 0;
+}
+
+
+/* owner inboxes, and the owner map of the pages of the whole arena or
+ * reserve */
+static int
+mpool_ctx_init_remote(struct mpool_ctx * ctx)
+{
+    size_t inbox_size, range;
+
+    if (ctx->segment_pool != NULL)
+        range = ctx->reserve_size;
+    else
+        range = ctx->slice_end[NUM_POOLS] - ctx->base;
+
+    inbox_size = MPOOL_MAX_OWNERS * sizeof(struct mpool_inbox);
+    ctx->remote_size = inbox_size + (range >> LG2_OWNER_GRANULE) + 1;
+    ctx->inbox = mmap(NULL, ctx->remote_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ctx->inbox == MAP_FAILED) {
+        ctx->inbox = NULL;
+        return ENOMEM;
+    }
+
+    ctx->owner_map = (uint8_t *) ctx->inbox + inbox_size;
+
+    return 0;
+}
+
+
+/* an instance per node, which reserve is bound to the node. Binding is best
+ * effort: fake nodes are folded onto the real ones, and the pages of a reserve
+ * which cannot be bound follow the default policy */
+static int
+mpool_ctx_init_numa(struct mpool_ctx * ctx, size_t total_size,
+        unsigned int * weights, int weights_len)
+{
+    int i;
+    struct mpool_ctx * node;
+
+    ctx->num_nodes = mpool_numa_num_nodes(&ctx->fake_numa);
+    for (i = 0 ; i < ctx->num_nodes ; i++) {
+        node = mpool_ctx_create(NULL, total_size, weights, weights_len,
+                ctx->flags & ~MPOOL_NUMA);
+        if (node == NULL) {
+            while (i-- > 0)
+                mpool_ctx_destroy(ctx->nodes[i]);
+
+            ctx->num_nodes = 0;
+            return ENOMEM;
+        }
+
+        (void) mpool_numa_bind(node->reserve, node->reserve_size, i);
+        ctx->nodes[i] = node;
+    }
+
+    return 0;
+}
+
+
+NOINLINE struct mpool_ctx *
+mpool_ctx_create(void * arena, size_t total_size,
+        unsigned int * weights, int weights_len, int flags)
+{
+    int rv;
+    struct mpool_ctx * ctx;
+
+    assert(weights_len <= NUM_BINS + 1);
+
+    if (  weights_len > NUM_BINS + 1
+       || (arena == NULL) != ((flags & MPOOL_GROW) != 0)
+       || (flags & (MPOOL_NUMA | MPOOL_GROW)) == MPOOL_NUMA)
+        return NULL;
+
+#ifndef MPOOL_WITH_REMOTE_FREE
+    /* held back until its gains are measured on multi-core machines */
+    if (flags & MPOOL_REMOTE_FREE) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+#endif
+
+    ctx = mpool_ctx_get_slot();
+    if (ctx == NULL)
+        return NULL;
+
+    ctx->flags = flags;
+    mpool_ctx_init_lookup(ctx);
+    if (flags & MPOOL_NUMA)
+        rv = mpool_ctx_init_numa(ctx, total_size, weights, weights_len);
+    else if (flags & MPOOL_GROW)
+        rv = mpool_ctx_init_growable(ctx, total_size, weights, weights_len);
+    else
+        rv = mpool_ctx_init_fixed(ctx, arena, total_size, weights,
+                weights_len);
+
+    if (rv != 0) {
+        mpool_ctx_put_slot(ctx);
+        return NULL;
+    }
+
+    if (  flags & MPOOL_PERCPU
+       && !(flags & MPOOL_NUMA)
+       && mpool_ctx_init_percpu(ctx) != 0) {
+        mpool_ctx_destroy(ctx);
+        return NULL;
+    }
+
+    if (  (flags & (MPOOL_REMOTE_FREE | MPOOL_NUMA | MPOOL_PERCPU))
+          == MPOOL_REMOTE_FREE
+       && mpool_ctx_init_remote(ctx) != 0) {
+        mpool_ctx_destroy(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+
+NOINLINE void
+mpool_ctx_destroy(struct mpool_ctx * ctx)
+{
+    int i;
+    struct mpool * pool;
+
+    if (ctx == NULL)
+        return;
+
+    for (i = 0 ; i < MPOOL_MAX_OBJCACHES ; i++)
+        assert(  !pool_glob.objcache[i].in_use
+              || pool_glob.objcache[i].ctx != ctx);
+
+    /* its chunks cached by the threads are not served inline any longer */
+    if (ctx == pool_glob.default_ctx)
+        __atomic_store_n(&mpool_inline_gen, MPOOL_INLINE_NONE,
+                __ATOMIC_RELAXED);
+
+    for (i = 0 ; i < ctx->num_nodes ; i++)
+        mpool_ctx_destroy(ctx->nodes[i]);
+
+    for (i = 0 ; i < NUM_POOLS ; i++) {
+        pool = &ctx->pools[i];
+        if (pool->arena != NULL) {
+            MPOOL_DESTROY_MEMPOOL(MPOOL_GET(pool));
+        }
+    }
+
+    if (ctx->has_large) {
+        MPOOL_DESTROY_MEMPOOL(MPOOL_GET(&ctx->large));
+    }
+
+    if (ctx->reserve != NULL)
+        munmap(ctx->reserve, ctx->reserve_size);
+
+    if (ctx->percpu != NULL)
+        munmap(ctx->percpu, ctx->percpu_size);
+
+    if (ctx->inbox != NULL)
+        munmap(ctx->inbox, ctx->remote_size);
+
+    mpool_ctx_put_slot(ctx);
+}
+
+
+NOINLINE int
+mpool_create(void * arena, size_t total_size,
+        unsigned int * weights, int weights_len)
+{
+    struct mpool_ctx * ctx;
+
+    ctx = mpool_ctx_create(arena, total_size, weights, weights_len, 0);
+    if (ctx == NULL)
+        return -1;
+
+    pool_glob.default_ctx = ctx;
+    mpool_inline_update();
+    return 0;
+}
+
+
+void
+mpool_set_default(struct mpool_ctx * ctx)
+{
+    pool_glob.default_ctx = ctx;
+    mpool_inline_update();
+}
+
+
+NOINLINE
+void mpool_destroy(void)
+{
+    mpool_ctx_destroy(pool_glob.default_ctx);
+    pool_glob.default_ctx = NULL;
+    mpool_inline_update();
+}
+
+
+static ALWAYS_INLINE int
+mpool_get_pool_index(struct mpool_ctx const * ctx, size_t size)
+{
+    if (unlikely(size > PAGE_SIZE))
+        return NUM_POOLS;
+
+    return ctx->pool_index[(size + (1 << LG2_SIZE_GRANULE) - 1)
+                           >> LG2_SIZE_GRANULE];
+}
+
+
+/* size class of a chunk from its address, NUM_POOLS for the large tier and -1
+ * for chunks which do not belong to the instance */
+static ALWAYS_INLINE int
+mpool_get_ptr_index(struct mpool_ctx const * ctx, void const * ptr)
+{
+    int i, n, half;
+    uintptr_t offset;
+
+    offset = (uintptr_t) ptr - ctx->base;
+    if (ctx->segment_pool != NULL) {
+        if (unlikely(offset >= ctx->reserve_size))
+            return -1;
+
+        i = ctx->segment_pool[offset >> LG2_SEGMENT_SIZE];
+        return i != UINT8_MAX ? i : -1;
+    }
+
+    if (unlikely(offset >= ctx->slice_end[NUM_POOLS] - ctx->base))
+        return -1;
+
+    /* first slice ending past the chunk */
+    i = 0;
+    for (n = NUM_POOLS + 1 ; n > 1 ; n -= half) {
+        half = n / 2;
+        if (ctx->slice_end[i + half - 1] <= (uintptr_t) ptr)
+            i += half;
+    }
+
+    return i;
+}
+
+
+/* owner slot of a chunk of a MPOOL_REMOTE_FREE instance */
+static ALWAYS_INLINE int
+mpool_get_owner(struct mpool_ctx const * ctx, void const * ptr)
+{
+    return __atomic_load_n(&ctx->owner_map[((uintptr_t) ptr - ctx->base)
+                                           >> LG2_OWNER_GRANULE],
+               __ATOMIC_RELAXED);
+}
+
+
+/* the page is only written to when it changes hands */
+static ALWAYS_INLINE void
+mpool_set_owner(struct mpool_ctx const * ctx, void const * ptr)
+{
+    uint8_t * owner;
+
+    owner = &ctx->owner_map[((uintptr_t) ptr - ctx->base) >> LG2_OWNER_GRANULE];
+    if (__atomic_load_n(owner, __ATOMIC_RELAXED) != (uint8_t) pool_owner)
+        __atomic_store_n(owner, (uint8_t) pool_owner, __ATOMIC_RELAXED);
+}
+
+
+/* the first free owner slot, or none when they are all taken */
+static void
+mpool_take_owner(void)
+{
+    int i;
+
+    pthread_mutex_lock(&pool_glob.lock);
+    pool_owner = 0;
+    for (i = 1 ; i < MPOOL_MAX_OWNERS ; i++) {
+        if (!pool_glob.owner_used[i]) {
+            __atomic_store_n(&pool_glob.owner_used[i], 1, __ATOMIC_RELAXED);
+            pool_owner = i;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&pool_glob.lock);
+}
+
+
+/* caches left over by a destroyed instance which slot got reused are dropped,
+ * the chunks they hold belonged to the former arena. The first cache set up by
+ * a thread registers it for the exit time flush, the first one of a
+ * MPOOL_REMOTE_FREE instance takes an owner slot */
+static NOINLINE void
+mpool_reset_cache(struct mpool_cpu_cache * cache, struct mpool const * pool,
+        unsigned int gen)
+{
+    cache->free = NULL;
+    cache->num_free = 0;
+    cache->gen = gen;
+    cache->batch = pool->min_batch;
+    cache->last = 0;
+    cache->remote = NULL;
+    cache->num_remote = 0;
+    cache->num_allocs = 0;
+    cache->num_frees = 0;
+
+    if (pthread_getspecific(pool_glob.cache_key) == NULL)
+        pthread_setspecific(pool_glob.cache_key, pool_cache);
+}
+
+
+/* the caches of the instance slot are mapped on the first one used. NULL when
+ * they cannot be */
+static NOINLINE struct mpool_cpu_cache *
+mpool_init_cache(struct mpool_ctx const * ctx, int pool_index)
+{
+    struct mpool_cpu_cache * cache;
+
+    if (pool_cache[ctx->id] == pool_cache_none) {
+        cache = mpool_map_caches(NUM_POOLS);
+        if (cache == NULL)
+            return NULL;
+
+        pool_cache[ctx->id] = cache;
+    }
+
+    cache = &pool_cache[ctx->id][pool_index];
+    mpool_reset_cache(cache, &ctx->pools[pool_index], ctx->gen);
+
+    if (ctx->inbox != NULL && pool_owner < 0)
+        mpool_take_owner();
+
+    return cache;
+}
+
+
+static ALWAYS_INLINE struct mpool_cpu_cache *
+mpool_get_cache(struct mpool_ctx const * ctx, int pool_index)
+{
+    struct mpool_cpu_cache * cache;
+
+    cache = &pool_cache[ctx->id][pool_index];
+    if (unlikely(cache->gen != ctx->gen))
+        cache = mpool_init_cache(ctx, pool_index);
+
+    return cache;
+}
+
+
+/* carve a purged span once the carving region is used up, unless another
+ * thread just did. The grow lock keeps a segment from being carved at the same
+ * time. ENOMEM without spans */
+static int
+mpool_carve_span(struct mpool_ctx * ctx, struct mpool * pool)
+{
+    int rv;
+    struct chunk_span * span;
+
+    rv = 0;
+    pthread_mutex_lock(&ctx->grow_lock);
+    if (mpool_num_uncarved(pool) == 0) {
+        pthread_mutex_lock(&ctx->span_lock);
+        span = pool->spans;
+        if (span != NULL) {
+            __atomic_store_n(&pool->spans, span->next, __ATOMIC_RELAXED);
+            __atomic_fetch_sub(&pool->num_purged,
+                    span->size / pool->elem_size, __ATOMIC_RELAXED);
+        }
+
+        pthread_mutex_unlock(&ctx->span_lock);
+
+        if (span != NULL)
+            mpool_carve_region(pool, (uint8_t *) span, span->size);
+        else
+            rv = ENOMEM;
+    }
+
+    pthread_mutex_unlock(&ctx->grow_lock);
+
+    return rv;
+}
+
+
+/* a batch of the pool free list, or else of at most num chunks carved from
+ * the never used ones, or from the purged ones. NULL when the pool is out of
+ * all of them */
+static struct chunk_batch *
+mpool_pool_pop(struct mpool_ctx * ctx, struct mpool * pool, unsigned int num)
+{
+    struct chunk_batch * batch;
+
+    for (;;) {
+        batch = mpool_central_pop(pool);
+        if (batch == NULL)
+            batch = mpool_carve(pool, num);
+
+        if (batch != NULL) {
+            mpool_stats_high_water(pool);
+            return batch;
+        }
+
+        if (  __atomic_load_n(&pool->spans, __ATOMIC_RELAXED) != NULL
+           && mpool_carve_span(ctx, pool) == 0)
+            continue;
+
+        /* a purge holds the free chunks for a moment, until it gives back
+         * those it cannot purge or makes spans of the others */
+        if (__atomic_load_n(&pool->purging, __ATOMIC_SEQ_CST)) {
+            while (  __atomic_load_n(&pool->purging, __ATOMIC_SEQ_CST)
+                  && __atomic_load_n(&pool->num_free, __ATOMIC_RELAXED) == 0
+                  && __atomic_load_n(&pool->spans, __ATOMIC_RELAXED) == NULL)
+                sched_yield();
+
+            continue;
+        }
+
+        if (mpool_grow(ctx, pool) != 0)
+            return NULL;
+    }
+}
+
+
+static int
+mpool_cmp_ptr(void const * a, void const * b)
+{
+    uintptr_t x, y;
+
+    x = (uintptr_t) *(void * const *) a;
+    y = (uintptr_t) *(void * const *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+/* bytes of the whole pages a run of free chunks covers from first, all but
+ * the one holding the span header */
+static size_t
+mpool_run_pages(uint8_t * start, size_t size, uintptr_t * first)
+{
+    uintptr_t last;
+
+    *first = ((uintptr_t) start + sizeof(struct chunk_span) + PAGE_SIZE - 1)
+             & ~((uintptr_t) PAGE_SIZE - 1);
+    last = ((uintptr_t) start + size) & ~((uintptr_t) PAGE_SIZE - 1);
+
+    return last > *first ? last - *first : 0;
+}
+
+
+/* give the pages of a run of free chunks back to the system, and keep the run
+ * as a span. 0 when it covers no such page */
+static size_t
+mpool_purge_run(struct mpool_ctx * ctx, struct mpool * pool, uint8_t * start,
+        size_t size)
+{
+    uintptr_t first;
+    size_t len;
+    struct chunk_span * span;
+
+    len = mpool_run_pages(start, size, &first);
+    if (len == 0 || madvise(VOIDPTR(first), len, MADV_DONTNEED) != 0)
+        return 0;
+
+    span = VOIDPTR(start);
+    span->size = size;
+
+    pthread_mutex_lock(&ctx->span_lock);
+    span->next = pool->spans;
+    __atomic_store_n(&pool->spans, span, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&pool->num_purged, size / pool->elem_size,
+            __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&ctx->span_lock);
+
+    return len;
+}
+
+
+/* give a chunk back to the pool, by batches of the biggest cache size */
+static void
+mpool_purge_keep(struct mpool * pool, struct chunk_list ** list,
+        unsigned int * num, void * ptr)
+{
+    struct chunk_list * chunk;
+    struct chunk_batch * batch;
+
+    chunk = ptr;
+    chunk->next = *list;
+    *list = chunk;
+    if (++*num < pool->max_batch)
+        return;
+
+    batch = (struct chunk_batch *) *list;
+    batch->num = *num;
+    mpool_central_push(pool, batch);
+    *list = NULL;
+    *num = 0;
+}
+
+
+/* go through the runs of chunks next to each other of the sorted ptrs, and
+ * give back to the pool those which cannot be purged. Or else, purge the
+ * others and give back those which could not be. Returns the bytes purged */
+static size_t
+mpool_purge_runs(struct mpool_ctx * ctx, struct mpool * pool, void ** ptrs,
+        size_t num, int purge)
+{
+    size_t i, j, k, size, purged;
+    uintptr_t first;
+    unsigned int num_kept;
+    struct chunk_list * kept;
+    struct chunk_batch * batch;
+
+    purged = 0;
+    kept = NULL;
+    num_kept = 0;
+    for (i = 0 ; i < num ; i = j) {
+        for (j = i + 1 ; j < num ; j++) {
+            if ((uint8_t *) ptrs[j] != (uint8_t *) ptrs[j - 1] + pool->elem_size)
+                break;
+        }
+
+        size = mpool_run_pages(ptrs[i], (j - i) * pool->elem_size, &first);
+        if ((size != 0) != purge)
+            continue;
+
+        if (purge) {
+            size = mpool_purge_run(ctx, pool, ptrs[i],
+                    (j - i) * pool->elem_size);
+            purged += size;
+        }
+
+        for (k = i ; size == 0 && k < j ; k++)
+            mpool_purge_keep(pool, &kept, &num_kept, ptrs[k]);
+    }
+
+    if (num_kept > 0) {
+        batch = (struct chunk_batch *) kept;
+        batch->num = num_kept;
+        mpool_central_push(pool, batch);
+    }
+
+    return purged;
+}
+
+
+/* take the whole free list of the pool, and purge the runs of chunks next to
+ * each other which cover whole pages. The other chunks go back to the pool
+ * first: allocations find the pool empty only while the chunks are sorted,
+ * and wait for the purge meanwhile rather than fail or grow the pool */
+static size_t
+mpool_purge_pool(struct mpool_ctx * ctx, struct mpool * pool)
+{
+    size_t i, num, max, purged;
+    void ** ptrs;
+    struct chunk_list * chunk;
+    struct chunk_batch * batch;
+
+    /* the pool may grow meanwhile, the chunks past max are left alone */
+    max = __atomic_load_n(&pool->num_chunks, __ATOMIC_RELAXED);
+    if (pool->arena == NULL || max == 0)
+        return 0;
+
+    ptrs = mmap(NULL, max * sizeof(void *), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptrs == MAP_FAILED)
+        return 0;
+
+    __atomic_store_n(&pool->purging, 1, __ATOMIC_SEQ_CST);
+
+    num = 0;
+    while (num < max && (batch = mpool_central_pop(pool)) != NULL) {
+        if (batch->num > max - num) {
+            mpool_central_push(pool, batch);
+            break;
+        }
+
+        chunk = &batch->list;
+        for (i = batch->num ; i > 0 ; i--) {
+            ptrs[num++] = chunk;
+            chunk = chunk->next;
+        }
+    }
+
+    qsort(ptrs, num, sizeof(void *), mpool_cmp_ptr);
+
+    (void) mpool_purge_runs(ctx, pool, ptrs, num, 0);
+    purged = mpool_purge_runs(ctx, pool, ptrs, num, 1);
+
+    __atomic_store_n(&pool->purging, 0, __ATOMIC_SEQ_CST);
+    munmap(ptrs, max * sizeof(void *));
+
+    return purged;
+}
+
+
+size_t
+mpool_ctx_purge(struct mpool_ctx * ctx)
+{
+    int i;
+    size_t purged, total;
+
+    assert(ctx != NULL);
+
+    total = 0;
+    for (i = 0 ; i < ctx->num_nodes ; i++)
+        total += mpool_ctx_purge(ctx->nodes[i]);
+
+    purged = 0;
+    pthread_mutex_lock(&ctx->purge_lock);
+    for (i = 0 ; i < NUM_POOLS ; i++)
+        purged += mpool_purge_pool(ctx, &ctx->pools[i]);
+
+    pthread_mutex_unlock(&ctx->purge_lock);
+    __atomic_add_fetch(&ctx->purged, purged, __ATOMIC_RELAXED);
+
+    return total + purged;
+}
+
+
+size_t
+mpool_purge(void)
+{
+    return mpool_ctx_purge(pool_glob.default_ctx);
+}
+
+
+static uint64_t
+mpool_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+
+/* the first thread flushing chunks to the pools once the decay period is
+ * over purges them */
+static void
+mpool_decay(struct mpool_ctx * ctx)
+{
+    uint64_t decay, now, next;
+
+    decay = __atomic_load_n(&ctx->decay, __ATOMIC_RELAXED);
+    if (likely(decay == 0))
+        return;
+
+    now = mpool_now();
+    next = __atomic_load_n(&ctx->next_purge, __ATOMIC_RELAXED);
+    if (  now < next
+       || !__atomic_compare_exchange_n(&ctx->next_purge, &next, now + decay,
+               0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return;
+
+    (void) mpool_ctx_purge(ctx);
+}
+
+
+/* row of the CPU the calling thread runs on, or ran on a moment ago */
+static ALWAYS_INLINE struct mpool_percpu_row *
+mpool_percpu_row(struct mpool_ctx const * ctx)
+{
+    int cpu;
+
+    if (likely(!ctx->percpu_locked))
+        return &ctx->percpu[__atomic_load_n(&mpool_get_rseq()->cpu_id,
+                __ATOMIC_RELAXED)];
+
+    cpu = sched_getcpu();
+    return &ctx->percpu[cpu > 0 ? cpu % ctx->percpu_rows : 0];
+}
+
+
+static struct mpool_percpu_row *
+mpool_percpu_lock(struct mpool_ctx const * ctx)
+{
+    struct mpool_percpu_row * row;
+
+    row = mpool_percpu_row(ctx);
+    while (__atomic_exchange_n(&row->lock, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+
+    return row;
+}
+
+
+static void
+mpool_percpu_unlock(struct mpool_percpu_row * row)
+{
+    __atomic_store_n(&row->lock, 0, __ATOMIC_RELEASE);
+}
+
+
+static NOINLINE void *
+mpool_percpu_pop_locked(struct mpool_ctx const * ctx, int pool_index)
+{
+    void * ptr;
+    struct mpool_percpu_row * row;
+    struct mpool_percpu_stack * stack;
+
+    row = mpool_percpu_lock(ctx);
+    stack = &row->stacks[pool_index];
+    ptr = stack->num > 0 ? stack->slots[--stack->num] : NULL;
+    mpool_percpu_unlock(row);
+
+    return ptr;
+}
+
+
+static NOINLINE int
+mpool_percpu_push_locked(struct mpool_ctx const * ctx, int pool_index,
+        void * ptr)
+{
+    int done;
+    struct mpool_percpu_row * row;
+    struct mpool_percpu_stack * stack;
+
+    row = mpool_percpu_lock(ctx);
+    stack = &row->stacks[pool_index];
+    done = stack->num < 2 * ctx->pools[pool_index].percpu_batch;
+    if (done)
+        stack->slots[stack->num++] = ptr;
+
+    mpool_percpu_unlock(row);
+
+    return done;
+}
+
+
+/* threads of an instance using rseq all have it registered: the kernel and
+ * the C library register every thread or none */
+static ALWAYS_INLINE void *
+mpool_percpu_pop(struct mpool_ctx const * ctx, int pool_index)
+{
+    struct mpool_rseq * rs;
+
+    if (likely(!ctx->percpu_locked)) {
+        rs = mpool_get_rseq();
+        assert(rs != &pool_rseq_none);
+        return mpool_rseq_pop(rs, &ctx->percpu[0].stacks[pool_index]);
+    }
+
+    return mpool_percpu_pop_locked(ctx, pool_index);
+}
+
+
+static ALWAYS_INLINE int
+mpool_percpu_push(struct mpool_ctx const * ctx, int pool_index, void * ptr)
+{
+    struct mpool_rseq * rs;
+
+    if (likely(!ctx->percpu_locked)) {
+        rs = mpool_get_rseq();
+        assert(rs != &pool_rseq_none);
+        return mpool_rseq_push(rs, &ctx->percpu[0].stacks[pool_index],
+                2 * ctx->pools[pool_index].percpu_batch, ptr);
+    }
+
+    return mpool_percpu_push_locked(ctx, pool_index, ptr);
+}
+
+
+/* take a batch from the pool: the caller gets its first chunk, the others go
+ * to the cache of the current CPU, and back to the pool if it fills up */
+static NOINLINE void *
+mpool_percpu_refill(struct mpool_ctx * ctx, int pool_index)
+{
+    unsigned int num;
+    struct mpool * pool;
+    struct chunk_list * ptr, * list, * next;
+    struct chunk_batch * batch, * rest;
+
+    MPOOL_LAT_SLOW_PATH();
+    pool = &ctx->pools[pool_index];
+    MPOOL_STAT_ADD(&pool->counters, misses, 1);
+    batch = mpool_pool_pop(ctx, pool, pool->percpu_batch);
+    if (unlikely(batch == NULL)) {
+        MPOOL_STAT_ADD(&pool->counters, enomem, 1);
+        return NULL;
+    }
+
+    MPOOL_STAT_ADD(&pool->counters, refills, 1);
+
+    if (batch->num > pool->percpu_batch) {
+        rest = (struct chunk_batch *) mpool_list_split(&batch->list,
+                pool->percpu_batch);
+        rest->num = batch->num - pool->percpu_batch;
+        batch->num = pool->percpu_batch;
+        mpool_central_push(pool, rest);
+    }
+
+    ptr = &batch->list;
+    num = batch->num - 1;
+    for (list = ptr->next ; list != NULL ; list = next, num--) {
+        next = list->next;
+        if (!mpool_percpu_push(ctx, pool_index, list)) {
+            rest = (struct chunk_batch *) list;
+            rest->num = num;
+            mpool_central_push(pool, rest);
+            break;
+        }
+    }
+
+    return ptr;
+}
+
+
+/* the cache of the current CPU is full: a batch of it goes back to the pool,
+ * and the chunk to the cache */
+static NOINLINE void
+mpool_percpu_flush(struct mpool_ctx * ctx, int pool_index, void const * ptr)
+{
+    unsigned int num;
+    struct mpool * pool;
+    struct chunk_list * list, * chunk;
+    struct chunk_batch * batch;
+
+    MPOOL_LAT_SLOW_PATH();
+    pool = &ctx->pools[pool_index];
+    list = NULL;
+    for (num = 0 ; num < pool->percpu_batch ; num++) {
+        chunk = mpool_percpu_pop(ctx, pool_index);
+        if (chunk == NULL)
+            break;
+
+        chunk->next = list;
+        list = chunk;
+    }
+
+    if (!mpool_percpu_push(ctx, pool_index, VOIDPTR(ptr))) {
+        chunk = VOIDPTR(ptr);
+        chunk->next = list;
+        list = chunk;
+        num++;
+    }
+
+    if (num > 0) {
+        batch = (struct chunk_batch *) list;
+        batch->num = num;
+        mpool_central_push(pool, batch);
+        MPOOL_STAT_ADD(&pool->counters, flushes, 1);
+    }
+
+    mpool_decay(ctx);
+}
+
+
+static NOINLINE int
+mpool_numa_lookup_node(struct mpool_ctx const * ctx)
+{
+    int node;
+
+    if (ctx->fake_numa)
+        node = (int) __atomic_fetch_add(&pool_glob.next_node, 1,
+                __ATOMIC_RELAXED);
+    else
+        node = mpool_numa_cpu_node();
+
+    pool_node = node + 1;
+
+    return node;
+}
+
+
+/* instance of the node of the calling thread. The node is looked up once,
+ * threads are taken to stay on it */
+static ALWAYS_INLINE struct mpool_ctx *
+mpool_numa_local(struct mpool_ctx const * ctx)
+{
+    int node;
+
+    node = pool_node - 1;
+    if (unlikely(node < 0))
+        node = mpool_numa_lookup_node(ctx);
+
+    if (unlikely(node >= ctx->num_nodes))
+        node %= ctx->num_nodes;
+
+    return ctx->nodes[node];
+}
+
+
+/* instance a chunk comes from, NULL for chunks of none of the nodes */
+static struct mpool_ctx *
+mpool_numa_owner(struct mpool_ctx const * ctx, void const * ptr)
+{
+    int i;
+    struct mpool_ctx * node;
+
+    for (i = 0 ; i < ctx->num_nodes ; i++) {
+        node = ctx->nodes[i];
+        if ((uintptr_t) ptr - node->base < node->reserve_size)
+            return node;
+    }
+
+    return NULL;
+}
+
+
+/* same, counting the free as local or remote to the calling thread */
+static NOINLINE struct mpool_ctx *
+mpool_numa_free_owner(struct mpool_ctx * ctx, void const * ptr)
+{
+    struct mpool_ctx * owner;
+    struct mpool_numa_frees * frees;
+
+    owner = mpool_numa_owner(ctx, ptr);
+    assert(owner != NULL);
+    if (unlikely(owner == NULL))
+        return NULL;
+
+    frees = &pool_numa_frees[ctx->id];
+    if (frees->gen != ctx->gen) {
+        frees->local = 0;
+        frees->remote = 0;
+        frees->gen = ctx->gen;
+    }
+
+    if (owner == mpool_numa_local(ctx))
+        frees->local++;
+    else
+        frees->remote++;
+
+    if (frees->local + frees->remote >= MPOOL_NUMA_FREES_BATCH)
+        mpool_numa_flush_frees(ctx, frees);
+
+    return owner;
+}
+
+
+/* hand a batch of the pool to an empty thread cache, from the inbox of the
+ * calling thread or the central free list when inbox is NULL */
+static void
+mpool_cache_take(struct mpool_cpu_cache * cache, struct mpool * pool,
+        uint32_t * inbox, struct chunk_batch * batch)
+{
+    struct chunk_list * tail;
+    struct chunk_batch * rest;
+
+    MPOOL_STAT_ADD(&pool->counters, refills, 1);
+
+    /* batches flushed by bigger caches are split, the rest goes back where
+     * they came from */
+    if (batch->num > 2 * cache->batch) {
+        tail = mpool_list_split(&batch->list, cache->batch);
+        rest = (struct chunk_batch *) tail;
+        rest->num = batch->num - cache->batch;
+        batch->num = cache->batch;
+        if (inbox != NULL)
+            mpool_inbox_push(pool, inbox, rest);
+        else
+            mpool_central_push(pool, rest);
+    }
+
+    cache->free = &batch->list;
+    cache->num_free = batch->num;
+}
+
+
+static int
+mpool_fill_cache(struct mpool_ctx * ctx, struct mpool_cpu_cache * cache,
+        struct mpool * pool)
+{
+    uint32_t * inbox;
+    struct chunk_batch * batch;
+
+    assert(pool != NULL);
+    assert(cache != NULL);
+    assert(cache->free == NULL);
+
+    /* threads which keep refilling get bigger batches */
+    if (cache->last == MPOOL_CACHE_REFILL && cache->batch < pool->max_batch)
+        mpool_cache_resize(ctx, cache, pool,
+                MIN(2 * cache->batch, pool->max_batch));
+
+    cache->last = MPOOL_CACHE_REFILL;
+    MPOOL_LAT_SLOW_PATH();
+
+    /* chunks other threads freed back to this one first */
+    batch = NULL;
+    inbox = NULL;
+    if (ctx->inbox != NULL && pool_owner > 0) {
+        inbox = &ctx->inbox[pool_owner].batches[pool - ctx->pools];
+        batch = mpool_inbox_pop(pool, inbox);
+    }
+
+    if (batch == NULL) {
+        inbox = NULL;
+        batch = mpool_pool_pop(ctx, pool, cache->batch);
+    }
+
+    if (unlikely(batch == NULL)) {
+        MPOOL_STAT_ADD(&pool->counters, enomem, 1);
+        return ENOMEM;
+    }
+
+    mpool_cache_take(cache, pool, inbox, batch);
+
+    return 0;
+}
+
+
+static NOINLINE void *
+mpool_large_alloc_ctx(struct mpool_ctx * ctx, size_t size, size_t alignment)
+{
+    void * ptr;
+
+    if (!ctx->has_large) {
+        MPOOL_STAT_ADD(&ctx->large_counters, enomem, 1);
+        return NULL;
+    }
+
+    ptr = mpool_large_alloc_aligned(&ctx->large, size, alignment);
+    while (  ptr == NULL
+          && mpool_grow_large(ctx, size + alignment - PAGE_SIZE) == 0)
+        ptr = mpool_large_alloc_aligned(&ctx->large, size, alignment);
+
+    if (ptr != NULL) {
+        MPOOL_STAT_ADD(&ctx->large_counters, allocs, 1);
+        MPOOL_MEMPOOL_ALLOC(MPOOL_GET(&ctx->large), ptr, size);
+    } else {
+        MPOOL_STAT_ADD(&ctx->large_counters, enomem, 1);
+    }
+
+    return ptr;
+}
+
+
+#ifdef MPOOL_LATENCY
+
+/* size class the latency of a call is recorded to, the nodes of a NUMA
+ * instance share theirs */
+static int
+mpool_lat_size_index(struct mpool_ctx const * ctx, size_t size)
+{
+    if (ctx->num_nodes != 0)
+        ctx = ctx->nodes[0];
+
+    return mpool_get_pool_index(ctx, size);
+}
+
+
+static int
+mpool_lat_ptr_index(struct mpool_ctx const * ctx, void const * ptr)
+{
+    if (ctx->num_nodes != 0) {
+        ctx = mpool_numa_owner(ctx, ptr);
+        if (ctx == NULL)
+            return -1;
+    }
+
+    return mpool_get_ptr_index(ctx, ptr);
+}
+
+#endif /* MPOOL_LATENCY */
+
+
+static ALWAYS_INLINE void *
+mpool_ctx_alloc_inline(struct mpool_ctx * ctx, size_t size)
+{
+    void * ptr;
+    int pool_index;
+    struct mpool * pool;
+    struct mpool_cpu_cache * cache;
+
+    assert(ctx != NULL);
+
+    if (unlikely(ctx->num_nodes != 0))
+        ctx = mpool_numa_local(ctx);
+
+    pool_index = mpool_get_pool_index(ctx, size);
+    if (unlikely(pool_index >= NUM_POOLS))
+        return mpool_large_alloc_ctx(ctx, size, PAGE_SIZE);
+
+    pool = &ctx->pools[pool_index];
+    if (ctx->percpu != NULL) {
+        ptr = mpool_percpu_pop(ctx, pool_index);
+        if (unlikely(ptr == NULL)) {
+            ptr = mpool_percpu_refill(ctx, pool_index);
+            if (ptr == NULL)
+                return NULL;
+        }
+
+        MPOOL_PERCPU_COUNT(ctx, allocs, pool_index, 1);
+    } else {
+        cache = mpool_get_cache(ctx, pool_index);
+        if (unlikely(cache == NULL))
+            return NULL;
+
+        if (cache->num_free == 0) {
+            MPOOL_STAT_ADD(&pool->counters, misses, 1);
+            if (unlikely(mpool_fill_cache(ctx, cache, pool)))
+                return NULL;
+
+            assert(cache->num_free > 0);
+        }
+
+        ptr = cache->free;
+        cache->free = cache->free->next;
+        cache->num_free -= 1;
+        MPOOL_COUNT_ALLOCS(pool, cache, 1);
+
+        if (ctx->owner_map != NULL)
+            mpool_set_owner(ctx, ptr);
+    }
+
+    MPOOL_MEMPOOL_ALLOC(MPOOL_GET(pool), ptr, pool->elem_size);
+    MPOOL_MAKE_MEM_UNDEFINED(ptr, size);
+    MPOOL_MAKE_MEM_NOACCESS((uint8_t *) ptr + size, pool->elem_size - size);
+
+    return ptr;
+}
+
+
+__attribute__((malloc))
+__attribute__((alloc_size(2)))
+void *
+mpool_ctx_alloc(struct mpool_ctx * ctx, size_t size, int flags)
+{
+    void * ptr;
+
+    (void) flags; /* for later user */
+
+    MPOOL_LAT_TIME(MPOOL_LATENCY_ALLOC, mpool_lat_size_index(ctx, size),
+            ptr = mpool_ctx_alloc_inline(ctx, size));
+
+    return ptr;
+}
+
+
+__attribute__((malloc))
+__attribute__((alloc_size(1)))
+void *
+mpool_alloc(size_t size, int flags)
+{
+    void * ptr;
+
+    (void) flags; /* for later user */
+
+    MPOOL_LAT_TIME(MPOOL_LATENCY_ALLOC,
+            mpool_lat_size_index(pool_glob.default_ctx, size),
+            ptr = mpool_ctx_alloc_inline(pool_glob.default_ctx, size));
+
+    return ptr;
+}
+
+
+/* point the inline fast path of the calling thread at its caches of the
+ * default instance, or leave it disabled */
+static NOINLINE void
+mpool_inline_setup(void)
+{
+    int i;
+    struct mpool_ctx * ctx;
+    struct mpool_cpu_cache * cache;
+
+    ctx = pool_glob.default_ctx;
+    if (  __atomic_load_n(&mpool_inline_gen, __ATOMIC_RELAXED)
+          == MPOOL_INLINE_NONE
+       || ctx == NULL)
+        return;
+
+    for (i = 0 ; i < MPOOL_INLINE_GRANULES ; i++) {
+        cache = mpool_get_cache(ctx, mpool_get_pool_index(ctx,
+                (size_t) i << LG2_SIZE_GRANULE));
+        if (cache == NULL)
+            return;
+
+        mpool_inline_caches.caches[i] = (struct mpool_tcache *) cache;
+    }
+
+    mpool_inline_caches.gen = ctx->gen;
+}
+
+
+/* cache misses of the inline fast path, and its first calls */
+void *
+mpool_alloc_slow(size_t size)
+{
+    if (unlikely(mpool_inline_caches.gen
+                 != __atomic_load_n(&mpool_inline_gen, __ATOMIC_RELAXED)))
+        mpool_inline_setup();
+
+    return mpool_alloc(size, 0);
+}
+
+
+void
+mpool_free_slow(void const * ptr, size_t size)
+{
+    if (unlikely(mpool_inline_caches.gen
+                 != __atomic_load_n(&mpool_inline_gen, __ATOMIC_RELAXED)))
+        mpool_inline_setup();
+
+    mpool_free(ptr, size);
+}
+
+
+/* power of two size classes have their chunks aligned on their size: the
+ * smallest one fitting both is taken. Bigger alignments, or instances without
+ * such a class, get runs of the large tier */
+void *
+mpool_ctx_aligned_alloc(struct mpool_ctx * ctx, size_t alignment, size_t size)
+{
+    int pool_index;
+    size_t elem_size;
+
+    assert(ctx != NULL);
+
+    if (unlikely(alignment == 0 || (alignment & (alignment - 1)) != 0))
+        return NULL;
+
+    if (alignment <= 1 << LG2_BATCH_REF_UNIT)
+        return mpool_ctx_alloc_inline(ctx, size);
+
+    if (unlikely(ctx->num_nodes != 0))
+        ctx = mpool_numa_local(ctx);
+
+    elem_size = MAX(size, alignment);
+    while (elem_size <= PAGE_SIZE) {
+        pool_index = mpool_get_pool_index(ctx, elem_size);
+        if (pool_index >= NUM_POOLS)
+            break;
+
+        elem_size = ctx->pools[pool_index].elem_size;
+        if ((elem_size & (elem_size - 1)) == 0)
+            return mpool_ctx_alloc_inline(ctx, elem_size);
+
+        /* next power of two */
+        elem_size = 1UL << (64 - __builtin_clzl(elem_size));
+    }
+
+    return mpool_large_alloc_ctx(ctx, MAX(size, 1),
+            MAX(alignment, PAGE_SIZE));
+}
+
+
+void *
+mpool_aligned_alloc(size_t alignment, size_t size)
+{
+    return mpool_ctx_aligned_alloc(pool_glob.default_ctx, alignment, size);
+}
+
+
+/* threads which could not map their caches give chunks straight back to the
+ * pool */
+static NOINLINE void
+mpool_free_uncached(struct mpool * pool, void const * ptr)
+{
+    struct chunk_batch * batch;
+
+    batch = VOIDPTR(ptr);
+    batch->list.next = NULL;
+    batch->num = 1;
+    mpool_central_push(pool, batch);
+}
+
+
+/* give all but a batch of the chunks of a thread cache back to the pool */
+static void
+mpool_cache_give(struct mpool_cpu_cache * cache, struct mpool * pool)
+{
+    struct chunk_batch * batch;
+
+    /* keep the most recently freed chunks, they are the hottest ones */
+    batch = (struct chunk_batch *) mpool_list_split(cache->free, cache->batch);
+    batch->num = cache->num_free - cache->batch;
+    cache->num_free = cache->batch;
+
+    mpool_central_push(pool, batch);
+    MPOOL_STAT_ADD(&pool->counters, flushes, 1);
+}
+
+
+static void
+mpool_empty_cache(struct mpool_ctx * ctx, struct mpool_cpu_cache * cache,
+        struct mpool * pool)
+{
+    assert(pool != NULL);
+    assert(cache != NULL);
+
+    /* threads which keep flushing hold less */
+    if (cache->last == MPOOL_CACHE_FLUSH && cache->batch > pool->min_batch)
+        mpool_cache_resize(ctx, cache, pool,
+                MAX(cache->batch / 2, pool->min_batch));
+
+    cache->last = MPOOL_CACHE_FLUSH;
+    MPOOL_LAT_SLOW_PATH();
+    mpool_cache_give(cache, pool);
+    mpool_decay(ctx);
+}
+
+
+/* a chunk freed to another owner than the chunks held so far: those go to
+ * their owner when they make a batch, and else to the thread cache */
+static NOINLINE void
+mpool_remote_switch(struct mpool_ctx * ctx, struct mpool_cpu_cache * cache,
+        struct mpool * pool)
+{
+    struct chunk_list * last;
+
+    if (cache->num_remote >= pool->min_batch) {
+        mpool_remote_flush(ctx, cache, (int) (pool - ctx->pools));
+        return;
+    }
+
+    for (last = cache->remote ; last->next != NULL ; last = last->next)
+        ;
+
+    last->next = cache->free;
+    cache->free = cache->remote;
+    cache->num_free += cache->num_remote;
+    cache->remote = NULL;
+    cache->num_remote = 0;
+
+    if (cache->num_free > 2 * cache->batch)
+        mpool_empty_cache(ctx, cache, pool);
+}
+
+
+/* chunks of other threads are kept apart, and handed back to their owner by
+ * batches of the biggest cache size */
+static void
+mpool_remote_free(struct mpool_ctx * ctx, struct mpool_cpu_cache * cache,
+        struct mpool * pool, void const * ptr, int owner)
+{
+    struct chunk_list * chunk;
+
+    if (cache->num_remote > 0 && cache->remote_owner != (unsigned int) owner)
+        mpool_remote_switch(ctx, cache, pool);
+
+    chunk = VOIDPTR(ptr);
+    chunk->next = cache->remote;
+    cache->remote = chunk;
+    cache->remote_owner = (unsigned int) owner;
+
+    if (++cache->num_remote >= pool->max_batch)
+        mpool_remote_flush(ctx, cache, (int) (pool - ctx->pools));
+}
+
+
+static ALWAYS_INLINE void
+mpool_ctx_free_inline(struct mpool_ctx * ctx, void const * ptr, int pool_index)
+{
+    int owner;
+    struct mpool * pool;
+    struct mpool_cpu_cache * cache;
+    struct chunk_list * tmp;
+
+    if (unlikely(pool_index >= NUM_POOLS)) {
+        assert(ctx->has_large);
+        MPOOL_MEMPOOL_FREE(MPOOL_GET(&ctx->large), ptr);
+        mpool_large_free(&ctx->large, ptr);
+        MPOOL_STAT_ADD(&ctx->large_counters, frees, 1);
+        return;
+    }
+
+    pool = &ctx->pools[pool_index];
+    MPOOL_MEMPOOL_FREE(MPOOL_GET(pool), ptr);
+    MPOOL_MAKE_MEM_DEFINED(ptr, sizeof(uintptr_t));
+
+    if (ctx->percpu != NULL) {
+        MPOOL_PERCPU_COUNT(ctx, frees, pool_index, 1);
+        if (unlikely(!mpool_percpu_push(ctx, pool_index, VOIDPTR(ptr))))
+            mpool_percpu_flush(ctx, pool_index, ptr);
+
+        return;
+    }
+
+    cache = mpool_get_cache(ctx, pool_index);
+    MPOOL_COUNT_FREES(pool, cache, 1);
+    if (unlikely(cache == NULL)) {
+        mpool_free_uncached(pool, ptr);
+        return;
+    }
+
+    if (ctx->owner_map != NULL) {
+        /* the chunks of exited threads stay with the one freeing them */
+        owner = mpool_get_owner(ctx, ptr);
+        if (  owner != 0 && owner != pool_owner
+           && __atomic_load_n(&pool_glob.owner_used[owner],
+                   __ATOMIC_RELAXED)) {
+            mpool_remote_free(ctx, cache, pool, ptr, owner);
+            return;
+        }
+    }
+
+    tmp = cache->free;
+    cache->free = VOIDPTR(ptr);
+    cache->free->next = tmp;
+    cache->num_free += 1;
+
+    if (cache->num_free > 2 * cache->batch)
+        mpool_empty_cache(ctx, cache, pool);
+}
+
+
+static ALWAYS_INLINE void
+mpool_ctx_free_size(struct mpool_ctx * ctx, void const * ptr, size_t size)
+{
+    if (unlikely(ctx->num_nodes != 0)) {
+        ctx = mpool_numa_free_owner(ctx, ptr);
+        if (unlikely(ctx == NULL))
+            return;
+    }
+
+    mpool_ctx_free_inline(ctx, ptr, mpool_get_pool_index(ctx, size));
+}
+
+
+void mpool_ctx_free(struct mpool_ctx * ctx, void const * ptr, size_t size)
+{
+    if (ptr == NULL)
+        return;
+
+    assert(ctx != NULL);
+
+    MPOOL_LAT_TIME(MPOOL_LATENCY_FREE, mpool_lat_size_index(ctx, size),
+            mpool_ctx_free_size(ctx, ptr, size));
+}
+
+
+void mpool_free(void const * ptr, size_t size)
+{
+    mpool_ctx_free(pool_glob.default_ctx, ptr, size);
+}
+
+
+static ALWAYS_INLINE void
+mpool_ctx_free_ptr_inline(struct mpool_ctx * ctx, void const * ptr)
+{
+    int pool_index;
+
+    if (unlikely(ctx->num_nodes != 0)) {
+        ctx = mpool_numa_free_owner(ctx, ptr);
+        if (unlikely(ctx == NULL))
+            return;
+    }
+
+    pool_index = mpool_get_ptr_index(ctx, ptr);
+    assert(pool_index >= 0);
+    if (unlikely(pool_index < 0))
+        return;
+
+    mpool_ctx_free_inline(ctx, ptr, pool_index);
+}
+
+
+void mpool_ctx_free_ptr(struct mpool_ctx * ctx, void const * ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    assert(ctx != NULL);
+
+    /* the address keeps its size class once freed */
+    MPOOL_LAT_TIME(MPOOL_LATENCY_FREE, mpool_lat_ptr_index(ctx, ptr),
+            mpool_ctx_free_ptr_inline(ctx, ptr));
+}
+
+
+void mpool_free_ptr(void const * ptr)
+{
+    mpool_ctx_free_ptr(pool_glob.default_ctx, ptr);
+}
+
+
+/* give the n chunks a failed bulk allocation took back to the thread cache,
+ * in the order they came. They were not counted as allocations */
+static void
+mpool_bulk_undo(struct mpool_cpu_cache * cache, struct mpool * pool,
+        unsigned int n, void ** ptrs)
+{
+    unsigned int i;
+    struct chunk_list * chunk;
+
+    for (i = n ; i-- > 0 ; ) {
+        MPOOL_MEMPOOL_FREE(MPOOL_GET(pool), ptrs[i]);
+        MPOOL_MAKE_MEM_DEFINED(ptrs[i], sizeof(uintptr_t));
+        chunk = ptrs[i];
+        chunk->next = cache->free;
+        cache->free = chunk;
+    }
+
+    cache->num_free += n;
+    if (cache->num_free > 2 * cache->batch)
+        mpool_cache_give(cache, pool);
+}
+
+
+int
+mpool_ctx_alloc_bulk(struct mpool_ctx * ctx, size_t size, unsigned int n,
+        void ** ptrs)
+{
+    int pool_index;
+    unsigned int i, num;
+    struct mpool * pool;
+    struct mpool_cpu_cache * cache;
+    struct chunk_list * list;
+
+    assert(ctx != NULL);
+    assert(ptrs != NULL || n == 0);
+
+    if (unlikely(ctx->num_nodes != 0))
+        ctx = mpool_numa_local(ctx);
+
+    /* large runs, and per-CPU caches, are taken one at a time */
+    pool_index = mpool_get_pool_index(ctx, size);
+    if (unlikely(pool_index >= NUM_POOLS || ctx->percpu != NULL)) {
+        for (i = 0 ; i < n ; i++) {
+            ptrs[i] = mpool_ctx_alloc_inline(ctx, size);
+            if (ptrs[i] == NULL) {
+                mpool_ctx_free_bulk(ctx, size, i, ptrs);
+                return ENOMEM;
+            }
+        }
+
+        return 0;
+    }
+
+    pool = &ctx->pools[pool_index];
+    cache = mpool_get_cache(ctx, pool_index);
+    if (unlikely(cache == NULL))
+        return ENOMEM;
+
+    /* take whole runs of the thread cache, refilled a batch at a time */
+    for (i = 0 ; i < n ; ) {
+        if (cache->num_free == 0 && mpool_fill_cache(ctx, cache, pool) != 0) {
+            mpool_bulk_undo(cache, pool, i, ptrs);
+            return ENOMEM;
+        }
+
+        num = MIN(n - i, cache->num_free);
+        cache->num_free -= num;
+        for (list = cache->free ; num > 0 ; num--) {
+            MPOOL_MEMPOOL_ALLOC(MPOOL_GET(pool), list, pool->elem_size);
+            if (ctx->owner_map != NULL)
+                mpool_set_owner(ctx, list);
+
+            ptrs[i++] = list;
+            list = list->next;
+        }
+
+        cache->free = list;
+    }
+
+    MPOOL_COUNT_ALLOCS(pool, cache, n);
+    for (i = 0 ; i < n ; i++) {
+        MPOOL_MAKE_MEM_UNDEFINED(ptrs[i], size);
+        MPOOL_MAKE_MEM_NOACCESS((uint8_t *) ptrs[i] + size,
+                pool->elem_size - size);
+    }
+
+    return 0;
+}
+
+
+int
+mpool_alloc_bulk(size_t size, unsigned int n, void ** ptrs)
+{
+    return mpool_ctx_alloc_bulk(pool_glob.default_ctx, size, n, ptrs);
+}
+
+
+void
+mpool_ctx_free_bulk(struct mpool_ctx * ctx, size_t size, unsigned int n,
+        void ** ptrs)
+{
+    int pool_index;
+    unsigned int i;
+    struct mpool * pool;
+    struct mpool_cpu_cache * cache;
+    struct chunk_list * chunk;
+
+    assert(ctx != NULL);
+    assert(ptrs != NULL || n == 0);
+
+    if (n == 0)
+        return;
+
+    /* the chunks may come from different nodes */
+    if (unlikely(ctx->num_nodes != 0)) {
+        for (i = 0 ; i < n ; i++)
+            mpool_ctx_free_size(ctx, ptrs[i], size);
+
+        return;
+    }
+
+    /* large runs, per-CPU caches, chunks which may have other owners, and
+     * threads without caches free them one at a time */
+    pool_index = mpool_get_pool_index(ctx, size);
+    cache = NULL;
+    if (likely(pool_index < NUM_POOLS && ctx->percpu == NULL
+               && ctx->owner_map == NULL))
+        cache = mpool_get_cache(ctx, pool_index);
+
+    if (unlikely(cache == NULL)) {
+        for (i = 0 ; i < n ; i++)
+            mpool_ctx_free_inline(ctx, ptrs[i], pool_index);
+
+        return;
+    }
+
+    pool = &ctx->pools[pool_index];
+
+    /* chain the chunks, and splice the chain in front of the thread cache */
+    for (i = 0 ; i < n ; i++) {
+        assert(ptrs[i] != NULL);
+        MPOOL_MEMPOOL_FREE(MPOOL_GET(pool), ptrs[i]);
+        MPOOL_MAKE_MEM_DEFINED(ptrs[i], sizeof(uintptr_t));
+
+        chunk = ptrs[i];
+        chunk->next = i + 1 < n ? ptrs[i + 1] : cache->free;
+    }
+
+    cache->free = ptrs[0];
+    cache->num_free += n;
+    MPOOL_COUNT_FREES(pool, cache, n);
+
+    /* a single flush, the chunks above the cache batch make a single batch */
+    if (cache->num_free > 2 * cache->batch)
+        mpool_empty_cache(ctx, cache, pool);
+}
+
+
+void
+mpool_free_bulk(size_t size, unsigned int n, void ** ptrs)
+{
+    mpool_ctx_free_bulk(pool_glob.default_ctx, size, n, ptrs);
+}
+
+
+size_t mpool_ctx_usable_size(struct mpool_ctx * ctx, void const * ptr)
+{
+    int pool_index;
+
+    assert(ctx != NULL);
+
+    if (ptr == NULL)
+        return 0;
+
+    if (ctx->num_nodes != 0) {
+        ctx = mpool_numa_owner(ctx, ptr);
+        if (ctx == NULL)
+            return 0;
+    }
+
+    pool_index = mpool_get_ptr_index(ctx, ptr);
+    if (pool_index < 0)
+        return 0;
+
+    if (pool_index >= NUM_POOLS)
+        return mpool_large_size(&ctx->large, ptr);
+
+    return ctx->pools[pool_index].elem_size;
+}
+
+
+size_t mpool_usable_size(void const * ptr)
+{
+    return mpool_ctx_usable_size(pool_glob.default_ctx, ptr);
+}
+
+
+static ALWAYS_INLINE void *
+mpool_ctx_realloc_inline(struct mpool_ctx * ctx, void const * ptr,
+        size_t old_size, size_t new_size)
+{
+    void * tmp;
+    int old_index, new_index;
+    struct mpool_ctx * owner;
+
+    assert(ptr != NULL || old_size == 0);
+    if (unlikely(ptr == NULL && old_size != 0))
+        return NULL;
+
+    owner = ctx;
+    if (unlikely(ctx->num_nodes != 0 && ptr != NULL)) {
+        owner = mpool_numa_owner(ctx, ptr);
+        assert(owner != NULL);
+        if (unlikely(owner == NULL))
+            return NULL;
+    }
+
+    /* from the address: aligned chunks may come from a bigger size class, or
+     * the large tier */
+    old_index = ptr != NULL ? mpool_get_ptr_index(owner, ptr) : -1;
+    new_index = mpool_get_pool_index(owner, new_size);
+    if (ptr != NULL && old_index == new_index && new_index < NUM_POOLS) {
+        MPOOL_MAKE_MEM_UNDEFINED((const uint8_t *) ptr + old_size, new_size -
+                old_size);
+        return VOIDPTR(ptr);
+    }
+
+    /* large runs shrink, or grow over the following free pages, in place */
+    if (  ptr != NULL
+       && old_index >= NUM_POOLS
+       && new_index >= NUM_POOLS
+       && mpool_large_resize(&owner->large, ptr, new_size) == 0) {
+        MPOOL_MEMPOOL_CHANGE(MPOOL_GET(&owner->large), ptr, ptr, new_size);
+        return VOIDPTR(ptr);
+    }
+
+    tmp = mpool_ctx_alloc_inline(ctx, new_size);
+    if (likely(tmp != NULL && ptr != NULL)) {
+        memcpy(tmp, ptr, MIN(old_size, new_size));
+        mpool_ctx_free_ptr_inline(ctx, ptr);
+    }
+
+    return tmp;
+}
+
+
+void * mpool_ctx_realloc(struct mpool_ctx * ctx, void const * ptr,
+        size_t old_size, size_t new_size, int flags)
+{
+    void * tmp;
+
+    (void) flags; /* for later user */
+
+    MPOOL_LAT_TIME(MPOOL_LATENCY_REALLOC, mpool_lat_size_index(ctx, new_size),
+            tmp = mpool_ctx_realloc_inline(ctx, ptr, old_size, new_size));
+
+    return tmp;
+}
+
+
+void * mpool_realloc(void const * ptr, size_t old_size, size_t new_size, int
+        flags)
+{
+    return mpool_ctx_realloc(pool_glob.default_ctx, ptr, old_size, new_size,
+            flags);
+}
+
+
+void
+mpool_ctx_set_cache_limit(struct mpool_ctx * ctx, size_t limit)
+{
+    int i;
+
+    assert(ctx != NULL);
+
+    for (i = 0 ; i < ctx->num_nodes ; i++)
+        mpool_ctx_set_cache_limit(ctx->nodes[i], limit);
+
+    __atomic_store_n(&ctx->cache_limit, limit, __ATOMIC_RELAXED);
+}
+
+
+void
+mpool_ctx_set_decay(struct mpool_ctx * ctx, unsigned int decay_ms)
+{
+    int i;
+
+    assert(ctx != NULL);
+
+    for (i = 0 ; i < ctx->num_nodes ; i++)
+        mpool_ctx_set_decay(ctx->nodes[i], decay_ms);
+
+    __atomic_store_n(&ctx->next_purge, mpool_now() + decay_ms * 1000000ULL,
+            __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->decay, decay_ms * 1000000ULL, __ATOMIC_RELAXED);
+}
+
+
+int
+mpool_ctx_cache_info(struct mpool_ctx * ctx, size_t size,
+        struct mpool_cache_info * info)
+{
+    int pool_index, cpu;
+    struct mpool_cpu_cache * cache;
+    struct mpool_percpu_stack * stack;
+
+    assert(ctx != NULL);
+    assert(info != NULL);
+
+    if (ctx->num_nodes != 0)
+        ctx = mpool_numa_local(ctx);
+
+    pool_index = mpool_get_pool_index(ctx, size);
+    if (pool_index >= NUM_POOLS || ctx->pools[pool_index].arena == NULL)
+        return EINVAL;
+
+    info->elem_size = ctx->pools[pool_index].elem_size;
+    if (ctx->percpu != NULL) {
+        cpu = sched_getcpu();
+        stack = &ctx->percpu[cpu > 0 ? cpu % ctx->percpu_rows : 0]
+                .stacks[pool_index];
+        info->num_free = (unsigned int) __atomic_load_n(&stack->num,
+                __ATOMIC_RELAXED);
+        info->batch = ctx->pools[pool_index].percpu_batch;
+        info->rseq = !ctx->percpu_locked;
+    } else {
+        cache = mpool_get_cache(ctx, pool_index);
+        if (cache == NULL)
+            return ENOMEM;
+
+        info->num_free = cache->num_free;
+        info->batch = cache->batch;
+        info->rseq = 0;
+    }
+
+    info->size = __atomic_load_n(&ctx->cache_size, __ATOMIC_RELAXED);
+    info->limit = __atomic_load_n(&ctx->cache_limit, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+
+size_t
+mpool_ctx_alloc_size(struct mpool_ctx * ctx, size_t size)
+{
+    int pool_index;
+
+    assert(ctx != NULL);
+
+    pool_index = mpool_get_pool_index(ctx, size);
+    if (pool_index >= NUM_POOLS)
+        return (size + PAGE_SIZE - 1) & ~((size_t) PAGE_SIZE - 1);
+
+    return mpool_class_size(pool_index);
+}
+
+
+int
+mpool_ctx_numa_stats(struct mpool_ctx * ctx, size_t * local_frees,
+        size_t * remote_frees)
+{
+    struct mpool_numa_frees * frees;
+
+    assert(ctx != NULL);
+
+    if (ctx->num_nodes == 0)
+        return EINVAL;
+
+    /* the counts of the calling thread are up to date */
+    frees = &pool_numa_frees[ctx->id];
+    if (frees->gen == ctx->gen)
+        mpool_numa_flush_frees(ctx, frees);
+
+    *local_frees = __atomic_load_n(&ctx->local_frees, __ATOMIC_RELAXED);
+    *remote_frees = __atomic_load_n(&ctx->remote_frees, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+
+#ifndef MPOOL_NO_STATS
+
+static void
+mpool_counters_add(struct mpool_counters const * counters,
+        struct mpool_class_stats * stats)
+{
+    stats->allocs += __atomic_load_n(&counters->allocs, __ATOMIC_RELAXED);
+    stats->frees += __atomic_load_n(&counters->frees, __ATOMIC_RELAXED);
+    stats->cache_misses += __atomic_load_n(&counters->misses,
+            __ATOMIC_RELAXED);
+    stats->refills += __atomic_load_n(&counters->refills, __ATOMIC_RELAXED);
+    stats->flushes += __atomic_load_n(&counters->flushes, __ATOMIC_RELAXED);
+    stats->contended += __atomic_load_n(&counters->contended,
+            __ATOMIC_RELAXED);
+    stats->enomem += __atomic_load_n(&counters->enomem, __ATOMIC_RELAXED);
+    stats->high_water += __atomic_load_n(&counters->high_water,
+            __ATOMIC_RELAXED);
+}
+
+
+/* add the counters of an instance to stats, the counts of the calling thread
+ * are up to date */
+static void
+mpool_ctx_stats_add(struct mpool_ctx * ctx, struct mpool_stats * stats)
+{
+    int i, cpu;
+    unsigned int n;
+    size_t num_pages;
+    struct mpool * pool;
+    struct mpool_cpu_cache * cache;
+    struct mpool_class_stats * class_stats, large_stats;
+
+    n = 0;
+    for (i = 0 ; i < NUM_POOLS ; i++) {
+        pool = &ctx->pools[i];
+        if (pool->arena == NULL)
+            continue;
+
+        cache = &pool_cache[ctx->id][i];
+        if (cache->gen == ctx->gen)
+            mpool_stats_fold(pool, cache);
+
+        class_stats = &stats->classes[n++];
+        class_stats->elem_size = pool->elem_size;
+        mpool_counters_add(&pool->counters, class_stats);
+        for (cpu = 0 ; ctx->percpu != NULL && cpu < ctx->percpu_rows ; cpu++) {
+            class_stats->allocs += __atomic_load_n(&ctx->percpu[cpu].allocs[i],
+                    __ATOMIC_RELAXED);
+            class_stats->frees += __atomic_load_n(&ctx->percpu[cpu].frees[i],
+                    __ATOMIC_RELAXED);
+        }
+
+        class_stats->used += mpool_num_used(pool);
+        class_stats->total += __atomic_load_n(&pool->num_chunks,
+                __ATOMIC_RELAXED);
+    }
+
+    stats->num_classes = n;
+
+    memset(&large_stats, 0, sizeof(large_stats));
+    mpool_counters_add(&ctx->large_counters, &large_stats);
+    stats->large.allocs += large_stats.allocs;
+    stats->large.frees += large_stats.frees;
+    stats->large.enomem += large_stats.enomem;
+    if (ctx->has_large) {
+        pthread_mutex_lock(&ctx->large.lock);
+        num_pages = ctx->large.num_added;
+        stats->large.used_pages += num_pages - ctx->large.num_free;
+        stats->large.total_pages += num_pages;
+        pthread_mutex_unlock(&ctx->large.lock);
+    }
+
+    stats->cache_size += __atomic_load_n(&ctx->cache_size, __ATOMIC_RELAXED);
+    stats->purged += __atomic_load_n(&ctx->purged, __ATOMIC_RELAXED);
+}
+
+#endif /* MPOOL_NO_STATS */
+
+
+int
+mpool_ctx_stats_get(struct mpool_ctx * ctx, struct mpool_stats * stats)
+{
+#ifndef MPOOL_NO_STATS
+    int i;
+    unsigned int j;
+    struct mpool_class_stats * class_stats;
+
+    assert(ctx != NULL);
+    assert(stats != NULL);
+
+    memset(stats, 0, sizeof(*stats));
+    if (ctx->num_nodes == 0)
+        mpool_ctx_stats_add(ctx, stats);
+
+    /* the nodes share their size classes */
+    for (i = 0 ; i < ctx->num_nodes ; i++)
+        mpool_ctx_stats_add(ctx->nodes[i], stats);
+
+    for (j = 0 ; j < stats->num_classes ; j++) {
+        class_stats = &stats->classes[j];
+        if (class_stats->allocs > class_stats->cache_misses)
+            class_stats->cache_hits = class_stats->allocs
+                                      - class_stats->cache_misses;
+    }
+
+    return 0;
+#else
+    (void) ctx;
+    (void) stats;
+
+    return ENOTSUP;
+#endif
+}
+
+
+int
+mpool_stats_get(struct mpool_stats * stats)
+{
+    return mpool_ctx_stats_get(pool_glob.default_ctx, stats);
+}
+
+
+#ifdef MPOOL_LATENCY
+
+/* the smallest count of ticks at least permille of the calls took, as the
+ * upper bound of its bucket */
+static uint64_t
+mpool_lat_percentile(size_t const * buckets, size_t count, uint64_t max,
+        unsigned int permille)
+{
+    unsigned int i;
+    size_t rank, sum;
+
+    rank = (count * permille + 999) / 1000;
+    sum = 0;
+    for (i = 0 ; i < NUM_LAT_BUCKETS ; i++) {
+        sum += buckets[i];
+        if (sum >= rank && sum > 0)
+            return MIN(mpool_lat_bucket_max(i), max);
+    }
+
+    return max;
+}
+
+#endif /* MPOOL_LATENCY */
+
+
+int
+mpool_ctx_latency_get(struct mpool_ctx * ctx, size_t size, int call,
+        int slow, struct mpool_latency * latency)
+{
+#ifdef MPOOL_LATENCY
+    int pool_index;
+    unsigned int i;
+    size_t buckets[NUM_LAT_BUCKETS];
+    struct mpool_lat_hist * hist;
+    struct mpool_lat_thread * lat;
+
+    assert(ctx != NULL);
+    assert(latency != NULL);
+
+    if (call < 0 || call >= MPOOL_LATENCY_CALLS || (slow != 0 && slow != 1))
+        return EINVAL;
+
+    memset(latency, 0, sizeof(*latency));
+    memset(buckets, 0, sizeof(buckets));
+    pool_index = mpool_lat_size_index(ctx, size);
+    if (pool_index < NUM_POOLS)
+        latency->elem_size = (ctx->num_nodes != 0 ? ctx->nodes[0] : ctx)
+                             ->pools[pool_index].elem_size;
+
+    for (lat = __atomic_load_n(&pool_lat_threads, __ATOMIC_ACQUIRE) ;
+         lat != NULL ; lat = lat->next) {
+        hist = &lat->hist[call][slow][pool_index];
+        for (i = 0 ; i < NUM_LAT_BUCKETS ; i++)
+            buckets[i] += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+
+        latency->max = MAX(latency->max,
+                __atomic_load_n(&hist->max, __ATOMIC_RELAXED));
+    }
+
+    for (i = 0 ; i < NUM_LAT_BUCKETS ; i++)
+        latency->count += buckets[i];
+
+    latency->p50 = mpool_lat_percentile(buckets, latency->count,
+            latency->max, 500);
+    latency->p99 = mpool_lat_percentile(buckets, latency->count,
+            latency->max, 990);
+    latency->p999 = mpool_lat_percentile(buckets, latency->count,
+            latency->max, 999);
+
+    return 0;
+#else
+    (void) ctx;
+    (void) size;
+    (void) call;
+    (void) slow;
+    (void) latency;
+
+    return ENOTSUP;
+#endif
+}
+
+
+int
+mpool_latency_get(size_t size, int call, int slow,
+        struct mpool_latency * latency)
+{
+    return mpool_ctx_latency_get(pool_glob.default_ctx, size, call, slow,
+            latency);
+}
+
+
+void
+mpool_latency_reset(void)
+{
+#ifdef MPOOL_LATENCY
+    int i, j, k;
+    unsigned int b;
+    struct mpool_lat_hist * hist;
+    struct mpool_lat_thread * lat;
+
+    for (lat = __atomic_load_n(&pool_lat_threads, __ATOMIC_ACQUIRE) ;
+         lat != NULL ; lat = lat->next) {
+        for (i = 0 ; i < MPOOL_LATENCY_CALLS ; i++) {
+            for (j = 0 ; j < 2 ; j++) {
+                for (k = 0 ; k < NUM_POOLS + 1 ; k++) {
+                    hist = &lat->hist[i][j][k];
+                    for (b = 0 ; b < NUM_LAT_BUCKETS ; b++)
+                        __atomic_store_n(&hist->buckets[b], 0,
+                                __ATOMIC_RELAXED);
+
+                    __atomic_store_n(&hist->max, 0, __ATOMIC_RELAXED);
+                }
+            }
+        }
+    }
+#endif
+}
+
+
+NOINLINE void
+mpool_ctx_stats(struct mpool_ctx * ctx)
+{
+    int i;
+    size_t num_elem, local_frees, remote_frees;
+    struct mpool * pool;
+    struct mpool_objcache * objcache;
+
+    if (mpool_ctx_numa_stats(ctx, &local_frees, &remote_frees) == 0) {
+        for (i = 0 ; i < ctx->num_nodes ; i++) {
+            printf("node %d%s\n", i, ctx->fake_numa ? " (fake)" : "");
+            mpool_ctx_stats(ctx->nodes[i]);
+        }
+
+        printf("frees local %zd remote %zd\n", local_frees, remote_frees);
+        return;
+    }
+
+    for (i = 0 ; i < NUM_POOLS ; i++) {
+        pool = &ctx->pools[i];
+        if (pool->arena == NULL)
+            continue;
+
+        printf("pool[%zd] %zd/%zd\n", pool->elem_size, mpool_num_used(pool),
+                __atomic_load_n(&pool->num_chunks, __ATOMIC_RELAXED));
+    }
+
+    pthread_mutex_lock(&pool_glob.lock);
+    for (i = 0 ; i < MPOOL_MAX_OBJCACHES ; i++) {
+        objcache = &pool_glob.objcache[i];
+        if (!objcache->in_use || objcache->ctx != ctx)
+            continue;
+
+        pool = &objcache->pool;
+        printf("objcache %s[%zd] %zd/%zd\n", objcache->name, pool->elem_size,
+                mpool_num_used(pool),
+                __atomic_load_n(&pool->num_chunks, __ATOMIC_RELAXED));
+    }
+
+    pthread_mutex_unlock(&pool_glob.lock);
+
+    if (ctx->has_large) {
+        num_elem = __atomic_load_n(&ctx->large.num_added, __ATOMIC_RELAXED);
+        printf("large %zd/%zd pages\n", num_elem - ctx->large.num_free,
+                num_elem);
+    }
+
+    printf("purged %zd bytes\n",
+            __atomic_load_n(&ctx->purged, __ATOMIC_RELAXED));
+
+    if (ctx->percpu != NULL) {
+        printf("per-CPU caches (%s)\n",
+                ctx->percpu_locked ? "locked" : "rseq");
+        return;
+    }
+
+    printf("thread caches grew by %zd/%zd bytes\n",
+            __atomic_load_n(&ctx->cache_size, __ATOMIC_RELAXED),
+            __atomic_load_n(&ctx->cache_limit, __ATOMIC_RELAXED));
+}
+
+
+NOINLINE void
+mpool_stats(void)
+{
+    mpool_ctx_stats(pool_glob.default_ctx);
+}
+
+
+static struct mpool_objcache *
+mpool_objcache_get_slot(struct mpool_ctx * ctx)
+{
+    int i;
+    struct mpool_objcache * objcache;
+
+    pthread_once(&pool_glob.once, mpool_glob_init);
+
+    objcache = NULL;
+    pthread_mutex_lock(&pool_glob.lock);
+    for (i = 0 ; i < MPOOL_MAX_OBJCACHES ; i++) {
+        if (!pool_glob.objcache[i].in_use) {
+            objcache = &pool_glob.objcache[i];
+            memset(&objcache->pool, 0, sizeof(objcache->pool));
+            objcache->ctx = ctx;
+            pthread_mutex_init(&objcache->grow_lock, NULL);
+            objcache->slabs = NULL;
+            objcache->num_slabs = 0;
+            objcache->cache_size = 0;
+            objcache->id = (unsigned int) i;
+            objcache->gen = ++pool_glob.gen;
+            if (objcache->gen == 0)
+                objcache->gen = ++pool_glob.gen;
+
+            objcache->in_use = 1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&pool_glob.lock);
+
+    return objcache;
+}
+
+
+/* objects are packed at their size rounded up to the batch reference unit,
+ * and to their alignment, after the header of their slab */
+NOINLINE struct mpool_objcache *
+mpool_ctx_objcache_create(struct mpool_ctx * ctx, char const * name,
+        size_t obj_size, size_t align, void (* ctor)(void * obj),
+        void (* dtor)(void * obj))
+{
+    size_t elem_size, link, offset, slab_size, end;
+    struct mpool_objcache * objcache;
+
+    assert(ctx != NULL);
+
+    if (align == 0)
+        align = 1 << LG2_BATCH_REF_UNIT;
+
+    if (  obj_size == 0 || obj_size > MPOOL_OBJCACHE_MAX_SIZE
+       || (align & (align - 1)) != 0 || align > PAGE_SIZE)
+        return NULL;
+
+    if (ctx->num_nodes != 0)
+        ctx = mpool_numa_local(ctx);
+
+    /* the batches are referenced from the base of the instance */
+    end = ctx->segment_pool != NULL ? ctx->reserve_size
+                                    : ctx->slice_end[NUM_POOLS] - ctx->base;
+    if (!ctx->has_large || end >> LG2_BATCH_REF_UNIT >= UINT32_MAX)
+        return NULL;
+
+    align = MAX(align, 1 << LG2_BATCH_REF_UNIT);
+    link = 0;
+    elem_size = MAX(obj_size, sizeof(struct chunk_batch));
+    if (ctor != NULL || dtor != NULL) {
+        link = (obj_size + (1 << LG2_BATCH_REF_UNIT) - 1)
+               & ~((size_t) (1 << LG2_BATCH_REF_UNIT) - 1);
+        elem_size = link + sizeof(struct chunk_batch);
+    }
+
+    elem_size = (elem_size + align - 1) & ~(align - 1);
+    offset = MAX(CACHELINE_SIZE, align);
+    slab_size = offset + MAX(MPOOL_OBJCACHE_SLAB_SIZE,
+            MPOOL_OBJCACHE_MIN_OBJS * elem_size);
+    slab_size = (slab_size + PAGE_SIZE - 1) & ~((size_t) PAGE_SIZE - 1);
+
+    objcache = mpool_objcache_get_slot(ctx);
+    if (objcache == NULL)
+        return NULL;
+
+    snprintf(objcache->name, sizeof(objcache->name), "%s",
+            name != NULL ? name : "");
+    objcache->obj_size = obj_size;
+    objcache->link = link;
+    objcache->offset = offset;
+    objcache->slab_size = slab_size;
+    objcache->slab_objs = (slab_size - offset) / elem_size;
+    objcache->ctor = ctor;
+    objcache->dtor = dtor;
+    objcache->pool.arena = (uint8_t *) ctx->base;
+    mpool_init_arena(&objcache->pool, elem_size, 0);
+
+    return objcache;
+}
+
+
+struct mpool_objcache *
+mpool_objcache_create(char const * name, size_t obj_size, size_t align,
+        void (* ctor)(void * obj), void (* dtor)(void * obj))
+{
+    return mpool_ctx_objcache_create(pool_glob.default_ctx, name, obj_size,
+            align, ctor, dtor);
+}
+
+
+/* every object is free by now, and the ones ever carved are constructed. Only
+ * the newest slab may not be carved whole */
+NOINLINE void
+mpool_objcache_destroy(struct mpool_objcache * objcache)
+{
+    size_t i;
+    uint8_t * chunk, * end;
+    struct mpool_slab * slab, * next;
+    struct mpool_ctx * ctx;
+
+    if (objcache == NULL)
+        return;
+
+    ctx = objcache->ctx;
+    end = objcache->pool.arena
+          + ((size_t) CARVE_NEXT(objcache->pool.carve) << LG2_BATCH_REF_UNIT);
+    for (slab = objcache->slabs ; slab != NULL ; slab = next) {
+        next = slab->next;
+        chunk = (uint8_t *) slab + objcache->offset + objcache->link;
+        for (i = 0 ; objcache->dtor != NULL && i < objcache->slab_objs ; i++) {
+            if (slab == objcache->slabs && chunk >= end)
+                break;
+
+            objcache->dtor(chunk - objcache->link);
+            chunk += objcache->pool.elem_size;
+        }
+
+        mpool_ctx_free_inline(ctx, slab, NUM_POOLS);
+    }
+
+    __atomic_sub_fetch(&ctx->cache_size, objcache->cache_size,
+            __ATOMIC_RELAXED);
+    MPOOL_DESTROY_MEMPOOL(MPOOL_GET(&objcache->pool));
+
+    pthread_mutex_lock(&pool_glob.lock);
+    objcache->in_use = 0;
+    pthread_mutex_unlock(&pool_glob.lock);
+}
+
+
+/* add a slab to carve once the newest one is used up, unless another thread
+ * just did */
+static int
+mpool_objcache_grow(struct mpool_objcache * objcache)
+{
+    int rv;
+    struct mpool_slab * slab;
+
+    rv = 0;
+    pthread_mutex_lock(&objcache->grow_lock);
+    if (mpool_num_uncarved(&objcache->pool) == 0) {
+        slab = mpool_large_alloc_ctx(objcache->ctx, objcache->slab_size,
+                PAGE_SIZE);
+        if (slab != NULL) {
+            slab->next = objcache->slabs;
+            objcache->slabs = slab;
+            objcache->num_slabs++;
+            mpool_add_region(&objcache->pool,
+                    (uint8_t *) slab + objcache->offset + objcache->link,
+                    objcache->slab_objs * objcache->pool.elem_size);
+        } else {
+            rv = ENOMEM;
+        }
+    }
+
+    pthread_mutex_unlock(&objcache->grow_lock);
+
+    return rv;
+}
+
+
+/* free objects first, or else objects carved from the slabs, constructed on
+ * their way out */
+static NOINLINE int
+mpool_objcache_fill(struct mpool_objcache * objcache,
+        struct mpool_cpu_cache * cache)
+{
+    struct mpool * pool;
+    struct chunk_list * chunk;
+    struct chunk_batch * batch;
+
+    pool = &objcache->pool;
+    if (cache->last == MPOOL_CACHE_REFILL && cache->batch < pool->max_batch)
+        mpool_objcache_resize(objcache, cache,
+                MIN(2 * cache->batch, pool->max_batch));
+
+    cache->last = MPOOL_CACHE_REFILL;
+
+    for (;;) {
+        batch = mpool_central_pop(pool);
+        if (batch != NULL)
+            break;
+
+        batch = mpool_carve(pool, cache->batch);
+        if (batch != NULL) {
+            for (chunk = &batch->list ; objcache->ctor != NULL && chunk != NULL ;
+                 chunk = chunk->next)
+                objcache->ctor((uint8_t *) chunk - objcache->link);
+
+            break;
+        }
+
+        if (mpool_objcache_grow(objcache) != 0) {
+            MPOOL_STAT_ADD(&pool->counters, enomem, 1);
+            return ENOMEM;
+        }
+    }
+
+    mpool_stats_high_water(pool);
+    mpool_cache_take(cache, pool, NULL, batch);
+
+    return 0;
+}
+
+
+static NOINLINE void
+mpool_objcache_flush(struct mpool_objcache * objcache,
+        struct mpool_cpu_cache * cache)
+{
+    struct mpool * pool;
+
+    pool = &objcache->pool;
+    if (cache->last == MPOOL_CACHE_FLUSH && cache->batch > pool->min_batch)
+        mpool_objcache_resize(objcache, cache,
+                MAX(cache->batch / 2, pool->min_batch));
+
+    cache->last = MPOOL_CACHE_FLUSH;
+    mpool_cache_give(cache, pool);
+}
+
+
+/* the caches of all the object caches are mapped on the first one used. NULL
+ * when they cannot be */
+static NOINLINE struct mpool_cpu_cache *
+mpool_objcache_init_cache(struct mpool_objcache const * objcache)
+{
+    struct mpool_cpu_cache * cache;
+
+    if (pool_objcache == pool_cache_none) {
+        cache = mpool_map_caches(MPOOL_MAX_OBJCACHES);
+        if (cache == NULL)
+            return NULL;
+
+        pool_objcache = cache;
+    }
+
+    cache = &pool_objcache[objcache->id];
+    mpool_reset_cache(cache, &objcache->pool, objcache->gen);
+
+    return cache;
+}
+
+
+static ALWAYS_INLINE struct mpool_cpu_cache *
+mpool_objcache_get_cache(struct mpool_objcache const * objcache)
+{
+    struct mpool_cpu_cache * cache;
+
+    cache = &pool_objcache[objcache->id];
+    if (unlikely(cache->gen != objcache->gen))
+        cache = mpool_objcache_init_cache(objcache);
+
+    return cache;
+}
+
+
+void *
+mpool_objcache_alloc(struct mpool_objcache * objcache)
+{
+    struct chunk_list * chunk;
+    struct mpool_cpu_cache * cache;
+
+    assert(objcache != NULL);
+
+    cache = mpool_objcache_get_cache(objcache);
+    if (unlikely(cache == NULL))
+        return NULL;
+
+    if (cache->num_free == 0) {
+        MPOOL_STAT_ADD(&objcache->pool.counters, misses, 1);
+        if (unlikely(mpool_objcache_fill(objcache, cache)))
+            return NULL;
+
+        assert(cache->num_free > 0);
+    }
+
+    chunk = cache->free;
+    cache->free = chunk->next;
+    cache->num_free -= 1;
+    MPOOL_COUNT_ALLOCS(&objcache->pool, cache, 1);
+
+    return (uint8_t *) chunk - objcache->link;
+}
+
+
+void
+mpool_objcache_free(struct mpool_objcache * objcache, void const * obj)
+{
+    struct chunk_list * chunk;
+    struct mpool_cpu_cache * cache;
+
+    if (obj == NULL)
+        return;
+
+    assert(objcache != NULL);
+
+    cache = mpool_objcache_get_cache(objcache);
+    MPOOL_COUNT_FREES(&objcache->pool, cache, 1);
+
+    chunk = VOIDPTR((uint8_t const *) obj + objcache->link);
+    if (unlikely(cache == NULL)) {
+        mpool_free_uncached(&objcache->pool, chunk);
+        return;
+    }
+
+    chunk->next = cache->free;
+    cache->free = chunk;
+    cache->num_free += 1;
+
+    if (unlikely(cache->num_free > 2 * cache->batch))
+        mpool_objcache_flush(objcache, cache);
+}
+
+
+int
+mpool_objcache_stats_get(struct mpool_objcache * objcache,
+        struct mpool_class_stats * stats)
+{
+#ifndef MPOOL_NO_STATS
+    struct mpool * pool;
+    struct mpool_cpu_cache * cache;
+
+    assert(objcache != NULL);
+    assert(stats != NULL);
+
+    /* the counts of the calling thread are up to date */
+    pool = &objcache->pool;
+    cache = &pool_objcache[objcache->id];
+    if (cache->gen == objcache->gen)
+        mpool_stats_fold(pool, cache);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->elem_size = pool->elem_size;
+    mpool_counters_add(&pool->counters, stats);
+    if (stats->allocs > stats->cache_misses)
+        stats->cache_hits = stats->allocs - stats->cache_misses;
+
+    stats->used = mpool_num_used(pool);
+    stats->total = __atomic_load_n(&pool->num_chunks, __ATOMIC_RELAXED);
+
+    return 0;
+#else
+    (void) objcache;
+    (void) stats;
+
+    return ENOTSUP;
+#endif
 }
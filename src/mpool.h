@@ -1,17 +1,362 @@
 #ifndef MPOOL_H
 #define MPOOL_H
 
+#include <stdint.h>
 #include <stdlib.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* weights[i] is the share of the arena given to the chunks bigger than
+ * (cacheline size << (i - 1)) bytes, up to (cacheline size << i) bytes and the
+ * page size. Each of these doublings is split evenly between four size
+ * classes. One more weight can be given for the large object tier, which
+ * serves bigger allocations as runs of pages. */
 int mpool_create(void * arena, size_t total_size, unsigned int * weights, int
         weights_len);
 void mpool_destroy(void);
 
 void * mpool_alloc(size_t size, int flags);
 void mpool_free(void const * ptr, size_t size);
+
+/* release a chunk, and tell its size, from its address alone. A pointer which
+ * does not come from the pool has no usable size */
+void mpool_free_ptr(void const * ptr);
+size_t mpool_usable_size(void const * ptr);
+
 void * mpool_realloc(void const * ptr, size_t old_size, size_t new_size, int
         flags);
 
+/* allocate size bytes aligned on alignment, a power of two, or return NULL.
+ * The chunk is to be released with mpool_free_ptr() */
+void * mpool_aligned_alloc(size_t alignment, size_t size);
+
+/* allocate, or release, n chunks of size bytes at once. Chunks move between the
+ * thread cache and the pool by whole batches. The allocation is all or
+ * nothing, it returns 0 or ENOMEM */
+int mpool_alloc_bulk(size_t size, unsigned int n, void ** ptrs);
+void mpool_free_bulk(size_t size, unsigned int n, void ** ptrs);
+
+/* inline forms of mpool_alloc() and mpool_free() for sizes known at compile
+ * time, up to MPOOL_INLINE_MAX_SIZE: the size class is picked at compile time,
+ * and the chunk taken from, or given to, the calling thread cache without
+ * calling the library, which is only called on cache misses and overflows.
+ * Other sizes go to mpool_alloc() and mpool_free(), and so do all sizes when
+ * the default instance has no plain thread caches (MPOOL_NUMA, MPOOL_PERCPU,
+ * MPOOL_REMOTE_FREE), or the library is built with MEMCHECK or
+ * MPOOL_LATENCY. Chunks are released with either form, or mpool_free_ptr().
+ * The thread caches are expected in the static TLS block of the program:
+ * code loaded with dlopen(), rather than linked to the library, defines
+ * MPOOL_TLS_MODEL as "global-dynamic" first. */
+#define MPOOL_INLINE_MAX_SIZE 1024
+#define MPOOL_INLINE_GRANULES ((MPOOL_INLINE_MAX_SIZE >> 4) + 1)
+#define MPOOL_INLINE_NONE 0xffffffffU /* no instance is served inline */
+
+#ifndef MPOOL_TLS_MODEL
+#define MPOOL_TLS_MODEL "initial-exec"
+#endif
+
+/* the fields of a thread cache the inline forms use */
+struct mpool_tcache {
+    void * free; /* chunks linked through their first word */
+    unsigned int num_free;
+    unsigned int batch; /* it is flushed above twice that */
+    unsigned int num_allocs;
+    unsigned int num_frees;
+};
+
+/* the caches of the default instance serving each 16 bytes of size, valid
+ * while gen is the one of mpool_inline_gen */
+struct mpool_inline_caches {
+    unsigned int gen;
+    struct mpool_tcache * caches[MPOOL_INLINE_GRANULES];
+};
+
+extern __thread struct mpool_inline_caches mpool_inline_caches
+        __attribute__((tls_model(MPOOL_TLS_MODEL)));
+extern unsigned int mpool_inline_gen;
+
+void * mpool_alloc_slow(size_t size);
+void mpool_free_slow(void const * ptr, size_t size);
+
+static inline __attribute__((always_inline)) void *
+mpool_alloc_fast(size_t size)
+{
+    void * ptr;
+    struct mpool_tcache * cache;
+
+    if (!__builtin_constant_p(size) || size > MPOOL_INLINE_MAX_SIZE)
+        return mpool_alloc(size, 0);
+
+    if (__builtin_expect(mpool_inline_caches.gen
+                         == __atomic_load_n(&mpool_inline_gen,
+                                 __ATOMIC_RELAXED), 1)) {
+        cache = mpool_inline_caches.caches[(size + 15) >> 4];
+        if (__builtin_expect(cache->num_free != 0, 1)) {
+            ptr = cache->free;
+            cache->free = *(void **) ptr;
+            cache->num_free -= 1;
+            cache->num_allocs += 1;
+            return ptr;
+        }
+    }
+
+    return mpool_alloc_slow(size);
+}
+
+
+static inline __attribute__((always_inline)) void
+mpool_free_fast(void const * ptr, size_t size)
+{
+    struct mpool_tcache * cache;
+
+    if (!__builtin_constant_p(size) || size > MPOOL_INLINE_MAX_SIZE) {
+        mpool_free(ptr, size);
+        return;
+    }
+
+    if (__builtin_expect(mpool_inline_caches.gen
+                         == __atomic_load_n(&mpool_inline_gen,
+                                 __ATOMIC_RELAXED), 1)) {
+        cache = mpool_inline_caches.caches[(size + 15) >> 4];
+        if (  __builtin_expect(cache->num_free < 2 * cache->batch, 1)
+           && ptr != NULL) {
+            *(void **) (uintptr_t) ptr = cache->free;
+            cache->free = (void *) (uintptr_t) ptr;
+            cache->num_free += 1;
+            cache->num_frees += 1;
+            return;
+        }
+    }
+
+    mpool_free_slow(ptr, size);
+}
+
 void mpool_stats(void);
 
+/* give the pages of the size classes which only hold free chunks back to the
+ * system, returns how many bytes. The chunks held by thread or per-CPU caches
+ * are not purged */
+size_t mpool_purge(void);
+
+/* mpool_arena_map() flags */
+#define MPOOL_MAP_THP 0x1      /* transparent huge pages */
+#define MPOOL_MAP_HUGETLB 0x2  /* huge pages reserved in the hugetlbfs pool,
+                                * transparent ones when it runs short */
+#define MPOOL_MAP_POPULATE 0x4 /* fault the whole arena in up front */
+#define MPOOL_MAP_LOCK 0x8     /* and keep it in memory */
+
+/* map an arena for mpool_create() or mpool_ctx_create(), its size rounded up
+ * to the huge page size. The modes which are not available fall back to the
+ * next best ones, flags are updated with those which took effect. Returns
+ * NULL when no memory could be mapped at all */
+void * mpool_arena_map(size_t size, int * flags);
+void mpool_arena_unmap(void * arena, size_t size);
+
+/* independent instances, each with its own arena and thread caches.
+ * The functions above work on a default instance. */
+struct mpool_ctx;
+
+/* mpool_ctx_create() flags */
+#define MPOOL_GROW 0x1 /* no arena is given: total_size bytes of address space
+                        * are reserved, and committed on demand to the size
+                        * classes and large tier given a weight */
+#define MPOOL_POW2_CLASSES 0x2 /* a single size class per doubling */
+#define MPOOL_TINY_CLASSES 0x4 /* size classes of 16, 32 and 48 bytes sharing
+                                * weights[0], packed in cachelines: only for
+                                * objects which are thread local or read
+                                * mostly, chunks used by different threads may
+                                * false share */
+#define MPOOL_NUMA 0x8 /* with MPOOL_GROW: a growable instance of total_size
+                        * bytes per NUMA node, bound to it. Threads allocate
+                        * from the instance of their node, chunks are freed
+                        * to the one they come from. MPOOL_NUMA_NODES=n in
+                        * the environment fakes n nodes */
+#define MPOOL_PERCPU 0x10 /* caches per CPU instead of per thread, updated
+                           * with restartable sequences, or locked per CPU
+                           * where rseq is not available. They are not
+                           * adaptive, and need no flush at thread exit */
+#define MPOOL_REMOTE_FREE 0x20 /* chunks freed by another thread than the one
+                                * they were allocated to go back to it by
+                                * batches, through a lock-free queue it
+                                * empties on refill. For producer/consumer
+                                * workloads; ignored with MPOOL_PERCPU.
+                                * Only in libraries built with REMOTE_FREE=1,
+                                * mpool_ctx_create() fails with errno set to
+                                * ENOTSUP otherwise */
+#define MPOOL_FORK_DROP_CACHES 0x40 /* the child of a fork() drops the thread
+                                     * caches it inherits rather than using
+                                     * them, without touching their chunks:
+                                     * no copy on write of their pages, but
+                                     * they are lost to the child */
+
+struct mpool_ctx * mpool_ctx_create(void * arena, size_t total_size,
+        unsigned int * weights, int weights_len, int flags);
+void mpool_ctx_destroy(struct mpool_ctx * ctx);
+
+/* make an instance the default one, mpool_destroy() then destroys it */
+void mpool_set_default(struct mpool_ctx * ctx);
+
+void * mpool_ctx_alloc(struct mpool_ctx * ctx, size_t size, int flags);
+void mpool_ctx_free(struct mpool_ctx * ctx, void const * ptr, size_t size);
+void mpool_ctx_free_ptr(struct mpool_ctx * ctx, void const * ptr);
+size_t mpool_ctx_usable_size(struct mpool_ctx * ctx, void const * ptr);
+void * mpool_ctx_realloc(struct mpool_ctx * ctx, void const * ptr,
+        size_t old_size, size_t new_size, int flags);
+void * mpool_ctx_aligned_alloc(struct mpool_ctx * ctx, size_t alignment,
+        size_t size);
+int mpool_ctx_alloc_bulk(struct mpool_ctx * ctx, size_t size, unsigned int n,
+        void ** ptrs);
+void mpool_ctx_free_bulk(struct mpool_ctx * ctx, size_t size, unsigned int n,
+        void ** ptrs);
+
+/* size of the chunk an allocation of size bytes gets */
+size_t mpool_ctx_alloc_size(struct mpool_ctx * ctx, size_t size);
+
+void mpool_ctx_stats(struct mpool_ctx * ctx);
+
+/* thread caches refill and flush each size class by batches, which grow for
+ * the threads that keep refilling it and shrink for the ones that keep
+ * flushing it. limit caps the bytes all the thread caches of the instance may
+ * grow by. The caches of a size class also grow by at most 1/128 of its
+ * chunks, so that a class sized for its working set is not held up in the
+ * caches of threads done with it. */
+void mpool_ctx_set_cache_limit(struct mpool_ctx * ctx, size_t limit);
+
+struct mpool_cache_info {
+    size_t elem_size;      /* size class serving the requested size */
+    unsigned int num_free; /* chunks in the calling thread cache, or the
+                            * one of its CPU */
+    unsigned int batch;    /* its current refill and flush size */
+    int rseq;              /* per-CPU caches updated with restartable
+                            * sequences rather than locked */
+    size_t size;           /* bytes all the thread caches grew by */
+    size_t limit;
+};
+
+int mpool_ctx_cache_info(struct mpool_ctx * ctx, size_t size,
+        struct mpool_cache_info * info);
+
+size_t mpool_ctx_purge(struct mpool_ctx * ctx);
+
+/* purge every decay_ms milliseconds, from the threads flushing chunks to the
+ * pools, 0 never does (the default) */
+void mpool_ctx_set_decay(struct mpool_ctx * ctx, unsigned int decay_ms);
+
+/* frees of the chunks of a NUMA instance by threads of the node they come
+ * from, and of other nodes. EINVAL for other instances */
+int mpool_ctx_numa_stats(struct mpool_ctx * ctx, size_t * local_frees,
+        size_t * remote_frees);
+
+#define MPOOL_STATS_MAX_CLASSES 64
+
+/* counters of a size class. Threads add up their allocations and frees by
+ * batches, the counts of the other running threads may lag behind by a few
+ * hundred per size class, and by those of mpool_alloc_fast() and
+ * mpool_free_fast() since their last cache miss or flush */
+struct mpool_class_stats {
+    size_t elem_size;
+    size_t allocs;
+    size_t frees;
+    size_t cache_hits;   /* allocations served by a thread or per-CPU cache */
+    size_t cache_misses; /* and the ones which found it empty */
+    size_t refills;      /* batches the caches took from the pool */
+    size_t flushes;      /* batches they gave back */
+    size_t contended;    /* retried updates of the pool free list, or waits
+                          * for its lock */
+    size_t enomem;       /* allocations failed for want of chunks */
+    size_t used;         /* chunks out of the pool, allocated or cached */
+    size_t high_water;   /* the most chunks out at once, as seen on refills */
+    size_t total;        /* chunks of the size class */
+};
+
+struct mpool_large_stats {
+    size_t allocs;
+    size_t frees;
+    size_t enomem;
+    size_t used_pages;
+    size_t total_pages;
+};
+
+struct mpool_stats {
+    unsigned int num_classes; /* the size classes given a weight, smallest
+                               * first */
+    struct mpool_class_stats classes[MPOOL_STATS_MAX_CLASSES];
+    struct mpool_large_stats large;
+    size_t cache_size; /* bytes the thread caches grew by */
+    size_t purged;     /* bytes */
+};
+
+/* fill stats in, NUMA instances sum up their nodes. ENOTSUP when the library
+ * is built with MPOOL_NO_STATS, which removes the counters altogether */
+int mpool_ctx_stats_get(struct mpool_ctx * ctx, struct mpool_stats * stats);
+int mpool_stats_get(struct mpool_stats * stats);
+
+/* per-call latency of mpool_alloc(), mpool_free(), mpool_free_ptr(),
+ * mpool_realloc() and of their mpool_ctx_*() forms, recorded by libraries
+ * built with MPOOL_LATENCY, in TSC ticks (nanoseconds where there is no TSC).
+ * Each thread keeps log-linear histograms per call and size class, with the
+ * calls which refilled or flushed a thread or per-CPU cache (slow) apart from
+ * the others. Those of all instances are added up per size class rank, size
+ * picks the size class of the given instance, or its large tier.
+ * Percentiles are within 1/8th of the exact value. ENOTSUP without
+ * MPOOL_LATENCY */
+#define MPOOL_LATENCY_ALLOC 0
+#define MPOOL_LATENCY_FREE 1
+#define MPOOL_LATENCY_REALLOC 2
+#define MPOOL_LATENCY_CALLS 3
+
+struct mpool_latency {
+    size_t elem_size; /* 0 for the large tier */
+    size_t count;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+int mpool_ctx_latency_get(struct mpool_ctx * ctx, size_t size, int call,
+        int slow, struct mpool_latency * latency);
+int mpool_latency_get(size_t size, int call, int slow,
+        struct mpool_latency * latency);
+
+/* clear the histograms of all threads, while they make no calls */
+void mpool_latency_reset(void);
+
+/* object caches, slab style: objects of a single type, packed at their size
+ * rounded up to 16 bytes and to align (0 for 16, or a power of two up to the
+ * page size) in slabs taken from the large tier of an instance, which needs a
+ * large tier weight. Objects are cached per thread like chunks, and released
+ * with mpool_objcache_free() only.
+ * The constructor runs once per object, when it is first handed out, and
+ * the freed objects keep their constructed state: allocations get them back
+ * as they were left. The destructor runs on every constructed object when
+ * the cache is destroyed, which is done once they are all freed, and before
+ * the instance is destroyed. Objects with a constructor or a destructor take
+ * 16 more bytes, for the free list link. */
+struct mpool_objcache;
+
+#define MPOOL_OBJCACHE_NAME_LEN 32 /* names are truncated to it */
+
+struct mpool_objcache * mpool_ctx_objcache_create(struct mpool_ctx * ctx,
+        char const * name, size_t obj_size, size_t align,
+        void (* ctor)(void * obj), void (* dtor)(void * obj));
+struct mpool_objcache * mpool_objcache_create(char const * name,
+        size_t obj_size, size_t align, void (* ctor)(void * obj),
+        void (* dtor)(void * obj));
+void mpool_objcache_destroy(struct mpool_objcache * objcache);
+
+void * mpool_objcache_alloc(struct mpool_objcache * objcache);
+void mpool_objcache_free(struct mpool_objcache * objcache, void const * obj);
+
+/* counters of the objects of the cache, elem_size is their footprint.
+ * ENOTSUP with MPOOL_NO_STATS */
+int mpool_objcache_stats_get(struct mpool_objcache * objcache,
+        struct mpool_class_stats * stats);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* MPOOL_H */
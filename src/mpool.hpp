@@ -0,0 +1,188 @@
+#ifndef MPOOL_HPP
+#define MPOOL_HPP
+
+/*
+ * C++ adaptors, C++17.
+ *
+ * The allocators know the size of what they release, and hand it to
+ * mpool_free() rather than having it looked up from the address. Allocations
+ * aligned on more than mpool_chunk_alignment are made with
+ * mpool_aligned_alloc() and released with mpool_free_ptr().
+ */
+
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+#include "mpool.h"
+
+/* every chunk is aligned on it */
+constexpr std::size_t mpool_chunk_alignment = 16;
+
+namespace mpool_detail {
+
+inline void *
+allocate(struct mpool_ctx * ctx, std::size_t size, std::size_t alignment)
+{
+    void * ptr;
+
+    if (alignment <= mpool_chunk_alignment)
+        ptr = ctx != nullptr ? mpool_ctx_alloc(ctx, size, 0)
+                             : mpool_alloc(size, 0);
+    else
+        ptr = ctx != nullptr ? mpool_ctx_aligned_alloc(ctx, alignment, size)
+                             : mpool_aligned_alloc(alignment, size);
+
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+
+    return ptr;
+}
+
+
+inline void
+deallocate(struct mpool_ctx * ctx, void * ptr, std::size_t size,
+        std::size_t alignment) noexcept
+{
+    if (alignment <= mpool_chunk_alignment) {
+        if (ctx != nullptr)
+            mpool_ctx_free(ctx, ptr, size);
+        else
+            mpool_free(ptr, size);
+    } else {
+        if (ctx != nullptr)
+            mpool_ctx_free_ptr(ctx, ptr);
+        else
+            mpool_free_ptr(ptr);
+    }
+}
+
+} /* namespace mpool_detail */
+
+
+/* polymorphic resource over an instance, the default one when none is
+ * given. Allocations fail with std::bad_alloc */
+class mpool_memory_resource : public std::pmr::memory_resource {
+public:
+    explicit mpool_memory_resource(struct mpool_ctx * ctx = nullptr) noexcept
+        : ctx_(ctx)
+    {
+    }
+
+    struct mpool_ctx *
+    ctx() const noexcept
+    {
+        return ctx_;
+    }
+
+private:
+    void *
+    do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        return mpool_detail::allocate(ctx_, bytes, alignment);
+    }
+
+    void
+    do_deallocate(void * ptr, std::size_t bytes, std::size_t alignment)
+            override
+    {
+        mpool_detail::deallocate(ctx_, ptr, bytes, alignment);
+    }
+
+    bool
+    do_is_equal(std::pmr::memory_resource const & other) const noexcept
+            override
+    {
+        auto const * res =
+                dynamic_cast<mpool_memory_resource const *>(&other);
+
+        return res != nullptr && res->ctx_ == ctx_;
+    }
+
+    struct mpool_ctx * ctx_;
+};
+
+
+/* stateless allocator of the standard containers, over the default
+ * instance */
+template <typename T>
+class mpool_allocator {
+public:
+    using value_type = T;
+    using is_always_equal = std::true_type;
+
+    mpool_allocator() noexcept = default;
+
+    template <typename U>
+    mpool_allocator(mpool_allocator<U> const &) noexcept
+    {
+    }
+
+    T *
+    allocate(std::size_t n)
+    {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_array_new_length();
+
+        return static_cast<T *>(mpool_detail::allocate(nullptr,
+                n * sizeof(T), alignof(T)));
+    }
+
+    void
+    deallocate(T * ptr, std::size_t n) noexcept
+    {
+        mpool_detail::deallocate(nullptr, ptr, n * sizeof(T), alignof(T));
+    }
+};
+
+template <typename T, typename U>
+bool
+operator==(mpool_allocator<T> const &, mpool_allocator<U> const &) noexcept
+{
+    return true;
+}
+
+template <typename T, typename U>
+bool
+operator!=(mpool_allocator<T> const &, mpool_allocator<U> const &) noexcept
+{
+    return false;
+}
+
+
+/* destroys and releases an object of make_pooled(). It frees sizeof(T)
+ * bytes: unlike std::default_delete, it does not convert from the deleter of
+ * a derived class */
+template <typename T>
+struct mpool_deleter {
+    void
+    operator()(T * ptr) const noexcept
+    {
+        ptr->~T();
+        mpool_detail::deallocate(nullptr, ptr, sizeof(T), alignof(T));
+    }
+};
+
+template <typename T>
+using mpool_ptr = std::unique_ptr<T, mpool_deleter<T>>;
+
+/* an object built in a chunk of the default instance */
+template <typename T, typename... Args>
+mpool_ptr<T>
+make_pooled(Args &&... args)
+{
+    void * ptr;
+
+    ptr = mpool_detail::allocate(nullptr, sizeof(T), alignof(T));
+    try {
+        return mpool_ptr<T>(new (ptr) T(std::forward<Args>(args)...));
+    } catch (...) {
+        mpool_detail::deallocate(nullptr, ptr, sizeof(T), alignof(T));
+        throw;
+    }
+}
+
+#endif /* MPOOL_HPP */
@@ -0,0 +1,395 @@
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "mpool_large.h"
+
+#define LG2_BIN_SUBDIV 2
+#define BIN_SUBDIV (1 << LG2_BIN_SUBDIV)
+
+
+static ALWAYS_INLINE int
+mpool_large_bin(uint32_t num_pages)
+{
+    int fl;
+
+    assert(num_pages > 0);
+
+    if (num_pages < BIN_SUBDIV)
+        return (int) num_pages;
+
+    fl = 31 - __builtin_clz(num_pages);
+    return (fl << LG2_BIN_SUBDIV)
+           + (int) ((num_pages >> (fl - LG2_BIN_SUBDIV)) & (BIN_SUBDIV - 1));
+}
+
+
+/* first bin which runs are all at least num_pages long */
+static ALWAYS_INLINE int
+mpool_large_bin_fit(uint32_t num_pages)
+{
+    int fl;
+
+    if (num_pages < BIN_SUBDIV)
+        return (int) num_pages;
+
+    fl = 31 - __builtin_clz(num_pages);
+    num_pages += (1U << (fl - LG2_BIN_SUBDIV)) - 1;
+
+    return mpool_large_bin(num_pages);
+}
+
+
+static int
+mpool_large_find_bin(struct mpool_large const * large, int bin)
+{
+    int i;
+    uint64_t mask;
+
+    for (i = bin / 64 ; i < (int) arraylen(large->bin_mask) ; i++) {
+        mask = large->bin_mask[i];
+        if (i == bin / 64)
+            mask &= ~0ULL << (bin % 64);
+
+        if (mask != 0)
+            return i * 64 + __builtin_ctzll(mask);
+    }
+
+    return -1;
+}
+
+
+static void
+mpool_large_mark(struct mpool_large * large, uint32_t page,
+        uint32_t num_pages, uint32_t free)
+{
+    struct mpool_page * first, * last;
+
+    first = &large->pages[page];
+    last = &large->pages[page + num_pages - 1];
+
+    first->num_pages = last->num_pages = num_pages;
+    first->free = last->free = free;
+}
+
+
+static void
+mpool_large_insert(struct mpool_large * large, uint32_t page,
+        uint32_t num_pages)
+{
+    int bin;
+    uint32_t head;
+
+    mpool_large_mark(large, page, num_pages, 1);
+
+    bin = mpool_large_bin(num_pages);
+    head = large->bins[bin];
+    large->pages[page].prev = 0;
+    large->pages[page].next = head;
+    if (head != 0)
+        large->pages[head - 1].prev = page + 1;
+
+    large->bins[bin] = page + 1;
+    large->bin_mask[bin / 64] |= 1ULL << (bin % 64);
+    large->num_free += num_pages;
+}
+
+
+static void
+mpool_large_remove(struct mpool_large * large, uint32_t page)
+{
+    int bin;
+    struct mpool_page * run;
+
+    run = &large->pages[page];
+    bin = mpool_large_bin(run->num_pages);
+
+    if (run->prev != 0)
+        large->pages[run->prev - 1].next = run->next;
+    else
+        large->bins[bin] = run->next;
+
+    if (run->next != 0)
+        large->pages[run->next - 1].prev = run->prev;
+
+    if (large->bins[bin] == 0)
+        large->bin_mask[bin / 64] &= ~(1ULL << (bin % 64));
+
+    large->num_free -= run->num_pages;
+}
+
+
+/* split the leading num_pages of a run off, and free the remainder */
+static void
+mpool_large_split(struct mpool_large * large, uint32_t page,
+        uint32_t run_pages, uint32_t num_pages)
+{
+    mpool_large_mark(large, page, num_pages, 0);
+    if (run_pages > num_pages)
+        mpool_large_insert(large, page + num_pages, run_pages - num_pages);
+}
+
+
+static ALWAYS_INLINE uint32_t
+mpool_large_num_pages(size_t size)
+{
+    if (unlikely(size > ((size_t) UINT32_MAX << LG2_PAGE_SIZE)))
+        return 0;
+
+    return (uint32_t) ((size + PAGE_SIZE - 1) >> LG2_PAGE_SIZE);
+}
+
+
+static ALWAYS_INLINE uint32_t
+mpool_large_page(struct mpool_large const * large, void const * ptr)
+{
+    assert((uint8_t const *) ptr >= large->arena);
+    assert(((uintptr_t) ptr & (PAGE_SIZE - 1)) == 0);
+
+    return (uint32_t) (((uint8_t const *) ptr - large->arena)
+                       >> LG2_PAGE_SIZE);
+}
+
+
+int
+mpool_large_init(struct mpool_large * large, void * arena, size_t size)
+{
+    uintptr_t start, end;
+    size_t num_pages, map_size;
+
+    start = ((uintptr_t) arena + PAGE_SIZE - 1) & ~((uintptr_t) PAGE_SIZE - 1);
+    end = ((uintptr_t) arena + size) & ~((uintptr_t) PAGE_SIZE - 1);
+    if (end <= start)
+        return EINVAL;
+
+    /* the page map is carved from the front of the tier */
+    num_pages = (end - start) >> LG2_PAGE_SIZE;
+    map_size = num_pages * sizeof(struct mpool_page);
+    map_size = (map_size + PAGE_SIZE - 1) & ~((size_t) PAGE_SIZE - 1);
+    if (map_size >= end - start || num_pages > UINT32_MAX)
+        return EINVAL;
+
+    num_pages = (end - start - map_size) >> LG2_PAGE_SIZE;
+    mpool_large_setup(large, (struct mpool_page *) start,
+            (uint8_t *) (start + map_size), num_pages);
+    mpool_large_add(large, large->arena, num_pages << LG2_PAGE_SIZE);
+
+    return 0;
+}
+
+
+/* set up an empty tier spanning num_pages from arena, which pages are to be
+ * handed over with mpool_large_add(). The page map entries of the pages never
+ * added must read as zero */
+void
+mpool_large_setup(struct mpool_large * large, struct mpool_page * pages,
+        void * arena, size_t num_pages)
+{
+    assert(num_pages <= UINT32_MAX);
+
+    memset(large->bin_mask, 0, sizeof(large->bin_mask));
+    memset(large->bins, 0, sizeof(large->bins));
+    large->num_free = 0;
+    large->num_added = 0;
+    pthread_mutex_init(&large->lock, NULL);
+
+    large->pages = pages;
+    large->arena = arena;
+    large->num_pages = num_pages;
+}
+
+
+/* hand pages over to the tier, they are merged with the free runs around */
+void
+mpool_large_add(struct mpool_large * large, void * ptr, size_t size)
+{
+    mpool_large_mark(large, mpool_large_page(large, ptr),
+            (uint32_t) (size >> LG2_PAGE_SIZE), 0);
+    __atomic_fetch_add(&large->num_added, size >> LG2_PAGE_SIZE,
+            __ATOMIC_RELAXED);
+    mpool_large_free(large, ptr);
+}
+
+
+/* runs start at the first page of the run taken aligned on alignment, the
+ * pages before it are given back */
+void *
+mpool_large_alloc_aligned(struct mpool_large * large, size_t size,
+        size_t alignment)
+{
+    int bin;
+    uint32_t num_pages, extra, page, ref, run_pages, lead;
+
+    assert((alignment & (alignment - 1)) == 0);
+
+    num_pages = mpool_large_num_pages(size);
+    extra = alignment > PAGE_SIZE ? mpool_large_num_pages(alignment) - 1 : 0;
+    if (unlikely(  num_pages == 0
+                || num_pages > large->num_pages
+                || extra > large->num_pages - num_pages))
+        return NULL;
+
+    pthread_mutex_lock(&large->lock);
+
+    bin = mpool_large_find_bin(large, mpool_large_bin_fit(num_pages + extra));
+    if (bin >= 0) {
+        page = large->bins[bin] - 1;
+    } else {
+        /* last resort: some runs of the bin num_pages falls in may fit */
+        bin = mpool_large_bin(num_pages + extra);
+        ref = large->bins[bin];
+        while (  ref != 0
+              && large->pages[ref - 1].num_pages < num_pages + extra)
+            ref = large->pages[ref - 1].next;
+
+        if (ref == 0) {
+            pthread_mutex_unlock(&large->lock);
+            return NULL;
+        }
+
+        page = ref - 1;
+    }
+
+    run_pages = large->pages[page].num_pages;
+    mpool_large_remove(large, page);
+
+    /* free runs are coalesced: the run before is in use */
+    lead = (uint32_t) ((-(uintptr_t) (large->arena
+                                      + ((size_t) page << LG2_PAGE_SIZE))
+                        & (alignment - 1)) >> LG2_PAGE_SIZE);
+    if (lead > 0)
+        mpool_large_insert(large, page, lead);
+
+    mpool_large_split(large, page + lead, run_pages - lead, num_pages);
+
+    pthread_mutex_unlock(&large->lock);
+
+    return large->arena + ((size_t) (page + lead) << LG2_PAGE_SIZE);
+}
+
+
+void *
+mpool_large_alloc(struct mpool_large * large, size_t size)
+{
+    return mpool_large_alloc_aligned(large, size, PAGE_SIZE);
+}
+
+
+void
+mpool_large_free(struct mpool_large * large, void const * ptr)
+{
+    uint32_t page, num_pages;
+    struct mpool_page * prev, * next;
+
+    page = mpool_large_page(large, ptr);
+
+    pthread_mutex_lock(&large->lock);
+
+    num_pages = large->pages[page].num_pages;
+    assert(!large->pages[page].free);
+
+    if (page > 0) {
+        prev = &large->pages[page - 1];
+        if (prev->free) {
+            page -= prev->num_pages;
+            num_pages += prev->num_pages;
+            mpool_large_remove(large, page);
+        }
+    }
+
+    if (page + num_pages < large->num_pages) {
+        next = &large->pages[page + num_pages];
+        if (next->free) {
+            mpool_large_remove(large, page + num_pages);
+            num_pages += next->num_pages;
+        }
+    }
+
+    mpool_large_insert(large, page, num_pages);
+
+    pthread_mutex_unlock(&large->lock);
+}
+
+
+/* resize a run in place, shrinking it or growing it over the free run that
+ * follows it. Returns 0 on success */
+int
+mpool_large_resize(struct mpool_large * large, void const * ptr, size_t size)
+{
+    int rv;
+    uint32_t page, num_pages, new_pages, next_page, next_pages;
+
+    page = mpool_large_page(large, ptr);
+    new_pages = mpool_large_num_pages(size);
+    if (unlikely(new_pages == 0))
+        return EINVAL;
+
+    rv = 0;
+    pthread_mutex_lock(&large->lock);
+
+    num_pages = large->pages[page].num_pages;
+    next_page = page + num_pages;
+
+    if (new_pages < num_pages) {
+        mpool_large_mark(large, page, new_pages, 0);
+
+        /* the released tail is coalesced with the next run if free */
+        next_pages = num_pages - new_pages;
+        if (  next_page < large->num_pages
+           && large->pages[next_page].free) {
+            next_pages += large->pages[next_page].num_pages;
+            mpool_large_remove(large, next_page);
+        }
+
+        mpool_large_insert(large, page + new_pages, next_pages);
+    } else if (new_pages > num_pages) {
+        if (  next_page < large->num_pages
+           && large->pages[next_page].free
+           && num_pages + large->pages[next_page].num_pages >= new_pages) {
+            next_pages = large->pages[next_page].num_pages;
+            mpool_large_remove(large, next_page);
+            mpool_large_split(large, page, num_pages + next_pages, new_pages);
+        } else {
+            rv = ENOMEM;
+        }
+    }
+
+    pthread_mutex_unlock(&large->lock);
+
+    return rv;
+}
+
+
+size_t
+mpool_large_size(struct mpool_large const * large, void const * ptr)
+{
+    return (size_t) large->pages[mpool_large_page(large, ptr)].num_pages
+           << LG2_PAGE_SIZE;
+}
+
+
+/* fork() handlers: no run is being split or merged while the address space is
+ * copied. The child gets the lock anew */
+void
+mpool_large_fork_prepare(struct mpool_large * large)
+{
+    pthread_mutex_lock(&large->lock);
+}
+
+
+void
+mpool_large_fork_parent(struct mpool_large * large)
+{
+    pthread_mutex_unlock(&large->lock);
+}
+
+
+void
+mpool_large_fork_child(struct mpool_large * large)
+{
+    pthread_mutex_init(&large->lock, NULL);
+}
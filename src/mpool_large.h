@@ -0,0 +1,59 @@
+#ifndef MPOOL_LARGE_H
+#define MPOOL_LARGE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "common.h"
+
+/*
+ * Large object tier: allocations bigger than a page are served as runs of
+ * contiguous pages. Free runs are kept in size segregated bins (two-level,
+ * four bins per power of two) so that a fitting run is found in O(1), and
+ * are coalesced with their free neighbours on release.
+ */
+
+#define LARGE_NUM_BINS 128
+
+/* page map entry, valid on the first and last page of a run */
+struct mpool_page {
+    uint32_t num_pages;
+    uint32_t free;
+    uint32_t prev; /* free run list links, page index + 1, 0 is none */
+    uint32_t next;
+};
+
+struct mpool_large {
+    pthread_mutex_t lock;
+
+    uint64_t bin_mask[LARGE_NUM_BINS / 64];
+    uint32_t bins[LARGE_NUM_BINS];
+    size_t num_free;
+
+    struct mpool_page * pages CACHE_ALIGNED;
+    size_t num_pages;
+    size_t num_added; /* pages handed over to the tier */
+    uint8_t * arena;
+};
+
+int mpool_large_init(struct mpool_large * large, void * arena, size_t size);
+void mpool_large_setup(struct mpool_large * large, struct mpool_page * pages,
+        void * arena, size_t num_pages);
+void mpool_large_add(struct mpool_large * large, void * ptr, size_t size);
+
+void * mpool_large_alloc(struct mpool_large * large, size_t size);
+/* alignment is a power of two, runs are at least page aligned */
+void * mpool_large_alloc_aligned(struct mpool_large * large, size_t size,
+        size_t alignment);
+void mpool_large_free(struct mpool_large * large, void const * ptr);
+int mpool_large_resize(struct mpool_large * large, void const * ptr,
+        size_t size);
+
+size_t mpool_large_size(struct mpool_large const * large, void const * ptr);
+
+void mpool_large_fork_prepare(struct mpool_large * large);
+void mpool_large_fork_parent(struct mpool_large * large);
+void mpool_large_fork_child(struct mpool_large * large);
+
+#endif /* MPOOL_LARGE_H */
@@ -0,0 +1,153 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "common.h"
+#include "mpool.h"
+
+#define THP_ENABLED "/sys/kernel/mm/transparent_hugepage/enabled"
+
+
+static size_t
+mpool_map_size(size_t size)
+{
+    return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+
+/* transparent huge pages are only given to madvise()d ranges when the system
+ * mode is "always" or "madvise" */
+static int
+mpool_map_has_thp(void)
+{
+    FILE * f;
+    char mode[64];
+    int rv;
+
+    f = fopen(THP_ENABLED, "r");
+    if (f == NULL)
+        return 0;
+
+    rv = fgets(mode, sizeof(mode), f) != NULL
+         && strstr(mode, "[never]") == NULL;
+    fclose(f);
+
+    return rv;
+}
+
+
+/* huge page aligned, so that huge pages back the whole range */
+static void *
+mpool_map_aligned(size_t size)
+{
+    uint8_t * map;
+    uintptr_t start;
+
+    map = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    start = ((uintptr_t) map + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    if (start > (uintptr_t) map)
+        munmap(map, start - (uintptr_t) map);
+
+    munmap((uint8_t *) start + size,
+            (uintptr_t) map + HUGE_PAGE_SIZE - start);
+
+    return (void *) start;
+}
+
+
+/* fault the pages in after madvise(), MAP_POPULATE would fault them in as
+ * small pages first */
+static void
+mpool_map_populate(uint8_t * arena, size_t size)
+{
+    size_t offset;
+
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(arena, size, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+
+    for (offset = 0 ; offset < size ; offset += PAGE_SIZE)
+        ((uint8_t volatile *) arena)[offset] = 0;
+}
+
+
+/* transparent huge pages, else small pages */
+static void *
+mpool_map_thp(size_t size, int * flags)
+{
+    void * arena;
+    int got;
+
+    arena = mpool_map_aligned(size);
+    if (arena == NULL)
+        return NULL;
+
+    got = 0;
+    if (  *flags & (MPOOL_MAP_THP | MPOOL_MAP_HUGETLB)
+       && mpool_map_has_thp()
+       && madvise(arena, size, MADV_HUGEPAGE) == 0)
+        got |= MPOOL_MAP_THP;
+
+    if (*flags & MPOOL_MAP_POPULATE) {
+        mpool_map_populate(arena, size);
+        got |= MPOOL_MAP_POPULATE;
+    }
+
+    *flags = got | (*flags & MPOOL_MAP_LOCK);
+
+    return arena;
+}
+
+
+void *
+mpool_arena_map(size_t size, int * flags)
+{
+    void * arena;
+    int got;
+
+    assert(flags != NULL);
+
+    size = mpool_map_size(size);
+    if (size == 0)
+        return NULL;
+
+    /* explicit huge pages come populated, if the pool has enough of them */
+    arena = MAP_FAILED;
+    if (*flags & MPOOL_MAP_HUGETLB)
+        arena = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB
+                | (*flags & MPOOL_MAP_POPULATE ? MAP_POPULATE : 0), -1, 0);
+
+    got = *flags;
+    if (arena != MAP_FAILED)
+        got &= MPOOL_MAP_HUGETLB | MPOOL_MAP_POPULATE | MPOOL_MAP_LOCK;
+    else
+        arena = mpool_map_thp(size, &got);
+
+    if (arena == NULL)
+        return NULL;
+
+    /* mlock() fails past RLIMIT_MEMLOCK, the arena is then left unlocked */
+    if (got & MPOOL_MAP_LOCK && mlock(arena, size) != 0)
+        got &= ~MPOOL_MAP_LOCK;
+
+    *flags = got;
+
+    return arena;
+}
+
+
+void
+mpool_arena_unmap(void * arena, size_t size)
+{
+    if (arena != NULL)
+        munmap(arena, mpool_map_size(size));
+}
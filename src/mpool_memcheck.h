@@ -8,11 +8,12 @@
  * Let's just not care about it */
 #include <valgrind/memcheck.h>
 
-#define MPOOL_GET(index) (&pool_glob.pools[(index)].arena)
+#define MPOOL_GET(pool) (&(pool)->arena)
 #define MPOOL_CREATE_MEMPOOL VALGRIND_CREATE_MEMPOOL
 #define MPOOL_DESTROY_MEMPOOL VALGRIND_DESTROY_MEMPOOL
 #define MPOOL_MEMPOOL_ALLOC VALGRIND_MEMPOOL_ALLOC
 #define MPOOL_MEMPOOL_FREE VALGRIND_MEMPOOL_FREE
+#define MPOOL_MEMPOOL_CHANGE VALGRIND_MEMPOOL_CHANGE
 
 #define MPOOL_MAKE_MEM_NOACCESS VALGRIND_MAKE_MEM_NOACCESS
 #define MPOOL_MAKE_MEM_UNDEFINED VALGRIND_MAKE_MEM_UNDEFINED
@@ -24,6 +25,7 @@
 #define MPOOL_DESTROY_MEMPOOL(...)
 #define MPOOL_MEMPOOL_ALLOC(...)
 #define MPOOL_MEMPOOL_FREE(...)
+#define MPOOL_MEMPOOL_CHANGE(...)
 
 #define MPOOL_MAKE_MEM_NOACCESS(...)
 #define MPOOL_MAKE_MEM_UNDEFINED(...)
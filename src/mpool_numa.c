@@ -0,0 +1,126 @@
+#define _GNU_SOURCE /* syscall() */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+
+#include "common.h"
+#include "mpool_numa.h"
+
+#define NODE_POSSIBLE "/sys/devices/system/node/possible"
+
+/* ids of the possible nodes, which need not be contiguous */
+static struct {
+    pthread_once_t once;
+    int ids[MPOOL_MAX_NODES];
+    int num;
+} numa_nodes = { .once = PTHREAD_ONCE_INIT };
+
+
+/* add the nodes of a "0-3" or "0,2" like list in order, node 0 alone when
+ * the list cannot be read */
+static void
+mpool_numa_read_nodes(void)
+{
+    FILE * f;
+    int first, last;
+    char sep;
+
+    f = fopen(NODE_POSSIBLE, "r");
+    if (f != NULL) {
+        while (fscanf(f, "%d", &first) == 1) {
+            last = first;
+            if (fscanf(f, "%c", &sep) == 1 && sep == '-') {
+                if (fscanf(f, "%d", &last) != 1)
+                    break;
+
+                if (fscanf(f, "%c", &sep) != 1)
+                    sep = '\n';
+            }
+
+            for ( ; first <= last && numa_nodes.num < MPOOL_MAX_NODES ; first++)
+                numa_nodes.ids[numa_nodes.num++] = first;
+
+            if (sep != ',')
+                break;
+        }
+
+        fclose(f);
+    }
+
+    if (numa_nodes.num == 0)
+        numa_nodes.num = 1;
+}
+
+
+static int
+mpool_numa_real_nodes(void)
+{
+    pthread_once(&numa_nodes.once, mpool_numa_read_nodes);
+
+    return numa_nodes.num;
+}
+
+
+int
+mpool_numa_num_nodes(int * fake)
+{
+    char const * env;
+    int num_nodes;
+
+    env = getenv("MPOOL_NUMA_NODES");
+    if (env != NULL) {
+        num_nodes = atoi(env);
+        if (num_nodes > 0) {
+            *fake = 1;
+            return MIN(num_nodes, MPOOL_MAX_NODES);
+        }
+    }
+
+    *fake = 0;
+    return mpool_numa_real_nodes();
+}
+
+
+int
+mpool_numa_bind(void * ptr, size_t size, int node)
+{
+    unsigned long mask;
+    int id;
+
+    /* nodes past the mask follow the default policy */
+    id = numa_nodes.ids[node % mpool_numa_real_nodes()];
+    if (id >= (int) sizeof(mask) * 8)
+        return EINVAL;
+
+    /* the kernel reads one bit less than maxnode. No flag: the pages are
+     * fresh, there is nothing to move */
+    mask = 1UL << id;
+    if (syscall(SYS_mbind, ptr, size, MPOL_BIND, &mask,
+            sizeof(mask) * 8 + 1, 0) != 0)
+        return errno;
+
+    return 0;
+}
+
+
+int
+mpool_numa_cpu_node(void)
+{
+    unsigned int cpu, node;
+    int i;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+        return 0;
+
+    for (i = mpool_numa_real_nodes() ; i-- > 0 ; ) {
+        if (numa_nodes.ids[i] == (int) node)
+            return i;
+    }
+
+    return 0;
+}
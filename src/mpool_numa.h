@@ -0,0 +1,26 @@
+#ifndef MPOOL_NUMA_H
+#define MPOOL_NUMA_H
+
+#include <stdlib.h>
+
+/*
+ * NUMA topology helpers, on top of the raw system calls so that no libnuma is
+ * needed. Setting MPOOL_NUMA_NODES in the environment fakes that many nodes,
+ * folded onto the real ones, so that the NUMA mode can be exercised on a
+ * single node machine.
+ */
+
+#define MPOOL_MAX_NODES 8
+
+/* number of nodes, at least 1. The real ones are the possible nodes in order
+ * of their ids, numbered from 0 whatever the ids. fake is set when they come
+ * from the environment */
+int mpool_numa_num_nodes(int * fake);
+
+/* bind the pages of [ptr, ptr + size) to a node, folded onto the real ones */
+int mpool_numa_bind(void * ptr, size_t size, int node);
+
+/* number of the node of the cpu the caller runs on, as counted above */
+int mpool_numa_cpu_node(void);
+
+#endif /* MPOOL_NUMA_H */
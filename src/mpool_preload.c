@@ -0,0 +1,294 @@
+/*
+ * malloc family replacement, to be loaded with LD_PRELOAD.
+ *
+ * Allocations are served by a growable default instance, reserving
+ * MPOOL_PRELOAD_RESERVE_MB of address space (16 GiB by default). Those it
+ * cannot serve, the ones made before it is set up, and the chunks which do
+ * not belong to it, go to the C library. MPOOL_PRELOAD_STATS set in the
+ * environment prints the instance statistics at exit.
+ *
+ * The instance is never destroyed: the chunks freed by the destructors which
+ * run after this library's may still belong to it.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "mpool.h"
+
+#define PRELOAD_RESERVE_SIZE (16UL << 30)
+
+extern void * __libc_malloc(size_t size);
+extern void   __libc_free(void * ptr);
+extern void * __libc_calloc(size_t nmemb, size_t size);
+extern void * __libc_realloc(void * ptr, size_t size);
+extern void * __libc_memalign(size_t alignment, size_t size);
+
+struct alloc_stats {
+    long num_mpool_alloc;
+    long num_mpool_free;
+    long num_mpool_realloc;
+    long num_sys_alloc;
+    long num_sys_free;
+    long num_sys_realloc;
+};
+static struct alloc_stats stats;
+static bool stats_enabled;
+
+static struct mpool_ctx * ctx;
+static bool alloc_overload_done;
+static size_t (* libc_malloc_usable_size)(void * ptr);
+
+#define STATS_INC(field) \
+    do { \
+        if (unlikely(stats_enabled)) \
+            __atomic_fetch_add(&stats.field, 1, __ATOMIC_RELAXED); \
+    } while (0)
+
+static void __attribute__((constructor))
+alloc_overload_init(void)
+{
+    char const * env;
+    size_t reserve_size;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 1};
+
+    /* before any allocation is served by the instance */
+    *(void **) &libc_malloc_usable_size = dlsym(RTLD_NEXT,
+            "malloc_usable_size");
+
+    reserve_size = PRELOAD_RESERVE_SIZE;
+    env = getenv("MPOOL_PRELOAD_RESERVE_MB");
+    if (env != NULL && atol(env) > 0)
+        reserve_size = (size_t) atol(env) << 20;
+
+    stats_enabled = getenv("MPOOL_PRELOAD_STATS") != NULL;
+
+    ctx = mpool_ctx_create(NULL, reserve_size, weights, arraylen(weights),
+            MPOOL_GROW);
+    if (ctx == NULL) {
+        fprintf(stderr, "mpool_preload: mpool_ctx_create() failed, "
+                "using the C library allocator\n");
+        return;
+    }
+
+    mpool_set_default(ctx);
+    __atomic_store_n(&alloc_overload_done, 1, __ATOMIC_RELEASE);
+}
+
+static void __attribute__((destructor))
+alloc_overload_cleanup(void)
+{
+    if (!stats_enabled || ctx == NULL)
+        return;
+
+    mpool_stats();
+    fprintf(stderr, "\n");
+    fprintf(stderr, "mpool_alloc:   %ld\n", stats.num_mpool_alloc);
+    fprintf(stderr, "mpool_free:    %ld\n", stats.num_mpool_free);
+    fprintf(stderr, "mpool_realloc: %ld\n", stats.num_mpool_realloc);
+    fprintf(stderr, "sys alloc:     %ld\n", stats.num_sys_alloc);
+    fprintf(stderr, "sys free:      %ld\n", stats.num_sys_free);
+    fprintf(stderr, "sys realloc:   %ld\n", stats.num_sys_realloc);
+}
+
+static ALWAYS_INLINE bool
+alloc_overload_ready(void)
+{
+    return likely(__atomic_load_n(&alloc_overload_done, __ATOMIC_ACQUIRE));
+}
+
+/* size of a chunk of the instance, 0 for the ones of the C library */
+static ALWAYS_INLINE size_t
+_mpool_size(void const * ptr)
+{
+    if (unlikely(!alloc_overload_ready()))
+        return 0;
+
+    return mpool_usable_size(ptr);
+}
+
+static ALWAYS_INLINE
+void * _malloc_inline(size_t size)
+{
+    void * result;
+
+    if (unlikely(!alloc_overload_ready()))
+        return __libc_malloc(size);
+
+    result = mpool_alloc(size, 0);
+    if (unlikely(result == NULL)) {
+        STATS_INC(num_sys_alloc);
+        return __libc_malloc(size);
+    }
+
+    STATS_INC(num_mpool_alloc);
+    return result;
+}
+
+static ALWAYS_INLINE
+void * _memalign_inline(size_t alignment, size_t size)
+{
+    void * result;
+
+    if (unlikely(!alloc_overload_ready()))
+        return __libc_memalign(alignment, size);
+
+    result = mpool_aligned_alloc(alignment, size);
+    if (unlikely(result == NULL)) {
+        STATS_INC(num_sys_alloc);
+        return __libc_memalign(alignment, size);
+    }
+
+    STATS_INC(num_mpool_alloc);
+    return result;
+}
+
+extern void * malloc(size_t size)
+{
+    return _malloc_inline(size);
+}
+
+extern void free(void * ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    if (unlikely(_mpool_size(ptr) == 0)) {
+        STATS_INC(num_sys_free);
+        __libc_free(ptr);
+        return;
+    }
+
+    STATS_INC(num_mpool_free);
+    mpool_free_ptr(ptr);
+}
+
+extern void * calloc(size_t nmemb, size_t size)
+{
+    void * ptr;
+    size_t total;
+
+    if (unlikely(__builtin_mul_overflow(nmemb, size, &total))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (unlikely(!alloc_overload_ready()))
+        return __libc_calloc(nmemb, size);
+
+    ptr = _malloc_inline(total);
+    if (ptr != NULL)
+        memset(ptr, 0, total);
+
+    return ptr;
+}
+
+extern void * realloc(void * ptr, size_t size)
+{
+    void * new_ptr;
+    size_t old_size;
+
+    if (ptr == NULL)
+        return _malloc_inline(size);
+
+    old_size = _mpool_size(ptr);
+    if (unlikely(old_size == 0)) {
+        STATS_INC(num_sys_realloc);
+        return __libc_realloc(ptr, size);
+    }
+
+    /* as the C library does */
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    new_ptr = mpool_realloc(ptr, old_size, size, 0);
+    if (likely(new_ptr != NULL)) {
+        STATS_INC(num_mpool_realloc);
+        return new_ptr;
+    }
+
+    /* the instance is out of room, the chunk moves to the C library. It is
+     * left alone if that fails too */
+    new_ptr = __libc_malloc(size);
+    if (unlikely(new_ptr == NULL))
+        return NULL;
+
+    memcpy(new_ptr, ptr, MIN(old_size, size));
+    mpool_free_ptr(ptr);
+    STATS_INC(num_sys_realloc);
+
+    return new_ptr;
+}
+
+extern void * reallocarray(void * ptr, size_t nmemb, size_t size)
+{
+    size_t total;
+
+    if (unlikely(__builtin_mul_overflow(nmemb, size, &total))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return realloc(ptr, total);
+}
+
+extern size_t malloc_usable_size(void * ptr)
+{
+    size_t size;
+
+    if (ptr == NULL)
+        return 0;
+
+    size = _mpool_size(ptr);
+    if (size == 0 && libc_malloc_usable_size != NULL)
+        size = libc_malloc_usable_size(ptr);
+
+    return size;
+}
+
+extern int posix_memalign(void ** memptr, size_t alignment, size_t size)
+{
+    void * ptr;
+
+    if (  alignment % sizeof(void *) != 0
+       || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+
+    ptr = _memalign_inline(alignment, size);
+    if (ptr == NULL)
+        return ENOMEM;
+
+    *memptr = ptr;
+    return 0;
+}
+
+extern void * memalign(size_t alignment, size_t size)
+{
+    return _memalign_inline(alignment, size);
+}
+
+extern void * aligned_alloc(size_t alignment, size_t size)
+{
+    return _memalign_inline(alignment, size);
+}
+
+extern void * valloc(size_t size)
+{
+    return _memalign_inline(PAGE_SIZE, size);
+}
+
+extern void * pvalloc(size_t size)
+{
+    size = (size + PAGE_SIZE - 1) & ~((size_t) PAGE_SIZE - 1);
+    return _memalign_inline(PAGE_SIZE, MAX(size, PAGE_SIZE));
+}
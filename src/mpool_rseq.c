@@ -0,0 +1,42 @@
+#define _GNU_SOURCE /* syscall() */
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+
+#include "common.h"
+#include "mpool_rseq.h"
+
+/* the signature of the C library, so that both may share an area */
+#define MPOOL_RSEQ_SIG 0x53053053
+
+/* set by glibc >= 2.35, which registers an area for every thread */
+extern ptrdiff_t const __rseq_offset __attribute__((weak));
+extern unsigned int const __rseq_size __attribute__((weak));
+
+#if MPOOL_HAS_RSEQ && defined(SYS_rseq)
+static __thread struct mpool_rseq pool_rseq_area;
+#endif
+
+
+struct mpool_rseq *
+mpool_rseq_register(void)
+{
+#if MPOOL_HAS_RSEQ && defined(SYS_rseq)
+    uint8_t * tp;
+
+    if (&__rseq_size != NULL && __rseq_size != 0) {
+        __asm__ ("movq %%fs:0, %0" : "=r" (tp));
+        return (struct mpool_rseq *) (tp + __rseq_offset);
+    }
+
+    /* the area must stay valid as long as the thread runs: the library is
+     * not to be unloaded while threads registered by it are alive */
+    if (syscall(SYS_rseq, &pool_rseq_area, sizeof(pool_rseq_area), 0,
+            MPOOL_RSEQ_SIG) == 0)
+        return &pool_rseq_area;
+#endif
+
+    return NULL;
+}
@@ -0,0 +1,164 @@
+#ifndef MPOOL_RSEQ_H
+#define MPOOL_RSEQ_H
+
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Per-CPU stacks of chunk pointers updated with restartable sequences. A push
+ * or a pop reads the CPU the thread runs on, and commits with a single store
+ * of the stack size. The kernel restarts the sequence from the beginning when
+ * the thread is preempted, migrated or signaled before that store, so that
+ * no lock nor atomic instruction is needed.
+ *
+ * The stacks of a CPU, one per size class, live in a row of PERCPU_ROW_SIZE
+ * bytes, with the counters of stats builds. The rows of the CPUs follow each
+ * other.
+ */
+
+#ifdef MPOOL_NO_STATS
+#define LG2_PERCPU_ROW_SIZE 9
+#else
+#define LG2_PERCPU_ROW_SIZE 10
+#endif
+#define PERCPU_ROW_SIZE (1 << LG2_PERCPU_ROW_SIZE)
+
+struct mpool_percpu_stack {
+    uintptr_t num;
+    void ** slots;
+};
+
+/* the kernel ABI struct rseq, as first registered */
+struct mpool_rseq {
+    uint32_t cpu_id_start;
+    uint32_t cpu_id;
+    uint64_t rseq_cs;
+    uint32_t flags;
+} __attribute__((aligned(32)));
+
+/* rseq area of the calling thread, the one registered by the C library or
+ * else one of ours. NULL when restartable sequences are not available */
+struct mpool_rseq * mpool_rseq_register(void);
+
+/* the thread sanitizer does not see the ordering the sequences provide */
+#if defined(__x86_64__) && !defined(__SANITIZE_THREAD__)
+
+#define MPOOL_HAS_RSEQ 1
+
+#define MPOOL_STR_(x) #x
+#define MPOOL_STR(x) MPOOL_STR_(x)
+
+/* critical section descriptor from 1 to 2, aborting to 4 which restarts the
+ * whole sequence at 6: the kernel clears rseq_cs on abort. The abort handler
+ * is preceded by the signature the area was registered with */
+#define MPOOL_RSEQ_CS_BEGIN \
+    ".pushsection __rseq_cs, \"aw\"\n\t" \
+    ".balign 32\n\t" \
+    "3:\n\t" \
+    ".long 0x0, 0x0\n\t" \
+    ".quad 1f, (2f - 1f), 4f\n\t" \
+    ".popsection\n\t" \
+    "6:\n\t" \
+    "leaq 3b(%%rip), %%rax\n\t" \
+    "movq %%rax, %[rseq_cs]\n\t" \
+    "1:\n\t"
+
+#define MPOOL_RSEQ_CS_END \
+    "2:\n\t" \
+    ".pushsection __rseq_failure, \"ax\"\n\t" \
+    ".byte 0x0f, 0xb9, 0x3d\n\t" \
+    ".long 0x53053053\n\t" \
+    "4:\n\t" \
+    "jmp 6b\n\t" \
+    ".popsection\n\t"
+
+/* stack of the current CPU, from the one of the first CPU */
+#define MPOOL_RSEQ_CPU_STACK \
+    "movl %[cpu_id], %%eax\n\t" \
+    "shlq $" MPOOL_STR(LG2_PERCPU_ROW_SIZE) ", %%rax\n\t" \
+    "addq %[stacks], %%rax\n\t"
+
+/* top of the stack of the current CPU, NULL when it is empty */
+static ALWAYS_INLINE void *
+mpool_rseq_pop(struct mpool_rseq * rs, struct mpool_percpu_stack * stacks)
+{
+    void * ptr;
+
+    __asm__ __volatile__ (
+        MPOOL_RSEQ_CS_BEGIN
+        "xorl %k[ptr], %k[ptr]\n\t"
+        MPOOL_RSEQ_CPU_STACK
+        "movq (%%rax), %%rcx\n\t"
+        "testq %%rcx, %%rcx\n\t"
+        "jz 2f\n\t"
+        "movq 8(%%rax), %%rdx\n\t"
+        "movq -8(%%rdx, %%rcx, 8), %[ptr]\n\t"
+        "decq %%rcx\n\t"
+        "movq %%rcx, (%%rax)\n\t"
+        MPOOL_RSEQ_CS_END
+        : [ptr] "=&r" (ptr), [rseq_cs] "=m" (rs->rseq_cs)
+        : [cpu_id] "m" (rs->cpu_id), [stacks] "r" (stacks)
+        : "rax", "rcx", "rdx", "memory", "cc");
+
+    return ptr;
+}
+
+
+/* push on the stack of the current CPU, 0 when it holds cap chunks already */
+static ALWAYS_INLINE int
+mpool_rseq_push(struct mpool_rseq * rs, struct mpool_percpu_stack * stacks,
+        uintptr_t cap, void * ptr)
+{
+    int done;
+
+    __asm__ __volatile__ (
+        MPOOL_RSEQ_CS_BEGIN
+        "xorl %[done], %[done]\n\t"
+        MPOOL_RSEQ_CPU_STACK
+        "movq (%%rax), %%rcx\n\t"
+        "cmpq %[cap], %%rcx\n\t"
+        "jae 2f\n\t"
+        "movq 8(%%rax), %%rdx\n\t"
+        "movq %[ptr], (%%rdx, %%rcx, 8)\n\t"
+        "incq %%rcx\n\t"
+        "movl $1, %[done]\n\t"
+        "movq %%rcx, (%%rax)\n\t"
+        MPOOL_RSEQ_CS_END
+        : [done] "=&r" (done), [rseq_cs] "=m" (rs->rseq_cs)
+        : [cpu_id] "m" (rs->cpu_id), [stacks] "r" (stacks),
+          [cap] "r" (cap), [ptr] "r" (ptr)
+        : "rax", "rcx", "rdx", "memory", "cc");
+
+    return done;
+}
+
+#else /* __x86_64__ */
+
+/* no critical sections for this architecture, or the sanitizer: the stacks
+ * are locked */
+#define MPOOL_HAS_RSEQ 0
+
+static ALWAYS_INLINE void *
+mpool_rseq_pop(struct mpool_rseq * rs, struct mpool_percpu_stack * stacks)
+{
+    (void) rs;
+    (void) stacks;
+    __builtin_unreachable();
+}
+
+
+static ALWAYS_INLINE int
+mpool_rseq_push(struct mpool_rseq * rs, struct mpool_percpu_stack * stacks,
+        uintptr_t cap, void * ptr)
+{
+    (void) rs;
+    (void) stacks;
+    (void) cap;
+    (void) ptr;
+    __builtin_unreachable();
+}
+
+#endif /* __x86_64__ */
+
+#endif /* MPOOL_RSEQ_H */
@@ -0,0 +1,223 @@
+/*
+ * Arena page size benchmark.
+ *
+ * An arena is mapped in each mpool_arena_map() mode, and a pool of 64 byte
+ * chunks created on it. Every chunk is then allocated, which faults the arena
+ * in as its chunks are carved, and the chunks are walked in a random order.
+ * The benchmark reports the mapping, creation and first touch times, and the
+ * time and dTLB misses per step of the walk, when perf events are
+ * available.
+ */
+#define _GNU_SOURCE /* syscall() */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define CHUNK_SIZE 64
+
+struct mode {
+    char const * name;
+    int flags;
+};
+
+struct chunk {
+    struct chunk * next;
+};
+
+static struct mode const modes[] = {
+    {"small pages", 0},
+    {"small pages, populated", MPOOL_MAP_POPULATE},
+    {"thp", MPOOL_MAP_THP},
+    {"thp, populated", MPOOL_MAP_THP | MPOOL_MAP_POPULATE},
+    {"hugetlb, populated", MPOOL_MAP_HUGETLB | MPOOL_MAP_POPULATE},
+    {"thp, populated, locked",
+     MPOOL_MAP_THP | MPOOL_MAP_POPULATE | MPOOL_MAP_LOCK},
+};
+
+static size_t arena_size = 1UL << 28;
+static long num_steps = 1 << 24;
+static struct chunk ** chunks;
+static uint64_t seed = 88172645463325252ULL;
+
+static double
+elapsed(struct timespec const * t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double) (t1.tv_sec - t0->tv_sec)
+           + (double) (t1.tv_nsec - t0->tv_nsec) * 1e-9;
+}
+
+/* xorshift64 */
+static uint64_t
+bench_rand(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+/* dTLB load misses of the calling thread, -1 without perf events */
+static int
+dtlb_open(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB
+                  | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static size_t
+walk(struct chunk * head)
+{
+    long i;
+    size_t sum;
+
+    sum = 0;
+    for (i = 0 ; i < num_steps ; i++) {
+        sum += (uintptr_t) head;
+        head = head->next;
+    }
+
+    return sum;
+}
+
+static void
+run(struct mode const * mode, int fd)
+{
+    int flags;
+    size_t i, j, num;
+    void * arena;
+    struct chunk * tmp;
+    struct mpool_ctx * ctx;
+    struct timespec t0;
+    double map_time, create_time, touch_time, walk_time;
+    long long misses;
+    unsigned int weights[] = {1};
+
+    flags = mode->flags;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    arena = mpool_arena_map(arena_size, &flags);
+    map_time = elapsed(&t0);
+    check(arena != NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ctx = mpool_ctx_create(arena, arena_size, weights, arraylen(weights), 0);
+    create_time = elapsed(&t0);
+    check(ctx != NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (num = 0 ; num < arena_size / CHUNK_SIZE ; num++) {
+        chunks[num] = mpool_ctx_alloc(ctx, CHUNK_SIZE, 0);
+        if (chunks[num] == NULL)
+            break;
+    }
+
+    touch_time = elapsed(&t0);
+
+    /* a random cycle through every chunk */
+    check(num > 0);
+    for (i = num - 1 ; i > 0 ; i--) {
+        j = bench_rand() % (i + 1);
+        tmp = chunks[i];
+        chunks[i] = chunks[j];
+        chunks[j] = tmp;
+    }
+
+    for (i = 0 ; i < num ; i++)
+        chunks[i]->next = chunks[(i + 1) % num];
+
+    misses = -1;
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    check(walk(chunks[0]) != 0);
+    walk_time = elapsed(&t0);
+
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+            misses = -1;
+    }
+
+    printf("%s, %s%s%s%s, %.2f, %.3f, %.2f, %.2f, ", mode->name,
+            flags & MPOOL_MAP_HUGETLB ? "hugetlb " : "",
+            flags & MPOOL_MAP_THP ? "thp " : "",
+            flags & MPOOL_MAP_POPULATE ? "populate " : "",
+            flags & MPOOL_MAP_LOCK ? "lock" : "",
+            map_time * 1e3, create_time * 1e3, touch_time * 1e3,
+            walk_time * 1e9 / (double) num_steps);
+    if (misses >= 0)
+        printf("%.4f\n", (double) misses / (double) num_steps);
+    else
+        printf("n/a\n");
+
+    for (i = 0 ; i < num ; i++)
+        mpool_ctx_free(ctx, chunks[i], CHUNK_SIZE);
+
+    mpool_ctx_destroy(ctx);
+    mpool_arena_unmap(arena, arena_size);
+}
+
+
+int
+main(int argc, char ** argv)
+{
+    int c, fd;
+    size_t i;
+
+    while ((c = getopt(argc, argv, "m:n:")) != -1) {
+        switch (c) {
+        case 'm':
+            arena_size = (size_t) atol(optarg) << 20;
+            break;
+        case 'n':
+            num_steps = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "%s [-m arena MB] [-n walk steps]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    chunks = malloc(arena_size / CHUNK_SIZE * sizeof(*chunks));
+    check(chunks != NULL);
+    fd = dtlb_open();
+
+    printf("mode, got, map (ms), create (ms), first touch (ms), "
+           "walk (ns/step), dTLB misses/step\n");
+    for (i = 0 ; i < arraylen(modes) ; i++)
+        run(&modes[i], fd);
+
+    if (fd >= 0)
+        close(fd);
+
+    free(chunks);
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * Bulk allocation benchmark.
+ *
+ * Bursts of 32 to 256 objects are allocated and freed either one object at a
+ * time, or with a single bulk call each way.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define RESERVE_SIZE (1UL << 30)
+#define MAX_BURST 256
+#define OBJECT_SIZE 64
+
+static long num_objects = 1 << 24;
+static void * ptrs[MAX_BURST];
+
+static double
+elapsed(struct timespec const * t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double) (t1.tv_sec - t0->tv_sec)
+           + (double) (t1.tv_nsec - t0->tv_nsec) * 1e-9;
+}
+
+static double
+run_loop(struct mpool_ctx * ctx, unsigned int burst)
+{
+    long i;
+    unsigned int j;
+    struct timespec t0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0 ; i < num_objects ; i += burst) {
+        for (j = 0 ; j < burst ; j++) {
+            ptrs[j] = mpool_ctx_alloc(ctx, OBJECT_SIZE, 0);
+            check(ptrs[j] != NULL);
+        }
+
+        for (j = 0 ; j < burst ; j++)
+            mpool_ctx_free(ctx, ptrs[j], OBJECT_SIZE);
+    }
+
+    return elapsed(&t0);
+}
+
+static double
+run_bulk(struct mpool_ctx * ctx, unsigned int burst)
+{
+    int rv;
+    long i;
+    struct timespec t0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0 ; i < num_objects ; i += burst) {
+        rv = mpool_ctx_alloc_bulk(ctx, OBJECT_SIZE, burst, ptrs);
+        check(rv == 0);
+        mpool_ctx_free_bulk(ctx, OBJECT_SIZE, burst, ptrs);
+    }
+
+    return elapsed(&t0);
+}
+
+int
+main(int argc, char ** argv)
+{
+    int c;
+    unsigned int burst;
+    double loop_time, bulk_time;
+    struct mpool_ctx * ctx;
+    unsigned int weights[] = {1};
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+        switch (c) {
+        case 'n':
+            num_objects = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "%s [-n objects]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(ctx != NULL);
+
+    printf("burst, loop (M objects/sec), bulk (M objects/sec), speedup\n");
+    for (burst = 32 ; burst <= MAX_BURST ; burst <<= 1) {
+        loop_time = run_loop(ctx, burst);
+        bulk_time = run_bulk(ctx, burst);
+        printf("%u, %.3f, %.3f, %.2f\n", burst,
+                (double) num_objects / loop_time * 1e-6,
+                (double) num_objects / bulk_time * 1e-6,
+                loop_time / bulk_time);
+    }
+
+    mpool_ctx_destroy(ctx);
+
+    return 0;
+}
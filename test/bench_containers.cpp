@@ -0,0 +1,181 @@
+/*
+ * Standard containers benchmark.
+ *
+ * Vectors grown from empty, lists, ordered and hashed maps are filled and
+ * emptied with std::allocator, mpool_allocator<T>, and polymorphic containers
+ * over an mpool_memory_resource.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <list>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+#include "check.h"
+#include "mpool.hpp"
+
+#define RESERVE_SIZE (4UL << 30)
+#define VECTOR_SIZE 64
+
+static long num_ops = 1 << 22;
+static long num_items = 1 << 12;
+static mpool_memory_resource * resource;
+
+static double
+elapsed(struct timespec const * t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double) (t1.tv_sec - t0->tv_sec)
+           + (double) (t1.tv_nsec - t0->tv_nsec) * 1e-9;
+}
+
+/* containers taking their allocator from the allocator of ints */
+template <typename A>
+struct rebind {
+    template <typename T>
+    using alloc = typename std::allocator_traits<A>::template rebind_alloc<T>;
+    using pair = std::pair<long const, long>;
+
+    using vector = std::vector<long, alloc<long>>;
+    using list = std::list<long, alloc<long>>;
+    using map = std::map<long, long, std::less<long>, alloc<pair>>;
+    using hash = std::unordered_map<long, long, std::hash<long>,
+                                    std::equal_to<long>, alloc<pair>>;
+};
+
+template <typename A>
+static A
+make_alloc(void)
+{
+    if constexpr (std::is_same_v<A, std::pmr::polymorphic_allocator<long>>)
+        return A(resource);
+    else
+        return A();
+}
+
+/* short lived vectors, grown one item at a time */
+template <typename A>
+static double
+run_vector(void)
+{
+    long i, j;
+    struct timespec t0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0 ; i < num_ops ; i += VECTOR_SIZE) {
+        typename rebind<A>::vector vec(make_alloc<A>());
+
+        for (j = 0 ; j < VECTOR_SIZE ; j++)
+            vec.push_back(j);
+
+        check(vec.size() == VECTOR_SIZE);
+    }
+
+    return elapsed(&t0);
+}
+
+template <typename C, typename A>
+static double
+run_nodes(void (* fill)(C &, long))
+{
+    long i;
+    struct timespec t0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0 ; i < num_ops ; i += num_items) {
+        C c(make_alloc<A>());
+
+        fill(c, num_items);
+        check(c.size() == static_cast<size_t>(num_items));
+    }
+
+    return elapsed(&t0);
+}
+
+template <typename C>
+static void
+fill_list(C & c, long n)
+{
+    long i;
+
+    for (i = 0 ; i < n ; i++)
+        c.push_back(i);
+}
+
+template <typename C>
+static void
+fill_map(C & c, long n)
+{
+    long i;
+
+    for (i = 0 ; i < n ; i++)
+        c.emplace(i * 7919 % n, i);
+}
+
+template <typename A>
+static void
+run_all(double * times)
+{
+    times[0] = run_vector<A>();
+    times[1] = run_nodes<typename rebind<A>::list, A>(
+            fill_list<typename rebind<A>::list>);
+    times[2] = run_nodes<typename rebind<A>::map, A>(
+            fill_map<typename rebind<A>::map>);
+    times[3] = run_nodes<typename rebind<A>::hash, A>(
+            fill_map<typename rebind<A>::hash>);
+}
+
+int
+main(int argc, char ** argv)
+{
+    int c;
+    size_t i;
+    struct mpool_ctx * ctx;
+    double std_times[4], mpool_times[4], pmr_times[4];
+    char const * names[] = {"vector", "list", "map", "unordered_map"};
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 1};
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+        switch (c) {
+        case 'n':
+            num_ops = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "%s [-n operations]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(ctx != NULL);
+    mpool_set_default(ctx);
+    resource = new mpool_memory_resource(ctx);
+
+    run_all<std::allocator<long>>(std_times);
+    run_all<mpool_allocator<long>>(mpool_times);
+    run_all<std::pmr::polymorphic_allocator<long>>(pmr_times);
+
+    printf("container, std::allocator (M items/sec), mpool_allocator "
+           "(M items/sec), pmr (M items/sec), speedup\n");
+    for (i = 0 ; i < arraylen(names) ; i++) {
+        printf("%s, %.3f, %.3f, %.3f, %.2f\n", names[i],
+                (double) num_ops / std_times[i] * 1e-6,
+                (double) num_ops / mpool_times[i] * 1e-6,
+                (double) num_ops / pmr_times[i] * 1e-6,
+                std_times[i] / mpool_times[i]);
+    }
+
+    delete resource;
+    mpool_destroy();
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Pool free list contention benchmark.
+ *
+ * Every thread allocates and frees bursts bigger than its cache, so that each
+ * burst goes through the pool free list. Build against the library compiled
+ * with -DMPOOL_CENTRAL_LOCK to compare with the mutex protected free list.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define MAX_THREADS 32
+#define BURST 64
+#define OBJECT_SIZE 64
+
+static long num_iters = 20000;
+static pthread_barrier_t barrier;
+
+static void *
+bench_thread(void * void_args)
+{
+    long i, j;
+    void * ptr[BURST];
+
+    (void) void_args;
+
+    pthread_barrier_wait(&barrier);
+
+    for (i = 0 ; i < num_iters ; i++) {
+        for (j = 0 ; j < BURST ; j++) {
+            ptr[j] = mpool_alloc(OBJECT_SIZE, 0);
+            check(ptr[j] != NULL);
+        }
+
+        for (j = 0 ; j < BURST ; j++)
+            mpool_free(ptr[j], OBJECT_SIZE);
+    }
+
+    return NULL;
+}
+
+static double
+elapsed(struct timespec const * t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double) (t1.tv_sec - t0->tv_sec)
+           + (double) (t1.tv_nsec - t0->tv_nsec) * 1e-9;
+}
+
+static double
+run(int num_threads)
+{
+    int i, rv;
+    struct timespec t0;
+    pthread_t threads[MAX_THREADS];
+
+    rv = pthread_barrier_init(&barrier, NULL, (unsigned) num_threads + 1);
+    check(rv == 0);
+
+    for (i = 0 ; i < num_threads ; i++) {
+        rv = pthread_create(&threads[i], NULL, &bench_thread, NULL);
+        check(rv == 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_barrier_wait(&barrier);
+
+    for (i = 0 ; i < num_threads ; i++) {
+        rv = pthread_join(threads[i], NULL);
+        check(rv == 0);
+    }
+
+    pthread_barrier_destroy(&barrier);
+
+    return elapsed(&t0);
+}
+
+int
+main(int argc, char ** argv)
+{
+    int c, rv, num_threads, max_threads;
+    double time, ops;
+    void * arena;
+    size_t arena_size;
+    unsigned int weights[] = {1};
+
+    max_threads = MAX_THREADS;
+    while ((c = getopt(argc, argv, "n:t:")) != -1) {
+        switch (c) {
+        case 'n':
+            num_iters = atol(optarg);
+            break;
+        case 't':
+            max_threads = MIN(atoi(optarg), MAX_THREADS);
+            break;
+        default:
+            fprintf(stderr, "%s [-n iterations] [-t max threads]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    arena_size = 1 << 24;
+    arena = mmap(NULL, arena_size,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_SHARED,
+            -1, 0);
+    check(arena != MAP_FAILED);
+
+    rv = mpool_create(arena, arena_size, weights, arraylen(weights));
+    check(rv == 0);
+
+    printf("threads, time (s), alloc+free/sec (M)\n");
+    for (num_threads = 1 ; num_threads <= max_threads ; num_threads <<= 1) {
+        time = run(num_threads);
+        ops = (double) num_threads * (double) num_iters * BURST;
+        printf("%d, %.3f, %.3f\n", num_threads, time, ops / time * 1e-6);
+    }
+
+    mpool_destroy();
+    munmap(arena, arena_size);
+
+    return 0;
+}
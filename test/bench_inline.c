@@ -0,0 +1,189 @@
+/*
+ * Cost of an allocation and free pair through the inline forms of mpool.h,
+ * mpool_alloc_fast() and mpool_free_fast(), against the exported functions,
+ * for sizes known at compile time. Pairs are made one at a time, or by bursts
+ * of BURST allocations then frees, all served by the thread cache. Costs are
+ * in TSC ticks, or nanoseconds where there is no TSC.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define RESERVE_SIZE (256UL << 20)
+#define NUM_PAIRS (10 * 1000 * 1000)
+#define BURST 16
+
+/* keeps the compiler from eliding a chunk */
+#define USE(ptr) __asm__ volatile ("" : : "r" (ptr) : "memory")
+
+static uint64_t
+ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+#define BENCH_SIZE(size) \
+    static NOINLINE double \
+    pairs_fast_##size(void) \
+    { \
+        long i; \
+        void * ptr; \
+        uint64_t t0; \
+\
+        t0 = ticks(); \
+        for (i = 0 ; i < NUM_PAIRS ; i++) { \
+            ptr = mpool_alloc_fast(size); \
+            USE(ptr); \
+            mpool_free_fast(ptr, size); \
+        } \
+\
+        return (double) (ticks() - t0) / NUM_PAIRS; \
+    } \
+\
+    static NOINLINE double \
+    pairs_lib_##size(void) \
+    { \
+        long i; \
+        void * ptr; \
+        uint64_t t0; \
+\
+        t0 = ticks(); \
+        for (i = 0 ; i < NUM_PAIRS ; i++) { \
+            ptr = mpool_alloc(size, 0); \
+            USE(ptr); \
+            mpool_free(ptr, size); \
+        } \
+\
+        return (double) (ticks() - t0) / NUM_PAIRS; \
+    } \
+\
+    static NOINLINE double \
+    pairs_ptr_##size(void) \
+    { \
+        long i; \
+        void * ptr; \
+        uint64_t t0; \
+\
+        t0 = ticks(); \
+        for (i = 0 ; i < NUM_PAIRS ; i++) { \
+            ptr = mpool_alloc(size, 0); \
+            USE(ptr); \
+            mpool_free_ptr(ptr); \
+        } \
+\
+        return (double) (ticks() - t0) / NUM_PAIRS; \
+    } \
+\
+    static NOINLINE double \
+    burst_fast_##size(void) \
+    { \
+        long i; \
+        int j; \
+        void * ptrs[BURST]; \
+        uint64_t t0; \
+\
+        t0 = ticks(); \
+        for (i = 0 ; i < NUM_PAIRS / BURST ; i++) { \
+            for (j = 0 ; j < BURST ; j++) { \
+                ptrs[j] = mpool_alloc_fast(size); \
+                USE(ptrs[j]); \
+            } \
+\
+            for (j = 0 ; j < BURST ; j++) \
+                mpool_free_fast(ptrs[j], size); \
+        } \
+\
+        return (double) (ticks() - t0) / NUM_PAIRS; \
+    } \
+\
+    static NOINLINE double \
+    burst_lib_##size(void) \
+    { \
+        long i; \
+        int j; \
+        void * ptrs[BURST]; \
+        uint64_t t0; \
+\
+        t0 = ticks(); \
+        for (i = 0 ; i < NUM_PAIRS / BURST ; i++) { \
+            for (j = 0 ; j < BURST ; j++) { \
+                ptrs[j] = mpool_alloc(size, 0); \
+                USE(ptrs[j]); \
+            } \
+\
+            for (j = 0 ; j < BURST ; j++) \
+                mpool_free(ptrs[j], size); \
+        } \
+\
+        return (double) (ticks() - t0) / NUM_PAIRS; \
+    }
+
+BENCH_SIZE(16)
+BENCH_SIZE(64)
+BENCH_SIZE(200)
+BENCH_SIZE(1024)
+
+struct bench {
+    size_t size;
+    double (* pairs_fast)(void);
+    double (* pairs_lib)(void);
+    double (* pairs_ptr)(void);
+    double (* burst_fast)(void);
+    double (* burst_lib)(void);
+};
+
+#define BENCH(size) \
+    { size, pairs_fast_##size, pairs_lib_##size, pairs_ptr_##size, \
+      burst_fast_##size, burst_lib_##size }
+
+static struct bench const benchs[] = {
+    BENCH(16),
+    BENCH(64),
+    BENCH(200),
+    BENCH(1024),
+};
+
+int
+main(void)
+{
+    size_t i;
+    struct mpool_ctx * ctx;
+    struct bench const * b;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 1};
+
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(ctx != NULL);
+    mpool_set_default(ctx);
+
+    printf("ticks per alloc/free pair: inline, mpool_alloc/mpool_free, "
+           "mpool_alloc/mpool_free_ptr; by bursts of %d: inline, "
+           "mpool_alloc/mpool_free\n", BURST);
+    for (i = 0 ; i < arraylen(benchs) ; i++) {
+        b = &benchs[i];
+
+        /* warm the caches up */
+        (void) b->burst_fast();
+        printf("%4zu bytes: %6.1f %6.1f %6.1f    %6.1f %6.1f\n", b->size,
+                b->pairs_fast(), b->pairs_lib(), b->pairs_ptr(),
+                b->burst_fast(), b->burst_lib());
+    }
+
+    mpool_destroy();
+
+    return 0;
+}
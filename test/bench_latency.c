@@ -0,0 +1,256 @@
+/*
+ * Per-call latency benchmark, of a library built with MPOOL_LATENCY
+ * (make LATENCY=1, or meson -Dlatency=true).
+ *
+ * Each thread keeps a set of objects of a single size, replaced at random:
+ * the object in a slot is freed, and a new one allocated, or grown from half
+ * the size with a realloc one time in four. The percentiles of the calls
+ * served by the thread caches (fast) and of the ones which refilled or
+ * flushed them (slow) are reported per call, size and thread count, in TSC
+ * ticks.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define RESERVE_SIZE (16UL << 30)
+#define MAX_THREADS 128
+#define NUM_SLOTS 1024
+#define DEFAULT_OPS 200000
+
+struct worker {
+    pthread_t thread;
+    uint64_t seed;
+    void * slots[NUM_SLOTS];
+} CACHE_ALIGNED;
+
+static struct mpool_ctx * bench_ctx;
+static struct worker workers[MAX_THREADS];
+static pthread_barrier_t barrier;
+static size_t obj_size;
+static long num_ops = DEFAULT_OPS;
+
+static char const * const call_names[MPOOL_LATENCY_CALLS] = {
+    [MPOOL_LATENCY_ALLOC] = "alloc",
+    [MPOOL_LATENCY_FREE] = "free",
+    [MPOOL_LATENCY_REALLOC] = "realloc",
+};
+
+/* xorshift64 */
+static uint64_t
+bench_rand(uint64_t * seed)
+{
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+
+static void *
+worker_thread(void * arg)
+{
+    long i;
+    uint64_t r;
+    void ** slot;
+    struct worker * worker = arg;
+
+    pthread_barrier_wait(&barrier);
+    for (i = 0 ; i < num_ops ; i++) {
+        r = bench_rand(&worker->seed);
+        slot = &worker->slots[r % NUM_SLOTS];
+        mpool_ctx_free_ptr(bench_ctx, *slot);
+        if ((r >> 32) % 4 == 0) {
+            *slot = mpool_ctx_alloc(bench_ctx, obj_size / 2 + 1, 0);
+            check(*slot != NULL);
+            *slot = mpool_ctx_realloc(bench_ctx, *slot, obj_size / 2 + 1,
+                    obj_size, 0);
+        } else {
+            *slot = mpool_ctx_alloc(bench_ctx, obj_size, 0);
+        }
+
+        check(*slot != NULL);
+        memset(*slot, 'a', 16);
+    }
+
+    for (i = 0 ; i < NUM_SLOTS ; i++)
+        mpool_ctx_free_ptr(bench_ctx, worker->slots[i]);
+
+    return NULL;
+}
+
+
+static void
+run(int num_threads)
+{
+    int i, call, slow;
+    struct mpool_latency latency;
+
+    memset(workers, 0, sizeof(workers));
+    check(pthread_barrier_init(&barrier, NULL, (unsigned int) num_threads)
+          == 0);
+    mpool_latency_reset();
+    for (i = 0 ; i < num_threads ; i++) {
+        workers[i].seed = 88172645463325252ULL + (uint64_t) i;
+        check(pthread_create(&workers[i].thread, NULL, worker_thread,
+                &workers[i]) == 0);
+    }
+
+    for (i = 0 ; i < num_threads ; i++)
+        check(pthread_join(workers[i].thread, NULL) == 0);
+
+    pthread_barrier_destroy(&barrier);
+
+    for (call = 0 ; call < MPOOL_LATENCY_CALLS ; call++) {
+        for (slow = 0 ; slow < 2 ; slow++) {
+            check(mpool_ctx_latency_get(bench_ctx, obj_size, call, slow,
+                    &latency) == 0);
+            printf("%zu, %zu, %d, %s, %s, %zu, %lu, %lu, %lu, %lu\n",
+                    obj_size, latency.elem_size, num_threads,
+                    call_names[call], slow ? "slow" : "fast", latency.count,
+                    (unsigned long) latency.p50, (unsigned long) latency.p99,
+                    (unsigned long) latency.p999,
+                    (unsigned long) latency.max);
+        }
+    }
+}
+
+
+/* TSC ticks per nanosecond, the library counts nanoseconds without a TSC */
+static double
+ticks_per_ns(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t t0, t1;
+    struct timespec ts0, ts1;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts0);
+    t0 = __builtin_ia32_rdtsc();
+    usleep(50000);
+    t1 = __builtin_ia32_rdtsc();
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+
+    return (double) (t1 - t0)
+           / ((double) (ts1.tv_sec - ts0.tv_sec) * 1e9
+              + (double) (ts1.tv_nsec - ts0.tv_nsec));
+#else
+    return 1;
+#endif
+}
+
+
+static int
+parse_list(char * list, long * values, int max_values, long max)
+{
+    int n;
+    char * end;
+
+    for (n = 0 ; n < max_values ; ) {
+        values[n] = strtol(list, &end, 10);
+        if (values[n] <= 0 || values[n] > max)
+            return -1;
+
+        n++;
+        if (*end != ',')
+            break;
+
+        list = end + 1;
+    }
+
+    return n;
+}
+
+
+static void
+usage(char const * prog)
+{
+    fprintf(stderr, "%s [-s sizes] [-t threads] [-n ops]\n", prog);
+    fprintf(stderr, "\t-s comma separated object sizes, by default from 16 "
+            "bytes to 4 pages by powers of four\n");
+    fprintf(stderr, "\t-t comma separated thread counts, powers of two up "
+            "to the number of CPUs by default\n");
+    fprintf(stderr, "\t-n replacements per thread, default %d\n",
+            DEFAULT_OPS);
+    exit(EXIT_FAILURE);
+}
+
+
+int
+main(int argc, char ** argv)
+{
+    int c, i, j, num_sizes, num_counts;
+    long sizes[16], counts[16], num_cpus;
+    struct mpool_latency latency;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 1};
+
+    num_sizes = 0;
+    num_counts = 0;
+    while ((c = getopt(argc, argv, "s:t:n:")) != -1) {
+        switch (c) {
+        case 's':
+            num_sizes = parse_list(optarg, sizes, arraylen(sizes), 1L << 20);
+            if (num_sizes < 0)
+                usage(argv[0]);
+            break;
+        case 't':
+            num_counts = parse_list(optarg, counts, arraylen(counts),
+                    MAX_THREADS);
+            if (num_counts < 0)
+                usage(argv[0]);
+            break;
+        case 'n':
+            num_ops = atol(optarg);
+            if (num_ops <= 0)
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (num_sizes == 0) {
+        for (i = 16 ; i <= 4 * PAGE_SIZE ; i *= 4)
+            sizes[num_sizes++] = i;
+    }
+
+    if (num_counts == 0) {
+        num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        for (i = 1 ; i <= MAX(num_cpus, 2) && i <= MAX_THREADS ; i *= 2)
+            counts[num_counts++] = i;
+    }
+
+    bench_ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights,
+            arraylen(weights), MPOOL_GROW);
+    check(bench_ctx != NULL);
+
+    if (mpool_ctx_latency_get(bench_ctx, 16, MPOOL_LATENCY_ALLOC, 0,
+            &latency) == ENOTSUP) {
+        fprintf(stderr, "libmpool is built without MPOOL_LATENCY, "
+                "rebuild it with LATENCY=1\n");
+        mpool_ctx_destroy(bench_ctx);
+        return 0;
+    }
+
+    printf("# %.3f ticks per ns\n", ticks_per_ns());
+    printf("size, size class, threads, call, path, calls, p50, p99, p99.9, "
+           "max\n");
+    for (i = 0 ; i < num_sizes ; i++) {
+        obj_size = (size_t) sizes[i];
+        for (j = 0 ; j < num_counts ; j++)
+            run((int) counts[j]);
+    }
+
+    mpool_ctx_destroy(bench_ctx);
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Resident memory benchmark.
+ *
+ * A growable instance takes a spike of allocations of random sizes up to the
+ * page size, which are all freed. The resident set size is reported after
+ * each step, then after an explicit purge. The spike is repeated with a decay
+ * period and a few chunks keep being allocated and freed, the resident set
+ * size is sampled as the decay purges take it back down.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define RESERVE_SIZE (16UL << 30)
+#define NUM_CHURN 4096
+#define CHURN_SIZE 64
+#define SAMPLE_MS 50
+
+struct chunk {
+    void * ptr;
+    size_t size;
+};
+
+static size_t spike_size = 512UL << 20;
+static unsigned int decay_ms = 200;
+static long run_ms = 1500;
+static struct chunk * chunks;
+static void * churn[NUM_CHURN];
+static uint64_t seed = 88172645463325252ULL;
+static struct timespec start;
+
+static double
+elapsed_ms(void)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double) (t1.tv_sec - start.tv_sec) * 1e3
+           + (double) (t1.tv_nsec - start.tv_nsec) * 1e-6;
+}
+
+/* xorshift64 */
+static uint64_t
+bench_rand(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static double
+rss_mb(void)
+{
+    int num;
+    long size, pages;
+    FILE * f;
+
+    f = fopen("/proc/self/statm", "r");
+    check(f != NULL);
+    num = fscanf(f, "%ld %ld", &size, &pages);
+    check(num == 2);
+    fclose(f);
+
+    return (double) pages * (double) sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+static void
+report(char const * phase)
+{
+    printf("%s, %.1f, %.1f\n", phase, elapsed_ms(), rss_mb());
+}
+
+static size_t
+spike(struct mpool_ctx * ctx)
+{
+    size_t num, total;
+
+    total = 0;
+    for (num = 0 ; total < spike_size ; num++) {
+        chunks[num].size = 16 + bench_rand() % (PAGE_SIZE - 16);
+        chunks[num].ptr = mpool_ctx_alloc(ctx, chunks[num].size, 0);
+        check(chunks[num].ptr != NULL);
+        memset(chunks[num].ptr, 'a', chunks[num].size);
+        total += chunks[num].size;
+    }
+
+    return num;
+}
+
+static void
+release(struct mpool_ctx * ctx, size_t num)
+{
+    size_t i;
+
+    for (i = 0 ; i < num ; i++)
+        mpool_ctx_free(ctx, chunks[i].ptr, chunks[i].size);
+}
+
+
+int
+main(int argc, char ** argv)
+{
+    int c;
+    size_t num, purged;
+    struct mpool_ctx * ctx;
+    double t0;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1};
+
+    while ((c = getopt(argc, argv, "m:d:t:")) != -1) {
+        switch (c) {
+        case 'm':
+            spike_size = (size_t) atol(optarg) << 20;
+            break;
+        case 'd':
+            decay_ms = (unsigned int) atoi(optarg);
+            break;
+        case 't':
+            run_ms = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "%s [-m spike MB] [-d decay ms] [-t run ms]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    chunks = malloc(spike_size / 16 * sizeof(*chunks));
+    check(chunks != NULL);
+
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(ctx != NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    printf("phase, time (ms), rss (MB)\n");
+    report("start");
+
+    num = spike(ctx);
+    report("spike");
+    release(ctx, num);
+    report("freed");
+
+    purged = mpool_ctx_purge(ctx);
+    report("mpool_purge");
+    fprintf(stderr, "purged %zu MB\n", purged >> 20);
+
+    /* again, with the decay purges */
+    mpool_ctx_set_decay(ctx, decay_ms);
+    num = spike(ctx);
+    report("spike");
+    release(ctx, num);
+    report("freed");
+
+    t0 = elapsed_ms();
+    while (elapsed_ms() - t0 < (double) run_ms) {
+        usleep(SAMPLE_MS * 1000);
+        check(mpool_ctx_alloc_bulk(ctx, CHURN_SIZE, NUM_CHURN, churn) == 0);
+        mpool_ctx_free_bulk(ctx, CHURN_SIZE, NUM_CHURN, churn);
+        report("decay");
+    }
+
+    mpool_ctx_destroy(ctx);
+    free(chunks);
+
+    return 0;
+}
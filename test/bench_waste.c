@@ -0,0 +1,136 @@
+/*
+ * Size class internal fragmentation benchmark.
+ *
+ * Every workload allocates the same sequence of sizes from an instance with a
+ * single size class per doubling, and from one with four, and reports the
+ * bytes lost to rounding up to the size classes in both cases.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define RESERVE_SIZE (1UL << 32)
+#define NUM_ALLOCS 20000
+
+struct workload {
+    char const * name;
+    size_t (* next_size)(void);
+};
+
+static void * ptrs[NUM_ALLOCS];
+static uint64_t seed;
+
+/* xorshift64 */
+static uint64_t
+bench_rand(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static size_t
+uniform_small(void)
+{
+    return 1 + bench_rand() % 256;
+}
+
+static size_t
+uniform_page(void)
+{
+    return 1 + bench_rand() % PAGE_SIZE;
+}
+
+static size_t
+pow2_plus_one(void)
+{
+    return ((size_t) CACHELINE_SIZE << bench_rand() % 6) + 1;
+}
+
+static size_t
+mixed(void)
+{
+    uint64_t r = bench_rand() % 10;
+
+    if (r < 6)
+        return 16 + bench_rand() % 112;
+    else if (r < 9)
+        return 128 + bench_rand() % 896;
+    else
+        return 1024 + bench_rand() % (PAGE_SIZE - 1024);
+}
+
+static size_t
+constant_65(void)
+{
+    return 65;
+}
+
+static size_t
+constant_2100(void)
+{
+    return 2100;
+}
+
+static struct workload const workloads[] = {
+    {"uniform 1-256", uniform_small},
+    {"uniform 1-4096", uniform_page},
+    {"pow2 + 1", pow2_plus_one},
+    {"mixed", mixed},
+    {"65 B", constant_65},
+    {"2100 B", constant_2100},
+};
+
+static size_t
+run(struct workload const * workload, int flags, size_t * requested)
+{
+    size_t i, size, wasted;
+    struct mpool_ctx * ctx;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1};
+
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW | flags);
+    check(ctx != NULL);
+
+    seed = 88172645463325252ULL;
+    wasted = 0;
+    *requested = 0;
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        size = workload->next_size();
+        ptrs[i] = mpool_ctx_alloc(ctx, size, 0);
+        check(ptrs[i] != NULL);
+
+        *requested += size;
+        wasted += mpool_ctx_alloc_size(ctx, size) - size;
+    }
+
+    mpool_ctx_destroy(ctx);
+
+    return wasted;
+}
+
+int
+main(void)
+{
+    size_t i, requested, pow2_waste, fine_waste;
+
+    printf("workload, requested (MB), wasted pow2 (MB), wasted pow2 (%%), "
+           "wasted fine (MB), wasted fine (%%)\n");
+    for (i = 0 ; i < arraylen(workloads) ; i++) {
+        pow2_waste = run(&workloads[i], MPOOL_POW2_CLASSES, &requested);
+        fine_waste = run(&workloads[i], 0, &requested);
+        printf("%s, %.2f, %.2f, %.1f, %.2f, %.1f\n", workloads[i].name,
+                (double) requested / 1e6,
+                (double) pow2_waste / 1e6,
+                100. * (double) pow2_waste / (double) (requested + pow2_waste),
+                (double) fine_waste / 1e6,
+                100. * (double) fine_waste / (double) (requested + fine_waste));
+    }
+
+    return 0;
+}
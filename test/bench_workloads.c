@@ -0,0 +1,794 @@
+/*
+ * Allocator workloads benchmark.
+ *
+ * Each workload runs for a while on a growing number of threads, against an
+ * mpool instance, the C library allocator, and the malloc() the program is
+ * linked to, which is the LD_PRELOADed allocator if any:
+ *
+ * - xmalloc: producer threads allocate batches of objects of random sizes,
+ *   consumer threads free them (Lever and Boreham)
+ * - larson: server threads keep a set of objects of random sizes, replaced at
+ *   random by a new thread per round, which frees the objects of the previous
+ *   ones (Larson and Krishnan)
+ * - cache-scratch: each thread frees an object the main thread allocated next
+ *   to the ones of the other threads, then allocates, writes and frees objects
+ *   of the same size. Allocators handing the freed object back to the thread
+ *   false share it (passive false sharing, Hoard)
+ * - cache-thrash: each thread allocates, writes and frees small objects, which
+ *   false share when neighbours go to different threads (active false sharing)
+ * - churn: thread local allocations of random sizes, freed in FIFO order
+ * - realloc: buffers grown by small steps up to 64 KiB
+ *
+ * Operations are allocations, or reallocations. The peak resident set size
+ * of each run is reset before it where the kernel allows it. The speedup is
+ * over the first thread count of the same workload and allocator.
+ */
+#define _GNU_SOURCE
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define RESERVE_SIZE (16UL << 30)
+#define MAX_THREADS 256
+#define MAX_RUNS 256
+
+#define XMALLOC_BATCH 1024
+#define XMALLOC_QUEUED 16 /* batches per producer */
+#define LARSON_SLOTS 1000
+#define LARSON_ROUND 10000
+#define LARSON_MIN_SIZE 16
+#define LARSON_MAX_SIZE 1024
+#define SCRATCH_SIZE 8
+#define SCRATCH_WRITES 100
+#define CHURN_SLOTS 256
+#define CHURN_MAX_SIZE 512
+#define REALLOC_MAX_SIZE (64 << 10)
+
+extern void * __libc_malloc(size_t size);
+extern void __libc_free(void * ptr);
+extern void * __libc_realloc(void * ptr, size_t size);
+
+struct allocator {
+    char const * name;
+    void * (* alloc)(size_t size);
+    void (* release)(void * ptr);
+    void * (* resize)(void * ptr, size_t size);
+    void (* setup)(void);
+    void (* teardown)(void);
+};
+
+struct worker {
+    unsigned int id;
+    uint64_t seed;
+    long ops;
+    void * ptr; /* cache-scratch object, larson slots */
+    pthread_t thread;
+} CACHE_ALIGNED;
+
+struct workload {
+    char const * name;
+    void * (* run)(void * arg);
+    int pairs; /* as many consumer threads as producers */
+    void (* setup)(int num_threads);
+    void (* teardown)(int num_threads);
+};
+
+struct result {
+    char const * workload;
+    char const * allocator;
+    int num_threads;
+    double seconds;
+    long ops;
+    double peak_rss_mb;
+    double speedup;
+};
+
+static struct allocator const * allocator;
+static struct mpool_ctx * bench_ctx;
+static struct worker workers[MAX_THREADS];
+static int stop;
+static double duration = 0.25;
+
+static struct result results[MAX_RUNS];
+static int num_results;
+
+/* xorshift64 */
+static uint64_t
+bench_rand(uint64_t * seed)
+{
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+static int
+stopped(void)
+{
+    return __atomic_load_n(&stop, __ATOMIC_RELAXED);
+}
+
+/* allocators. mpool gets an instance of its own: the default one may serve
+ * malloc() */
+
+static void *
+mpool_bench_alloc(size_t size)
+{
+    return mpool_ctx_alloc(bench_ctx, size, 0);
+}
+
+
+static void
+mpool_bench_free(void * ptr)
+{
+    mpool_ctx_free_ptr(bench_ctx, ptr);
+}
+
+
+static void *
+mpool_bench_realloc(void * ptr, size_t size)
+{
+    return mpool_ctx_realloc(bench_ctx, ptr,
+            mpool_ctx_usable_size(bench_ctx, ptr), size, 0);
+}
+
+
+static void
+mpool_bench_setup(void)
+{
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 1};
+
+    bench_ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights,
+            arraylen(weights), MPOOL_GROW);
+    check(bench_ctx != NULL);
+}
+
+
+static void
+mpool_bench_teardown(void)
+{
+    mpool_ctx_destroy(bench_ctx);
+    bench_ctx = NULL;
+}
+
+
+static void
+libc_teardown(void)
+{
+    malloc_trim(0);
+}
+
+static struct allocator const allocators[] = {
+    {"mpool", mpool_bench_alloc, mpool_bench_free, mpool_bench_realloc,
+     mpool_bench_setup, mpool_bench_teardown},
+    {"glibc", __libc_malloc, __libc_free, __libc_realloc, NULL,
+     libc_teardown},
+    {"system", malloc, free, realloc, NULL, libc_teardown},
+};
+
+/* xmalloc */
+
+struct xmalloc_batch {
+    struct xmalloc_batch * next;
+    void * objects[XMALLOC_BATCH];
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    struct xmalloc_batch * batches;
+    int num;
+    int max;
+} xmalloc_queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER,
+    .not_full = PTHREAD_COND_INITIALIZER,
+};
+
+static size_t const xmalloc_sizes[] = {8, 12, 16, 24, 32, 48, 64, 96, 128,
+                                       192, 256, 384, 512, 768, 1024, 1536,
+                                       2048};
+
+static void
+xmalloc_setup(int num_threads)
+{
+    xmalloc_queue.batches = NULL;
+    xmalloc_queue.num = 0;
+    xmalloc_queue.max = XMALLOC_QUEUED * num_threads;
+}
+
+
+static void
+xmalloc_release(struct xmalloc_batch * batch)
+{
+    int i;
+
+    for (i = 0 ; i < XMALLOC_BATCH ; i++)
+        allocator->release(batch->objects[i]);
+
+    allocator->release(batch);
+}
+
+
+static void
+xmalloc_teardown(int num_threads)
+{
+    struct xmalloc_batch * batch;
+
+    (void) num_threads;
+
+    while ((batch = xmalloc_queue.batches) != NULL) {
+        xmalloc_queue.batches = batch->next;
+        xmalloc_release(batch);
+    }
+}
+
+
+static void *
+xmalloc_producer(struct worker * worker)
+{
+    int i;
+    size_t size;
+    struct xmalloc_batch * batch;
+
+    while (!stopped()) {
+        batch = allocator->alloc(sizeof(*batch));
+        check(batch != NULL);
+        for (i = 0 ; i < XMALLOC_BATCH ; i++) {
+            size = xmalloc_sizes[bench_rand(&worker->seed)
+                                 % arraylen(xmalloc_sizes)];
+            batch->objects[i] = allocator->alloc(size);
+            check(batch->objects[i] != NULL);
+            memset(batch->objects[i], i, MIN(size, 128));
+        }
+
+        worker->ops += XMALLOC_BATCH + 1;
+
+        pthread_mutex_lock(&xmalloc_queue.lock);
+        while (xmalloc_queue.num >= xmalloc_queue.max && !stopped())
+            pthread_cond_wait(&xmalloc_queue.not_full, &xmalloc_queue.lock);
+
+        batch->next = xmalloc_queue.batches;
+        xmalloc_queue.batches = batch;
+        xmalloc_queue.num++;
+        pthread_cond_signal(&xmalloc_queue.not_empty);
+        pthread_mutex_unlock(&xmalloc_queue.lock);
+    }
+
+    return NULL;
+}
+
+
+static void *
+xmalloc_consumer(struct worker * worker)
+{
+    struct xmalloc_batch * batch;
+
+    (void) worker;
+
+    for (;;) {
+        pthread_mutex_lock(&xmalloc_queue.lock);
+        while (xmalloc_queue.batches == NULL && !stopped())
+            pthread_cond_wait(&xmalloc_queue.not_empty, &xmalloc_queue.lock);
+
+        batch = xmalloc_queue.batches;
+        if (batch != NULL) {
+            xmalloc_queue.batches = batch->next;
+            xmalloc_queue.num--;
+            pthread_cond_signal(&xmalloc_queue.not_full);
+        }
+
+        pthread_mutex_unlock(&xmalloc_queue.lock);
+
+        if (batch == NULL)
+            return NULL;
+
+        xmalloc_release(batch);
+    }
+}
+
+
+/* even workers produce, odd ones consume */
+static void *
+xmalloc_thread(void * arg)
+{
+    struct worker * worker = arg;
+
+    if (worker->id % 2 == 0)
+        return xmalloc_producer(worker);
+
+    return xmalloc_consumer(worker);
+}
+
+
+static void
+xmalloc_wake(void)
+{
+    pthread_mutex_lock(&xmalloc_queue.lock);
+    pthread_cond_broadcast(&xmalloc_queue.not_empty);
+    pthread_cond_broadcast(&xmalloc_queue.not_full);
+    pthread_mutex_unlock(&xmalloc_queue.lock);
+}
+
+/* larson */
+
+static size_t
+larson_size(struct worker * worker)
+{
+    return LARSON_MIN_SIZE + bench_rand(&worker->seed)
+           % (LARSON_MAX_SIZE - LARSON_MIN_SIZE + 1);
+}
+
+
+static void
+larson_setup(int num_threads)
+{
+    int i, j;
+    void ** slots;
+
+    for (i = 0 ; i < num_threads ; i++) {
+        slots = calloc(LARSON_SLOTS, sizeof(*slots));
+        check(slots != NULL);
+        for (j = 0 ; j < LARSON_SLOTS ; j++) {
+            slots[j] = allocator->alloc(larson_size(&workers[i]));
+            check(slots[j] != NULL);
+        }
+
+        workers[i].ptr = slots;
+    }
+}
+
+
+static void
+larson_teardown(int num_threads)
+{
+    int i, j;
+    void ** slots;
+
+    for (i = 0 ; i < num_threads ; i++) {
+        slots = workers[i].ptr;
+        for (j = 0 ; j < LARSON_SLOTS ; j++)
+            allocator->release(slots[j]);
+
+        free(slots);
+    }
+}
+
+
+static void *
+larson_round(void * arg)
+{
+    int i;
+    size_t slot, size;
+    struct worker * worker = arg;
+    void ** slots = worker->ptr;
+
+    for (i = 0 ; i < LARSON_ROUND ; i++) {
+        slot = bench_rand(&worker->seed) % LARSON_SLOTS;
+        size = larson_size(worker);
+        allocator->release(slots[slot]);
+        slots[slot] = allocator->alloc(size);
+        check(slots[slot] != NULL);
+        memset(slots[slot], i, MIN(size, 64));
+    }
+
+    return NULL;
+}
+
+
+/* a new thread per round, as a server would per connection */
+static void *
+larson_thread(void * arg)
+{
+    pthread_t thread;
+    struct worker * worker = arg;
+
+    while (!stopped()) {
+        check(pthread_create(&thread, NULL, larson_round, worker) == 0);
+        check(pthread_join(thread, NULL) == 0);
+        worker->ops += LARSON_ROUND;
+    }
+
+    return NULL;
+}
+
+/* cache-scratch and cache-thrash */
+
+static void
+scratch_setup(int num_threads)
+{
+    int i;
+
+    for (i = 0 ; i < num_threads ; i++) {
+        workers[i].ptr = allocator->alloc(SCRATCH_SIZE);
+        check(workers[i].ptr != NULL);
+    }
+}
+
+
+static void
+scratch_write(struct worker * worker)
+{
+    int i, j;
+    char * obj;
+
+    for (i = 0 ; i < 64 ; i++) {
+        obj = allocator->alloc(SCRATCH_SIZE);
+        check(obj != NULL);
+        for (j = 0 ; j < SCRATCH_WRITES ; j++)
+            ((char volatile *) obj)[j % SCRATCH_SIZE]++;
+
+        allocator->release(obj);
+    }
+
+    worker->ops += 64;
+}
+
+
+static void *
+scratch_thread(void * arg)
+{
+    struct worker * worker = arg;
+
+    allocator->release(worker->ptr);
+    while (!stopped())
+        scratch_write(worker);
+
+    return NULL;
+}
+
+
+static void *
+thrash_thread(void * arg)
+{
+    struct worker * worker = arg;
+
+    while (!stopped())
+        scratch_write(worker);
+
+    return NULL;
+}
+
+/* churn */
+
+static void *
+churn_thread(void * arg)
+{
+    int i;
+    size_t size;
+    void * slots[CHURN_SLOTS];
+    struct worker * worker = arg;
+
+    memset(slots, 0, sizeof(slots));
+    while (!stopped()) {
+        for (i = 0 ; i < CHURN_SLOTS ; i++) {
+            allocator->release(slots[i]);
+            size = 16 + bench_rand(&worker->seed) % (CHURN_MAX_SIZE - 15);
+            slots[i] = allocator->alloc(size);
+            check(slots[i] != NULL);
+            *(char *) slots[i] = (char) i;
+        }
+
+        worker->ops += CHURN_SLOTS;
+    }
+
+    for (i = 0 ; i < CHURN_SLOTS ; i++)
+        allocator->release(slots[i]);
+
+    return NULL;
+}
+
+/* realloc */
+
+static void *
+realloc_thread(void * arg)
+{
+    size_t size;
+    char * buf;
+    struct worker * worker = arg;
+
+    while (!stopped()) {
+        buf = NULL;
+        for (size = 16 ; size <= REALLOC_MAX_SIZE ;
+             size += 16 + bench_rand(&worker->seed) % 64) {
+            buf = allocator->resize(buf, size);
+            check(buf != NULL);
+            buf[size - 1] = 'a';
+            worker->ops++;
+        }
+
+        allocator->release(buf);
+    }
+
+    return NULL;
+}
+
+static struct workload const workloads[] = {
+    {"xmalloc", xmalloc_thread, 1, xmalloc_setup, xmalloc_teardown},
+    {"larson", larson_thread, 0, larson_setup, larson_teardown},
+    {"cache-scratch", scratch_thread, 0, scratch_setup, NULL},
+    {"cache-thrash", thrash_thread, 0, NULL, NULL},
+    {"churn", churn_thread, 0, NULL, NULL},
+    {"realloc", realloc_thread, 0, NULL, NULL},
+};
+
+/* resident set size peak since the last reset, in kB */
+static long
+peak_rss_kb(void)
+{
+    long kb;
+    char line[128];
+    FILE * f;
+
+    kb = 0;
+    f = fopen("/proc/self/status", "r");
+    if (f == NULL)
+        return 0;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "VmHWM: %ld", &kb) == 1)
+            break;
+    }
+
+    fclose(f);
+
+    return kb;
+}
+
+
+static void
+reset_peak_rss(void)
+{
+    FILE * f;
+
+    f = fopen("/proc/self/clear_refs", "w");
+    if (f == NULL)
+        return;
+
+    fputs("5", f);
+    fclose(f);
+}
+
+
+static double
+elapsed(struct timespec const * t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double) (t1.tv_sec - t0->tv_sec)
+           + (double) (t1.tv_nsec - t0->tv_nsec) * 1e-9;
+}
+
+
+static void
+run(struct workload const * workload, int num_threads, struct result * result)
+{
+    int i;
+    struct timespec t0;
+
+    if (workload->pairs)
+        num_threads *= 2;
+
+    check(num_threads <= MAX_THREADS);
+
+    if (allocator->setup != NULL)
+        allocator->setup();
+
+    memset(workers, 0, sizeof(workers));
+    for (i = 0 ; i < num_threads ; i++) {
+        workers[i].id = (unsigned int) i;
+        workers[i].seed = 88172645463325252ULL + (uint64_t) i;
+    }
+
+    if (workload->setup != NULL)
+        workload->setup(num_threads);
+
+    reset_peak_rss();
+    __atomic_store_n(&stop, 0, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0 ; i < num_threads ; i++)
+        check(pthread_create(&workers[i].thread, NULL, workload->run,
+                &workers[i]) == 0);
+
+    usleep((useconds_t) (duration * 1e6));
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    if (workload->pairs)
+        xmalloc_wake();
+
+    result->ops = 0;
+    for (i = 0 ; i < num_threads ; i++) {
+        check(pthread_join(workers[i].thread, NULL) == 0);
+        result->ops += workers[i].ops;
+    }
+
+    result->seconds = elapsed(&t0);
+    result->peak_rss_mb = (double) peak_rss_kb() / 1024;
+    result->workload = workload->name;
+    result->allocator = allocator->name;
+    result->num_threads = num_threads;
+
+    if (workload->teardown != NULL)
+        workload->teardown(num_threads);
+
+    if (allocator->teardown != NULL)
+        allocator->teardown();
+}
+
+
+static void
+print_csv(void)
+{
+    int i;
+    struct result * r;
+
+    printf("workload, allocator, threads, seconds, ops, Mops/sec, "
+           "peak RSS (MB), speedup\n");
+    for (i = 0 ; i < num_results ; i++) {
+        r = &results[i];
+        printf("%s, %s, %d, %.3f, %ld, %.3f, %.1f, %.2f\n", r->workload,
+                r->allocator, r->num_threads, r->seconds, r->ops,
+                (double) r->ops / r->seconds * 1e-6, r->peak_rss_mb,
+                r->speedup);
+    }
+}
+
+
+static void
+print_json(void)
+{
+    int i;
+    struct result * r;
+
+    printf("[\n");
+    for (i = 0 ; i < num_results ; i++) {
+        r = &results[i];
+        printf("  {\"workload\": \"%s\", \"allocator\": \"%s\", "
+               "\"threads\": %d, \"seconds\": %.3f, \"ops\": %ld, "
+               "\"ops_per_sec\": %.0f, \"peak_rss_mb\": %.1f, "
+               "\"speedup\": %.2f}%s\n", r->workload, r->allocator,
+                r->num_threads, r->seconds, r->ops,
+                (double) r->ops / r->seconds, r->peak_rss_mb, r->speedup,
+                i + 1 < num_results ? "," : "");
+    }
+
+    printf("]\n");
+}
+
+
+/* whether name is in the comma separated list, all names match NULL */
+static int
+selected(char const * list, char const * name)
+{
+    size_t len;
+    char const * end;
+
+    if (list == NULL)
+        return 1;
+
+    for ( ; list != NULL ; list = end != NULL ? end + 1 : NULL) {
+        end = strchr(list, ',');
+        len = end != NULL ? (size_t) (end - list) : strlen(list);
+        if (len == strlen(name) && strncmp(list, name, len) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+static void
+usage(char const * prog)
+{
+    size_t i;
+
+    fprintf(stderr, "%s [-w workloads] [-a allocators] [-t threads] "
+            "[-d seconds] [-j]\n", prog);
+    fprintf(stderr, "\t-w comma separated workloads, all by default:");
+    for (i = 0 ; i < arraylen(workloads) ; i++)
+        fprintf(stderr, " %s", workloads[i].name);
+
+    fprintf(stderr, "\n\t-a comma separated allocators among mpool, glibc "
+            "and system (the LD_PRELOADed one), the first two by default, "
+            "and system when LD_PRELOAD is set\n");
+    fprintf(stderr, "\t-t comma separated thread counts, powers of two up "
+            "to the number of CPUs by default (producer and consumer pairs "
+            "for xmalloc)\n");
+    fprintf(stderr, "\t-d seconds per run, default %.2f\n", duration);
+    fprintf(stderr, "\t-j JSON output instead of CSV\n");
+    exit(EXIT_FAILURE);
+}
+
+
+int
+main(int argc, char ** argv)
+{
+    int c, i, json, num_counts, first;
+    int counts[16];
+    long num_cpus;
+    size_t w, a;
+    char * list, * end;
+    char const * workload_list, * allocator_list;
+
+    workload_list = NULL;
+    allocator_list = getenv("LD_PRELOAD") != NULL ? NULL : "mpool,glibc";
+    json = 0;
+    num_counts = 0;
+    while ((c = getopt(argc, argv, "w:a:t:d:j")) != -1) {
+        switch (c) {
+        case 'w':
+            workload_list = optarg;
+            break;
+        case 'a':
+            allocator_list = optarg;
+            break;
+        case 't':
+            for (list = optarg ; num_counts < (int) arraylen(counts) ; ) {
+                counts[num_counts] = (int) strtol(list, &end, 10);
+                if (counts[num_counts] <= 0 || counts[num_counts] > 128)
+                    usage(argv[0]);
+
+                num_counts++;
+                if (*end != ',')
+                    break;
+
+                list = end + 1;
+            }
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 'j':
+            json = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (num_counts == 0) {
+        num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        for (i = 1 ; i <= MAX(num_cpus, 2) && i <= 128 ; i *= 2)
+            counts[num_counts++] = i;
+    }
+
+    for (w = 0 ; w < arraylen(workloads) ; w++) {
+        if (!selected(workload_list, workloads[w].name))
+            continue;
+
+        for (a = 0 ; a < arraylen(allocators) ; a++) {
+            if (!selected(allocator_list, allocators[a].name))
+                continue;
+
+            allocator = &allocators[a];
+            first = num_results;
+            for (i = 0 ; i < num_counts ; i++) {
+                check(num_results < MAX_RUNS);
+                run(&workloads[w], counts[i], &results[num_results]);
+                results[num_results].speedup =
+                        ((double) results[num_results].ops
+                         / results[num_results].seconds)
+                        / ((double) results[first].ops
+                           / results[first].seconds);
+                num_results++;
+            }
+        }
+    }
+
+    if (json)
+        print_json();
+    else
+        print_csv();
+
+    return 0;
+}
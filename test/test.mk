@@ -6,7 +6,7 @@ ALL_TEST_OBJECTS = $(TEST_OBJECTS_MPOOL)
 
 .INTERMEDIATE: $(TEST_OBJECTS_MPOOL)
 test_mpool: $(TEST_OBJECTS_MPOOL) $(TEST_HEADERS) $(TARGET)
-	$(CC) $(CFLAGS) $(LDFLAGS) -L. -lmpool -o $@ $<
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
 
 TEST_SOURCES_MTHREAD_MPOOL = test/test_mthread_mpool.c
 TEST_OBJECTS_MTHREAD_MPOOL = $(TEST_SOURCES_MTHREAD_MPOOL:.c=.o)
@@ -14,15 +14,164 @@ ALL_TEST_OBJECTS += $(TEST_OBJECTS_MTHREAD_MPOOL)
 
 .INTERMEDIATE: $(TEST_OBJECTS_MTHREAD_MPOOL)
 test_mthread_mpool: $(TEST_OBJECTS_MTHREAD_MPOOL) $(TEST_HEADERS) $(TARGET)
-	$(CC) $(CFLAGS) $(LDFLAGS) -L. -lmpool -lpthread -o $@ $<
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool -lpthread
 
-TEST_SOURCES_MPOOL_OVERLOAD = test/test_mpool_overload.c
-TEST_OBJECTS_MPOOL_OVERLOAD = $(TEST_SOURCES_MPOOL_OVERLOAD:.c=.o)
-ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_OVERLOAD)
+TEST_SOURCES_MPOOL_CTX = test/test_mpool_ctx.c
+TEST_OBJECTS_MPOOL_CTX = $(TEST_SOURCES_MPOOL_CTX:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_CTX)
 
-.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_OVERLOAD)
-test_mpool_overload.so: $(OBJECTS) $(TEST_OBJECTS_MPOOL_OVERLOAD)
-	$(CC) -shared -fPIC $(CFLAGS) -ldl $(LDFLAGS) -o $@ $^
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_CTX)
+test_mpool_ctx: $(TEST_OBJECTS_MPOOL_CTX) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
+
+TEST_SOURCES_MPOOL_LARGE = test/test_mpool_large.c
+TEST_OBJECTS_MPOOL_LARGE = $(TEST_SOURCES_MPOOL_LARGE:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_LARGE)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_LARGE)
+test_mpool_large: $(TEST_OBJECTS_MPOOL_LARGE) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
+
+TEST_SOURCES_MPOOL_GROW = test/test_mpool_grow.c
+TEST_OBJECTS_MPOOL_GROW = $(TEST_SOURCES_MPOOL_GROW:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_GROW)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_GROW)
+test_mpool_grow: $(TEST_OBJECTS_MPOOL_GROW) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
+
+TEST_SOURCES_MPOOL_CACHE = test/test_mpool_cache.c
+TEST_OBJECTS_MPOOL_CACHE = $(TEST_SOURCES_MPOOL_CACHE:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_CACHE)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_CACHE)
+test_mpool_cache: $(TEST_OBJECTS_MPOOL_CACHE) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool -lpthread
+
+TEST_SOURCES_MPOOL_THREAD_EXIT = test/test_mpool_thread_exit.c
+TEST_OBJECTS_MPOOL_THREAD_EXIT = $(TEST_SOURCES_MPOOL_THREAD_EXIT:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_THREAD_EXIT)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_THREAD_EXIT)
+test_mpool_thread_exit: $(TEST_OBJECTS_MPOOL_THREAD_EXIT) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool -lpthread
+
+TEST_SOURCES_MPOOL_CLASSES = test/test_mpool_classes.c
+TEST_OBJECTS_MPOOL_CLASSES = $(TEST_SOURCES_MPOOL_CLASSES:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_CLASSES)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_CLASSES)
+test_mpool_classes: $(TEST_OBJECTS_MPOOL_CLASSES) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
+
+TEST_SOURCES_MPOOL_FREE_PTR = test/test_mpool_free_ptr.c
+TEST_OBJECTS_MPOOL_FREE_PTR = $(TEST_SOURCES_MPOOL_FREE_PTR:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_FREE_PTR)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_FREE_PTR)
+test_mpool_free_ptr: $(TEST_OBJECTS_MPOOL_FREE_PTR) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
+
+TEST_SOURCES_MPOOL_BULK = test/test_mpool_bulk.c
+TEST_OBJECTS_MPOOL_BULK = $(TEST_SOURCES_MPOOL_BULK:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_BULK)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_BULK)
+test_mpool_bulk: $(TEST_OBJECTS_MPOOL_BULK) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
+
+TEST_SOURCES_MPOOL_NUMA = test/test_mpool_numa.c
+TEST_OBJECTS_MPOOL_NUMA = $(TEST_SOURCES_MPOOL_NUMA:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_NUMA)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_NUMA)
+test_mpool_numa: $(TEST_OBJECTS_MPOOL_NUMA) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool -lpthread
+
+TEST_SOURCES_MPOOL_MAP = test/test_mpool_map.c
+TEST_OBJECTS_MPOOL_MAP = $(TEST_SOURCES_MPOOL_MAP:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_MAP)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_MAP)
+test_mpool_map: $(TEST_OBJECTS_MPOOL_MAP) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
+
+TEST_SOURCES_MPOOL_PERCPU = test/test_mpool_percpu.c
+TEST_OBJECTS_MPOOL_PERCPU = $(TEST_SOURCES_MPOOL_PERCPU:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_PERCPU)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_PERCPU)
+test_mpool_percpu: $(TEST_OBJECTS_MPOOL_PERCPU) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool -lpthread
+
+TEST_SOURCES_MPOOL_REMOTE = test/test_mpool_remote.c
+TEST_OBJECTS_MPOOL_REMOTE = $(TEST_SOURCES_MPOOL_REMOTE:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_REMOTE)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_REMOTE)
+test_mpool_remote: $(TEST_OBJECTS_MPOOL_REMOTE) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool -lpthread
+
+TEST_SOURCES_MPOOL_PURGE = test/test_mpool_purge.c
+TEST_OBJECTS_MPOOL_PURGE = $(TEST_SOURCES_MPOOL_PURGE:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_PURGE)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_PURGE)
+test_mpool_purge: $(TEST_OBJECTS_MPOOL_PURGE) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool -lpthread
+
+TEST_SOURCES_MPOOL_STATS = test/test_mpool_stats.c
+TEST_OBJECTS_MPOOL_STATS = $(TEST_SOURCES_MPOOL_STATS:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_STATS)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_STATS)
+test_mpool_stats: $(TEST_OBJECTS_MPOOL_STATS) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool -lpthread
+
+TEST_SOURCES_MPOOL_ALIGNED = test/test_mpool_aligned.c
+TEST_OBJECTS_MPOOL_ALIGNED = $(TEST_SOURCES_MPOOL_ALIGNED:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_ALIGNED)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_ALIGNED)
+test_mpool_aligned: $(TEST_OBJECTS_MPOOL_ALIGNED) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
+
+TEST_SOURCES_MPOOL_FORK = test/test_mpool_fork.c
+TEST_OBJECTS_MPOOL_FORK = $(TEST_SOURCES_MPOOL_FORK:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_FORK)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_FORK)
+test_mpool_fork: $(TEST_OBJECTS_MPOOL_FORK) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool -lpthread
+
+TEST_SOURCES_MPOOL_OBJCACHE = test/test_mpool_objcache.c
+TEST_OBJECTS_MPOOL_OBJCACHE = $(TEST_SOURCES_MPOOL_OBJCACHE:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_OBJCACHE)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_OBJCACHE)
+test_mpool_objcache: $(TEST_OBJECTS_MPOOL_OBJCACHE) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool -lpthread
+
+TEST_SOURCES_MPOOL_LATENCY = test/test_mpool_latency.c
+TEST_OBJECTS_MPOOL_LATENCY = $(TEST_SOURCES_MPOOL_LATENCY:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_LATENCY)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_LATENCY)
+test_mpool_latency: $(TEST_OBJECTS_MPOOL_LATENCY) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool -lpthread
+
+TEST_SOURCES_MPOOL_INLINE = test/test_mpool_inline.c
+TEST_OBJECTS_MPOOL_INLINE = $(TEST_SOURCES_MPOOL_INLINE:.c=.o)
+ALL_TEST_OBJECTS += $(TEST_OBJECTS_MPOOL_INLINE)
+
+.INTERMEDIATE: $(TEST_OBJECTS_MPOOL_INLINE)
+test_mpool_inline: $(TEST_OBJECTS_MPOOL_INLINE) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool -lpthread
+
+TEST_SOURCES_MPOOL_HPP = test/test_mpool_hpp.cpp
+
+test_mpool_hpp: $(TEST_SOURCES_MPOOL_HPP) $(TEST_HEADERS) $(HEADERS) $(TARGET)
+	$(CXX) $(CXXFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
 
 TEST_SOURCES_SYSTEM_ALLOCS = test/test_system_allocs.c
 TEST_OBJECTS_SYSTEM_ALLOCS = $(TEST_SOURCES_SYSTEM_ALLOCS:.c=.o)
@@ -30,18 +179,123 @@ ALL_TEST_OBJECTS += $(TEST_OBJECTS_SYSTEM_ALLOCS)
 
 .INTERMEDIATE: $(TEST_OBJECTS_SYSTEM_ALLOCS)
 test_system_allocs: $(TEST_OBJECTS_SYSTEM_ALLOCS) $(TEST_HEADERS)
-	$(CC) $(CFLAGS) $(LDFLAGS) -o $@ $<
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -lpthread
+
+# both flavours of the pool free list are statically built in the benchmark,
+# so that they are compared on equal terms
+BENCH_SOURCES_CONTENTION = test/bench_contention.c
+
+bench_contention: $(BENCH_SOURCES_CONTENTION) $(SOURCES) $(HEADERS) $(TEST_HEADERS)
+	$(CC) $(CPPFLAGS) $(CFLAGS) -o $@ \
+		$(BENCH_SOURCES_CONTENTION) $(SOURCES) $(LDFLAGS) -lpthread
+
+bench_contention_mutex: $(BENCH_SOURCES_CONTENTION) $(SOURCES) $(HEADERS) $(TEST_HEADERS)
+	$(CC) $(CPPFLAGS) -DMPOOL_CENTRAL_LOCK $(CFLAGS) -o $@ \
+		$(BENCH_SOURCES_CONTENTION) $(SOURCES) $(LDFLAGS) -lpthread
+
+BENCH_SOURCES_WASTE = test/bench_waste.c
+BENCH_OBJECTS_WASTE = $(BENCH_SOURCES_WASTE:.c=.o)
+ALL_TEST_OBJECTS += $(BENCH_OBJECTS_WASTE)
+
+.INTERMEDIATE: $(BENCH_OBJECTS_WASTE)
+bench_waste: $(BENCH_OBJECTS_WASTE) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
+
+BENCH_SOURCES_BULK = test/bench_bulk.c
+BENCH_OBJECTS_BULK = $(BENCH_SOURCES_BULK:.c=.o)
+ALL_TEST_OBJECTS += $(BENCH_OBJECTS_BULK)
+
+.INTERMEDIATE: $(BENCH_OBJECTS_BULK)
+bench_bulk: $(BENCH_OBJECTS_BULK) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
+
+BENCH_SOURCES_ARENA_MAP = test/bench_arena_map.c
+BENCH_OBJECTS_ARENA_MAP = $(BENCH_SOURCES_ARENA_MAP:.c=.o)
+ALL_TEST_OBJECTS += $(BENCH_OBJECTS_ARENA_MAP)
+
+.INTERMEDIATE: $(BENCH_OBJECTS_ARENA_MAP)
+bench_arena_map: $(BENCH_OBJECTS_ARENA_MAP) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
+
+BENCH_SOURCES_RSS = test/bench_rss.c
+BENCH_OBJECTS_RSS = $(BENCH_SOURCES_RSS:.c=.o)
+ALL_TEST_OBJECTS += $(BENCH_OBJECTS_RSS)
+
+.INTERMEDIATE: $(BENCH_OBJECTS_RSS)
+bench_rss: $(BENCH_OBJECTS_RSS) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
+
+BENCH_SOURCES_CONTAINERS = test/bench_containers.cpp
+
+bench_containers: $(BENCH_SOURCES_CONTAINERS) $(TEST_HEADERS) $(HEADERS) \
+		$(TARGET)
+	$(CXX) $(CXXFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
+
+BENCH_SOURCES_WORKLOADS = test/bench_workloads.c
+BENCH_OBJECTS_WORKLOADS = $(BENCH_SOURCES_WORKLOADS:.c=.o)
+ALL_TEST_OBJECTS += $(BENCH_OBJECTS_WORKLOADS)
+
+.INTERMEDIATE: $(BENCH_OBJECTS_WORKLOADS)
+bench_workloads: $(BENCH_OBJECTS_WORKLOADS) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool -lpthread
+
+BENCH_SOURCES_LATENCY = test/bench_latency.c
+BENCH_OBJECTS_LATENCY = $(BENCH_SOURCES_LATENCY:.c=.o)
+ALL_TEST_OBJECTS += $(BENCH_OBJECTS_LATENCY)
+
+.INTERMEDIATE: $(BENCH_OBJECTS_LATENCY)
+bench_latency: $(BENCH_OBJECTS_LATENCY) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool -lpthread
+
+BENCH_SOURCES_INLINE = test/bench_inline.c
+BENCH_OBJECTS_INLINE = $(BENCH_SOURCES_INLINE:.c=.o)
+ALL_TEST_OBJECTS += $(BENCH_OBJECTS_INLINE)
+
+.INTERMEDIATE: $(BENCH_OBJECTS_INLINE)
+bench_inline: $(BENCH_OBJECTS_INLINE) $(TEST_HEADERS) $(TARGET)
+	$(CC) $(CFLAGS) -o $@ $< $(LDFLAGS) -L. -lmpool
 
 ALL_TESTS = \
 	test_mpool \
-	test_mthread_mpool
+	test_mthread_mpool \
+	test_mpool_ctx \
+	test_mpool_large \
+	test_mpool_grow \
+	test_mpool_cache \
+	test_mpool_thread_exit \
+	test_mpool_classes \
+	test_mpool_free_ptr \
+	test_mpool_bulk \
+	test_mpool_numa \
+	test_mpool_map \
+	test_mpool_percpu \
+	test_mpool_remote \
+	test_mpool_purge \
+	test_mpool_stats \
+	test_mpool_aligned \
+	test_mpool_fork \
+	test_mpool_hpp \
+	test_mpool_objcache \
+	test_mpool_latency \
+	test_mpool_inline
 
-TEST_MPOOL_OVERLOAD = test_mpool_overload.so
 TEST_SYSTEM_ALLOCS = test_system_allocs
 
+ALL_BENCHS = \
+	bench_contention \
+	bench_contention_mutex \
+	bench_waste \
+	bench_bulk \
+	bench_arena_map \
+	bench_rss \
+	bench_containers \
+	bench_workloads \
+	bench_latency \
+	bench_inline
+
 .PHONY: test_clean
 test_clean:
 	-@rm -vf $(ALL_TESTS)
 	-@rm -vf $(ALL_TEST_OBJECTS)
-	-@rm -vf $(TEST_MPOOL_OVERLOAD)
 	-@rm -vf $(TEST_SYSTEM_ALLOCS)
+	-@rm -vf $(ALL_BENCHS)
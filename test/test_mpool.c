@@ -56,7 +56,8 @@ main(void)
     for (i = 0 ; i < 100 ; i++)
         check(mpool_alloc(42, 0) != NULL);
 
-    /* should print 100 elems used in the 1st pool, 10 in all the others */
+    /* should print more than 100 elems used in the 1st pool, a cache batch in
+     * all the others */
     mpool_stats();
     printf("\n");
 
@@ -0,0 +1,97 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define ARENA_SIZE (1 << 24)
+#define RESERVE_SIZE (1UL << 30)
+#define NUM_ALLOCS 64
+#define MAX_ALIGNMENT (1 << 16)
+
+static void * ptrs[NUM_ALLOCS];
+static size_t const sizes[] = {0, 1, 24, 100, 1000, 3000, 5000, 40000};
+
+static void
+check_aligned(struct mpool_ctx * ctx, size_t alignment, size_t size)
+{
+    size_t i;
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        ptrs[i] = mpool_ctx_aligned_alloc(ctx, alignment, size);
+        check(ptrs[i] != NULL);
+        check(((uintptr_t) ptrs[i] & (alignment - 1)) == 0);
+        check(mpool_ctx_usable_size(ctx, ptrs[i]) >= size);
+        memset(ptrs[i], 'a', size);
+    }
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++)
+        mpool_ctx_free_ptr(ctx, ptrs[i]);
+}
+
+
+static void
+check_ctx(struct mpool_ctx * ctx)
+{
+    size_t i, alignment;
+    void * ptr;
+
+    /* not a power of two */
+    check(mpool_ctx_aligned_alloc(ctx, 0, 64) == NULL);
+    check(mpool_ctx_aligned_alloc(ctx, 24, 64) == NULL);
+
+    for (alignment = 1 ; alignment <= MAX_ALIGNMENT ; alignment *= 2) {
+        for (i = 0 ; i < arraylen(sizes) ; i++)
+            check_aligned(ctx, alignment, sizes[i]);
+    }
+
+    /* from the power of two size class fitting both */
+    ptr = mpool_ctx_aligned_alloc(ctx, 64, 100);
+    check(ptr != NULL);
+    check(mpool_ctx_usable_size(ctx, ptr) == 128);
+    mpool_ctx_free_ptr(ctx, ptr);
+
+    ptr = mpool_ctx_aligned_alloc(ctx, 256, 24);
+    check(ptr != NULL);
+    check(mpool_ctx_usable_size(ctx, ptr) == 256);
+    mpool_ctx_free_ptr(ctx, ptr);
+}
+
+
+int
+main(void)
+{
+    void * arena;
+    struct mpool_ctx * ctx;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 1};
+
+    arena = mmap(NULL, ARENA_SIZE,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE,
+            -1, 0);
+    check(arena != MAP_FAILED);
+
+    /* an arena which size classes are not aligned */
+    ctx = mpool_ctx_create((uint8_t *) arena + 16, ARENA_SIZE - 16, weights,
+            arraylen(weights), 0);
+    check(ctx != NULL);
+    check_ctx(ctx);
+    mpool_ctx_stats(ctx);
+    mpool_ctx_destroy(ctx);
+    munmap(arena, ARENA_SIZE);
+
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(ctx != NULL);
+    check_ctx(ctx);
+
+    /* bigger than the segments */
+    check_aligned(ctx, 1 << 22, 100);
+    mpool_ctx_destroy(ctx);
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define ARENA_SIZE (1 << 20)
+#define NUM_CHUNKS (ARENA_SIZE / 64)
+#define BULK 256
+
+static void * ptrs[NUM_CHUNKS + 1];
+
+static int
+cmp_ptr(void const * a, void const * b)
+{
+    uintptr_t pa = *(uintptr_t const *) a;
+    uintptr_t pb = *(uintptr_t const *) b;
+
+    return (pa > pb) - (pa < pb);
+}
+
+
+int
+main(void)
+{
+    int rv, stats_rv;
+    size_t i, n;
+    void * arena;
+    struct mpool_ctx * ctx;
+    struct mpool_stats before, after;
+    unsigned int weights[] = {1};
+    unsigned int large_weights[] = {1, 1, 1, 1, 1, 1, 1, 4};
+
+    arena = mmap(NULL, ARENA_SIZE,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_SHARED,
+            -1, 0);
+    check(arena != MAP_FAILED);
+
+    ctx = mpool_ctx_create(arena, ARENA_SIZE, weights, arraylen(weights), 0);
+    check(ctx != NULL);
+
+    /* bursts of every size up to several batches */
+    for (n = 0 ; n <= BULK ; n++) {
+        rv = mpool_ctx_alloc_bulk(ctx, 64, (unsigned int) n, ptrs);
+        check(rv == 0);
+        for (i = 0 ; i < n ; i++) {
+            check(ptrs[i] != NULL);
+            memset(ptrs[i], 'a', 64);
+        }
+
+        qsort(ptrs, n, sizeof(*ptrs), cmp_ptr);
+        for (i = 1 ; i < n ; i++)
+            check(ptrs[i - 1] != ptrs[i]);
+
+        mpool_ctx_free_bulk(ctx, 64, (unsigned int) n, ptrs);
+    }
+
+    /* all or nothing, a failed call counts neither allocations nor frees */
+    stats_rv = mpool_ctx_stats_get(ctx, &before);
+    rv = mpool_ctx_alloc_bulk(ctx, 64, NUM_CHUNKS + 1, ptrs);
+    check(rv == ENOMEM);
+    if (stats_rv == 0) {
+        check(mpool_ctx_stats_get(ctx, &after) == 0);
+        check(after.classes[0].allocs == before.classes[0].allocs);
+        check(after.classes[0].frees == before.classes[0].frees);
+    }
+
+    rv = mpool_ctx_alloc_bulk(ctx, 64, NUM_CHUNKS, ptrs);
+    check(rv == 0);
+    check(mpool_ctx_alloc(ctx, 64, 0) == NULL);
+
+    /* bulk and single object calls mix */
+    for (i = 0 ; i < NUM_CHUNKS ; i += 2)
+        mpool_ctx_free(ctx, ptrs[i], 64);
+
+    for (i = 1 ; i < NUM_CHUNKS ; i += 2)
+        ptrs[i / 2] = ptrs[i];
+
+    mpool_ctx_free_bulk(ctx, 64, NUM_CHUNKS / 2, ptrs);
+    rv = mpool_ctx_alloc_bulk(ctx, 64, NUM_CHUNKS, ptrs);
+    check(rv == 0);
+    mpool_ctx_free_bulk(ctx, 64, NUM_CHUNKS, ptrs);
+
+    mpool_ctx_stats(ctx);
+    mpool_ctx_destroy(ctx);
+
+    /* runs of pages go one by one */
+    rv = mpool_create(arena, ARENA_SIZE, large_weights,
+            arraylen(large_weights));
+    check(rv == 0);
+
+    rv = mpool_alloc_bulk(2 * PAGE_SIZE, 8, ptrs);
+    check(rv == 0);
+    for (i = 0 ; i < 8 ; i++)
+        memset(ptrs[i], 'b', 2 * PAGE_SIZE);
+
+    mpool_free_bulk(2 * PAGE_SIZE, 8, ptrs);
+
+    rv = mpool_alloc_bulk(ARENA_SIZE, 1, ptrs);
+    check(rv == ENOMEM);
+
+    mpool_stats();
+    mpool_destroy();
+    munmap(arena, ARENA_SIZE);
+
+    return 0;
+}
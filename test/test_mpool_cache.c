@@ -0,0 +1,107 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define ARENA_SIZE (1 << 22)
+#define NUM_ALLOCS 4096
+
+static void * ptrs[NUM_ALLOCS];
+
+static void *
+other_thread(void * arg)
+{
+    struct mpool_ctx * ctx = arg;
+    struct mpool_cache_info info;
+
+    /* the caches of a thread do not grow with the ones of another */
+    check(mpool_ctx_cache_info(ctx, 64, &info) == 0);
+    check(info.num_free == 0);
+
+    return (void *) (uintptr_t) info.batch;
+}
+
+
+int
+main(void)
+{
+    size_t i;
+    void * arena;
+    void * rv;
+    pthread_t thread;
+    unsigned int min_batch, max_batch;
+    struct mpool_ctx * ctx;
+    struct mpool_cache_info info;
+    unsigned int weights[] = {1};
+
+    arena = mmap(NULL, ARENA_SIZE,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_SHARED,
+            -1, 0);
+    check(arena != MAP_FAILED);
+
+    ctx = mpool_ctx_create(arena, ARENA_SIZE, weights, arraylen(weights), 0);
+    check(ctx != NULL);
+
+    /* only the size classes have thread caches */
+    check(mpool_ctx_cache_info(ctx, 128, &info) == EINVAL);
+    check(mpool_ctx_cache_info(ctx, 2 * PAGE_SIZE, &info) == EINVAL);
+
+    check(mpool_ctx_cache_info(ctx, 42, &info) == 0);
+    check(info.elem_size == 64);
+    check(info.num_free == 0);
+    check(info.size == 0);
+    min_batch = info.batch;
+    check(min_batch > 0);
+
+    /* a thread which keeps refilling gets bigger batches */
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        ptrs[i] = mpool_ctx_alloc(ctx, 64, 0);
+        check(ptrs[i] != NULL);
+    }
+
+    check(mpool_ctx_cache_info(ctx, 64, &info) == 0);
+    max_batch = info.batch;
+    check(max_batch > min_batch);
+    check(info.size == 2 * (max_batch - min_batch) * 64);
+
+    check(pthread_create(&thread, NULL, other_thread, ctx) == 0);
+    check(pthread_join(thread, &rv) == 0);
+    check((uintptr_t) rv == min_batch);
+
+    mpool_ctx_stats(ctx);
+
+    /* and shrinks back to its minimum as it keeps flushing */
+    for (i = 0 ; i < NUM_ALLOCS ; i++)
+        mpool_ctx_free(ctx, ptrs[i], 64);
+
+    check(mpool_ctx_cache_info(ctx, 64, &info) == 0);
+    check(info.batch == min_batch);
+    check(info.num_free <= 2 * min_batch);
+    check(info.size == 0);
+
+    /* the growth of the caches is capped */
+    mpool_ctx_set_cache_limit(ctx, 2 * (max_batch / 2 - min_batch) * 64);
+    for (i = 0 ; i < NUM_ALLOCS ; i++)
+        ptrs[i] = mpool_ctx_alloc(ctx, 64, 0);
+
+    check(mpool_ctx_cache_info(ctx, 64, &info) == 0);
+    check(info.batch < max_batch);
+    check(info.size <= info.limit);
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++)
+        mpool_ctx_free(ctx, ptrs[i], 64);
+
+    mpool_ctx_stats(ctx);
+    mpool_ctx_destroy(ctx);
+    munmap(arena, ARENA_SIZE);
+
+    return 0;
+}
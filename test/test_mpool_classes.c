@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define ARENA_SIZE (1 << 22)
+
+static void
+check_classes(struct mpool_ctx * ctx, int pow2)
+{
+    size_t size, chunk_size, prev;
+    uint8_t * ptr, * next;
+
+    prev = 0;
+    for (size = 1 ; size <= PAGE_SIZE ; size++) {
+        chunk_size = mpool_ctx_alloc_size(ctx, size);
+        check(chunk_size >= size);
+        check(chunk_size >= prev);
+        check((chunk_size & 15) == 0);
+        if (pow2) {
+            check((chunk_size & (chunk_size - 1)) == 0);
+        } else if (size > CACHELINE_SIZE) {
+            check(chunk_size - size < chunk_size / 4);
+        }
+
+        /* two chunks of a class do not overlap */
+        ptr = mpool_ctx_alloc(ctx, size, 0);
+        next = mpool_ctx_alloc(ctx, size, 0);
+        check(ptr != NULL && next != NULL);
+        memset(ptr, 'a', size);
+        memset(next, 'b', size);
+        check(ptr[size - 1] == 'a');
+        mpool_ctx_free(ctx, next, size);
+        mpool_ctx_free(ctx, ptr, size);
+
+        prev = chunk_size;
+    }
+
+    check(mpool_ctx_alloc_size(ctx, PAGE_SIZE + 1) == 2 * PAGE_SIZE);
+}
+
+
+int
+main(void)
+{
+    size_t i;
+    void * arena;
+    void * tiny[CACHELINE_SIZE / 16];
+    struct mpool_ctx * ctx;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1};
+
+    arena = mmap(NULL, ARENA_SIZE,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_SHARED,
+            -1, 0);
+    check(arena != MAP_FAILED);
+
+    /* four size classes per doubling */
+    ctx = mpool_ctx_create(arena, ARENA_SIZE, weights, arraylen(weights), 0);
+    check(ctx != NULL);
+
+    check(mpool_ctx_alloc_size(ctx, 0) == CACHELINE_SIZE);
+    check(mpool_ctx_alloc_size(ctx, 65) == 80);
+    check(mpool_ctx_alloc_size(ctx, 2100) == 2560);
+    check_classes(ctx, 0);
+
+    mpool_ctx_stats(ctx);
+    mpool_ctx_destroy(ctx);
+
+    /* a single one */
+    ctx = mpool_ctx_create(arena, ARENA_SIZE, weights, arraylen(weights),
+            MPOOL_POW2_CLASSES);
+    check(ctx != NULL);
+
+    check(mpool_ctx_alloc_size(ctx, 65) == 128);
+    check(mpool_ctx_alloc_size(ctx, 2100) == 4096);
+    check_classes(ctx, 1);
+
+    mpool_ctx_stats(ctx);
+    mpool_ctx_destroy(ctx);
+
+    /* and tiny ones */
+    ctx = mpool_ctx_create(arena, ARENA_SIZE, weights, arraylen(weights),
+            MPOOL_TINY_CLASSES);
+    check(ctx != NULL);
+
+    check(mpool_ctx_alloc_size(ctx, 1) == 16);
+    check(mpool_ctx_alloc_size(ctx, 8) == 16);
+    check(mpool_ctx_alloc_size(ctx, 24) == 32);
+    check(mpool_ctx_alloc_size(ctx, 48) == 48);
+    check(mpool_ctx_alloc_size(ctx, 49) == CACHELINE_SIZE);
+    check_classes(ctx, 0);
+
+    /* that share cachelines */
+    for (i = 0 ; i < arraylen(tiny) ; i++)
+        tiny[i] = mpool_ctx_alloc(ctx, 8, 0);
+
+    for (i = 1 ; i < arraylen(tiny) ; i++) {
+        check(tiny[i] != NULL);
+        check((uintptr_t) tiny[i - 1] + 16 == (uintptr_t) tiny[i]);
+    }
+
+    for (i = 0 ; i < arraylen(tiny) ; i++)
+        mpool_ctx_free(ctx, tiny[i], 8);
+
+    mpool_ctx_stats(ctx);
+    mpool_ctx_destroy(ctx);
+    munmap(arena, ARENA_SIZE);
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define NUM_CTX 3
+#define ARENA_SIZE (1 << 20)
+#define BIG_ARENA_SIZE (1UL << 30)
+
+static int
+in_arena(void const * ptr, void const * arena)
+{
+    return (uintptr_t) ptr >= (uintptr_t) arena
+           && (uintptr_t) ptr < (uintptr_t) arena + ARENA_SIZE;
+}
+
+static int
+in_big_arena(void const * ptr, void const * arena)
+{
+    return (uintptr_t) ptr >= (uintptr_t) arena
+           && (uintptr_t) ptr < (uintptr_t) arena + BIG_ARENA_SIZE;
+}
+
+static void *
+map_arena(void)
+{
+    void * arena;
+
+    arena = mmap(NULL, ARENA_SIZE,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_SHARED,
+            -1, 0);
+    check(arena != MAP_FAILED);
+
+    return arena;
+}
+
+static size_t
+resident_pages(void * addr, size_t size)
+{
+    size_t i, num;
+    unsigned char * vec;
+
+    vec = malloc(size / PAGE_SIZE);
+    check(vec != NULL);
+    check(mincore(addr, size, vec) == 0);
+
+    num = 0;
+    for (i = 0 ; i < size / PAGE_SIZE ; i++)
+        num += vec[i] & 1;
+
+    free(vec);
+
+    return num;
+}
+
+
+/* creating an instance does not touch its arena, chunks are carved from it as
+ * they are first needed */
+static void
+check_lazy(void)
+{
+    int i;
+    void * arena, * ptr[100];
+    struct mpool_ctx * ctx;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 1};
+
+    arena = mmap(NULL, BIG_ARENA_SIZE,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE,
+            -1, 0);
+    check(arena != MAP_FAILED);
+
+    ctx = mpool_ctx_create(arena, BIG_ARENA_SIZE, weights, arraylen(weights),
+            0);
+    check(ctx != NULL);
+    check(resident_pages(arena, BIG_ARENA_SIZE) <= 4);
+
+    for (i = 0 ; i < 100 ; i++) {
+        ptr[i] = mpool_ctx_alloc(ctx, 64, 0);
+        check(in_big_arena(ptr[i], arena));
+        memset(ptr[i], 'c', 64);
+    }
+
+    check(resident_pages(arena, BIG_ARENA_SIZE) <= 8);
+
+    for (i = 0 ; i < 100 ; i++)
+        mpool_ctx_free(ctx, ptr[i], 64);
+
+    mpool_ctx_destroy(ctx);
+    munmap(arena, BIG_ARENA_SIZE);
+}
+
+
+int
+main(void)
+{
+    int i, rv;
+    size_t size;
+    void * ptr;
+    void * arena[NUM_CTX];
+    void * default_arena;
+    struct mpool_ctx * ctx[NUM_CTX];
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1};
+    unsigned int small_weights[] = {1};
+
+    default_arena = map_arena();
+    rv = mpool_create(default_arena, ARENA_SIZE, weights, arraylen(weights));
+    check(rv == 0);
+
+    /* instances serve from their own arena */
+    for (i = 0 ; i < NUM_CTX ; i++) {
+        arena[i] = map_arena();
+        ctx[i] = mpool_ctx_create(arena[i], ARENA_SIZE, weights,
+                arraylen(weights), 0);
+        check(ctx[i] != NULL);
+    }
+
+    for (size = 1 ; size <= 4096 ; size <<= 1) {
+        for (i = 0 ; i < NUM_CTX ; i++) {
+            ptr = mpool_ctx_alloc(ctx[i], size, 0);
+            check(in_arena(ptr, arena[i]));
+            memset(ptr, 'a', size);
+            mpool_ctx_free(ctx[i], ptr, size);
+        }
+
+        ptr = mpool_alloc(size, 0);
+        check(in_arena(ptr, default_arena));
+        mpool_free(ptr, size);
+    }
+
+    ptr = mpool_ctx_realloc(ctx[0], NULL, 0, 42, 0);
+    check(in_arena(ptr, arena[0]));
+    ptr = mpool_ctx_realloc(ctx[0], ptr, 42, 1000, 0);
+    check(in_arena(ptr, arena[0]));
+    mpool_ctx_free(ctx[0], ptr, 1000);
+
+    /* a new instance reusing a destroyed one slot must not serve chunks left
+     * in the thread caches of the former one */
+    ptr = mpool_ctx_alloc(ctx[1], 64, 0);
+    check(ptr != NULL);
+    mpool_ctx_destroy(ctx[1]);
+    memset(arena[1], 0, ARENA_SIZE);
+
+    ctx[1] = mpool_ctx_create(arena[1], ARENA_SIZE, small_weights,
+            arraylen(small_weights), 0);
+    check(ctx[1] != NULL);
+    for (i = 0 ; i < 100 ; i++) {
+        ptr = mpool_ctx_alloc(ctx[1], 64, 0);
+        check(in_arena(ptr, arena[1]));
+        memset(ptr, 'b', 64);
+    }
+
+    /* only the size classes that got some weight are usable */
+    check(mpool_ctx_alloc(ctx[1], 128, 0) == NULL);
+
+    mpool_ctx_stats(ctx[1]);
+
+    for (i = 0 ; i < NUM_CTX ; i++) {
+        mpool_ctx_destroy(ctx[i]);
+        munmap(arena[i], ARENA_SIZE);
+    }
+
+    mpool_destroy();
+    munmap(default_arena, ARENA_SIZE);
+
+    check_lazy();
+
+    return 0;
+}
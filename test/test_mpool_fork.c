@@ -0,0 +1,181 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define RESERVE_SIZE (1UL << 30)
+#define NUM_THREADS 4
+#define NUM_FORKS 50
+#define NUM_ALLOCS 256
+#define CHUNK_SIZE 64
+#define CHILD_TIMEOUT 10 /* seconds before a child is taken as deadlocked */
+
+static struct mpool_ctx * ctxs[2];
+static int stop;
+
+static size_t const sizes[] = {16, 64, 200, 1000, 4000, 3 * PAGE_SIZE};
+
+static void
+alloc_free(struct mpool_ctx * ctx, unsigned int seed)
+{
+    size_t i, size;
+    void * ptrs[NUM_ALLOCS];
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        size = sizes[(seed + i) % arraylen(sizes)];
+        ptrs[i] = mpool_ctx_alloc(ctx, size, 0);
+        check(ptrs[i] != NULL);
+        memset(ptrs[i], 'a', size);
+    }
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++)
+        mpool_ctx_free_ptr(ctx, ptrs[i]);
+}
+
+
+static void *
+worker_thread(void * arg)
+{
+    unsigned int seed;
+
+    seed = (unsigned int) (uintptr_t) arg;
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        alloc_free(ctxs[seed % arraylen(ctxs)], seed);
+        seed++;
+    }
+
+    return NULL;
+}
+
+
+static void *
+purge_thread(void * arg)
+{
+    (void) arg;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED))
+        mpool_ctx_purge(ctxs[0]);
+
+    return NULL;
+}
+
+
+static void
+wait_child(pid_t pid)
+{
+    int status;
+
+    check(pid > 0);
+    check(waitpid(pid, &status, 0) == pid);
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+
+/* fork while the other threads allocate, free and purge: the child would
+ * deadlock on a lock one of them held */
+static void
+check_fork_under_load(void)
+{
+    int i, j;
+    pid_t pid;
+    pthread_t threads[NUM_THREADS + 1];
+
+    for (i = 0 ; i < NUM_THREADS ; i++)
+        check(pthread_create(&threads[i], NULL, worker_thread,
+                (void *) (uintptr_t) i) == 0);
+
+    check(pthread_create(&threads[NUM_THREADS], NULL, purge_thread, NULL) == 0);
+
+    for (i = 0 ; i < NUM_FORKS ; i++) {
+        pid = fork();
+        if (pid == 0) {
+            alarm(CHILD_TIMEOUT);
+            for (j = 0 ; j < 4 ; j++)
+                alloc_free(ctxs[j % arraylen(ctxs)], (unsigned int) j);
+
+            mpool_ctx_purge(ctxs[0]);
+            _exit(0);
+        }
+
+        wait_child(pid);
+        usleep(1000);
+    }
+
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for (i = 0 ; i < NUM_THREADS + 1 ; i++)
+        check(pthread_join(threads[i], NULL) == 0);
+}
+
+
+/* the child keeps the thread caches it inherits, or drops them */
+static void
+check_drop_caches(struct mpool_ctx * drop_ctx)
+{
+    pid_t pid;
+    void * ptr;
+    struct mpool_cache_info keep_info, drop_info, info;
+
+    alloc_free(ctxs[0], 1);
+    alloc_free(drop_ctx, 1);
+    check(mpool_ctx_cache_info(ctxs[0], CHUNK_SIZE, &keep_info) == 0);
+    check(mpool_ctx_cache_info(drop_ctx, CHUNK_SIZE, &drop_info) == 0);
+    check(keep_info.num_free > 0);
+    check(drop_info.num_free > 0);
+
+    pid = fork();
+    if (pid == 0) {
+        alarm(CHILD_TIMEOUT);
+        check(mpool_ctx_cache_info(ctxs[0], CHUNK_SIZE, &info) == 0);
+        check(info.num_free == keep_info.num_free);
+        check(mpool_ctx_cache_info(drop_ctx, CHUNK_SIZE, &info) == 0);
+        check(info.num_free == 0);
+        check(info.size == 0);
+
+        ptr = mpool_ctx_alloc(drop_ctx, CHUNK_SIZE, 0);
+        check(ptr != NULL);
+        mpool_ctx_free(drop_ctx, ptr, CHUNK_SIZE);
+        alloc_free(drop_ctx, 2);
+        _exit(0);
+    }
+
+    wait_child(pid);
+
+    /* the parent keeps its own */
+    check(mpool_ctx_cache_info(drop_ctx, CHUNK_SIZE, &info) == 0);
+    check(info.num_free == drop_info.num_free);
+}
+
+
+int
+main(void)
+{
+    struct mpool_ctx * drop_ctx;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 1};
+
+    ctxs[0] = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(ctxs[0] != NULL);
+    ctxs[1] = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW | MPOOL_PERCPU);
+    check(ctxs[1] != NULL);
+    drop_ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights,
+            arraylen(weights), MPOOL_GROW | MPOOL_FORK_DROP_CACHES);
+    check(drop_ctx != NULL);
+
+    check_fork_under_load();
+    check_drop_caches(drop_ctx);
+
+    mpool_ctx_destroy(drop_ctx);
+    mpool_ctx_destroy(ctxs[1]);
+    mpool_ctx_destroy(ctxs[0]);
+
+    return 0;
+}
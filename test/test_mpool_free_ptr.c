@@ -0,0 +1,92 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define ARENA_SIZE (1 << 23)
+#define RESERVE_SIZE (1UL << 28)
+#define MAX_SIZE (3 * PAGE_SIZE)
+#define NUM_ALLOCS 4
+
+static void
+check_free_ptr(struct mpool_ctx * ctx)
+{
+    int i;
+    size_t size;
+    void * ptrs[NUM_ALLOCS];
+    char foreign[64];
+
+    for (size = 1 ; size <= MAX_SIZE ; size += size < 256 ? 1 : 61) {
+        for (i = 0 ; i < NUM_ALLOCS ; i++) {
+            ptrs[i] = mpool_ctx_alloc(ctx, size, 0);
+            check(ptrs[i] != NULL);
+            memset(ptrs[i], 'a', size);
+            check(mpool_ctx_usable_size(ctx, ptrs[i])
+                  == mpool_ctx_alloc_size(ctx, size));
+        }
+
+        for (i = 0 ; i < NUM_ALLOCS ; i++)
+            mpool_ctx_free_ptr(ctx, ptrs[i]);
+    }
+
+    /* pointers from elsewhere do not belong to the instance */
+    check(mpool_ctx_usable_size(ctx, NULL) == 0);
+    check(mpool_ctx_usable_size(ctx, foreign) == 0);
+    ptrs[0] = malloc(64);
+    check(mpool_ctx_usable_size(ctx, ptrs[0]) == 0);
+    free(ptrs[0]);
+}
+
+
+int
+main(void)
+{
+    int rv;
+    void * arena, * ptr;
+    struct mpool_ctx * ctx;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 4};
+
+    arena = mmap(NULL, ARENA_SIZE,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_SHARED,
+            -1, 0);
+    check(arena != MAP_FAILED);
+
+    /* fixed arena, the size class is found from its slice */
+    ctx = mpool_ctx_create(arena, ARENA_SIZE, weights, arraylen(weights),
+            MPOOL_TINY_CLASSES);
+    check(ctx != NULL);
+    check_free_ptr(ctx);
+    mpool_ctx_stats(ctx);
+    mpool_ctx_destroy(ctx);
+
+    /* growable instance, from its segment */
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(ctx != NULL);
+    check_free_ptr(ctx);
+    mpool_ctx_stats(ctx);
+    mpool_ctx_destroy(ctx);
+
+    /* default instance */
+    rv = mpool_create(arena, ARENA_SIZE, weights, arraylen(weights));
+    check(rv == 0);
+    ptr = mpool_alloc(100, 0);
+    check(ptr != NULL);
+    check(mpool_usable_size(ptr) == 112);
+    ptr = mpool_realloc(ptr, mpool_usable_size(ptr), 2 * PAGE_SIZE, 0);
+    check(ptr != NULL);
+    check(mpool_usable_size(ptr) == 2 * PAGE_SIZE);
+    mpool_free_ptr(ptr);
+    mpool_free_ptr(NULL);
+    mpool_destroy();
+
+    munmap(arena, ARENA_SIZE);
+
+    return 0;
+}
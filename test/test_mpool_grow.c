@@ -0,0 +1,75 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define RESERVE_SIZE (1UL << 26) /* 64 MBytes */
+#define SEGMENT_SIZE (1UL << 21)
+#define NUM_ALLOCS (4 * SEGMENT_SIZE / 64)
+
+static void * ptrs[NUM_ALLOCS];
+
+int
+main(void)
+{
+    size_t i, num;
+    void * ptr, * big;
+    struct mpool_ctx * ctx;
+    unsigned int weights[] = {1, 0, 1, 0, 0, 0, 1, 1};
+
+    /* growable instances own their arena */
+    check(mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            0) == NULL);
+
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(ctx != NULL);
+
+    /* a size class grows well past a single segment */
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        ptrs[i] = mpool_ctx_alloc(ctx, 64, 0);
+        check(ptrs[i] != NULL);
+        memset(ptrs[i], 'a', 64);
+    }
+
+    /* classes without weight stay disabled */
+    check(mpool_ctx_alloc(ctx, 128, 0) == NULL);
+
+    /* other classes and the large tier take segments from the same reserve */
+    ptr = mpool_ctx_alloc(ctx, 256, 0);
+    check(ptr != NULL);
+    mpool_ctx_free(ctx, ptr, 256);
+
+    big = mpool_ctx_alloc(ctx, 3 * SEGMENT_SIZE, 0);
+    check(big != NULL);
+    memset(big, 'b', 3 * SEGMENT_SIZE);
+
+    mpool_ctx_stats(ctx);
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++)
+        mpool_ctx_free(ctx, ptrs[i], 64);
+
+    /* freed chunks are reused rather than committing more segments */
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        ptrs[i] = mpool_ctx_alloc(ctx, 64, 0);
+        check(ptrs[i] != NULL);
+    }
+
+    /* the reserve runs out eventually */
+    for (num = 0 ; ; num++) {
+        ptr = mpool_ctx_alloc(ctx, 4096, 0);
+        if (ptr == NULL)
+            break;
+    }
+
+    check(num > 0 && num < RESERVE_SIZE / 4096);
+
+    mpool_ctx_free(ctx, big, 3 * SEGMENT_SIZE);
+    mpool_ctx_stats(ctx);
+    mpool_ctx_destroy(ctx);
+
+    return 0;
+}
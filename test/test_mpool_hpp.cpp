@@ -0,0 +1,182 @@
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "check.h"
+#include "mpool.hpp"
+
+#define RESERVE_SIZE (1UL << 30)
+#define NUM_ITEMS 10000
+
+struct alignas(64) wide {
+    char bytes[64];
+};
+
+static int num_objects;
+
+struct object {
+    explicit object(int v) : value(v)
+    {
+        if (v < 0)
+            throw std::invalid_argument("negative");
+
+        num_objects++;
+    }
+
+    ~object()
+    {
+        num_objects--;
+    }
+
+    int value;
+};
+
+static bool
+from_pool(void const * ptr)
+{
+    return mpool_usable_size(ptr) > 0;
+}
+
+
+static void
+check_allocator(void)
+{
+    int i;
+    bool thrown;
+    std::vector<int, mpool_allocator<int>> vec;
+    std::list<int, mpool_allocator<int>> list;
+    std::map<int, int, std::less<int>,
+             mpool_allocator<std::pair<int const, int>>> map;
+    std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                       mpool_allocator<std::pair<int const, int>>> hash;
+    std::vector<wide, mpool_allocator<wide>> wide_vec(3);
+
+    for (i = 0 ; i < NUM_ITEMS ; i++) {
+        vec.push_back(i);
+        list.push_back(i);
+        map[i] = i;
+        hash[i] = i;
+    }
+
+    check(from_pool(vec.data()));
+    check(from_pool(&list.front()));
+    check(from_pool(&map.begin()->second));
+    check(from_pool(&hash.find(1)->second));
+    check(from_pool(wide_vec.data()));
+    check((reinterpret_cast<uintptr_t>(wide_vec.data()) & 63) == 0);
+
+    for (i = 0 ; i < NUM_ITEMS ; i++) {
+        check(vec[static_cast<size_t>(i)] == i);
+        check(map[i] == i);
+        check(hash[i] == i);
+    }
+
+    check(mpool_allocator<int>() == mpool_allocator<long>());
+
+    thrown = false;
+    try {
+        wide_vec.reserve(SIZE_MAX / 2 / sizeof(wide));
+    } catch (std::bad_alloc const &) {
+        thrown = true;
+    }
+
+    check(thrown);
+}
+
+
+static void
+check_resource(struct mpool_ctx * ctx)
+{
+    int i;
+    bool thrown;
+    void * ptr;
+    mpool_memory_resource res(ctx);
+    mpool_memory_resource other;
+    std::pmr::vector<std::pmr::string> strings(&res);
+
+    check(res.ctx() == ctx);
+    check(res.is_equal(res));
+    check(!res.is_equal(other));
+    check(!res.is_equal(*std::pmr::new_delete_resource()));
+
+    for (i = 0 ; i < NUM_ITEMS ; i++)
+        strings.emplace_back(std::to_string(i) + " is long enough to be on "
+                             "the heap");
+
+    check(mpool_ctx_usable_size(ctx, strings.data()) > 0);
+    check(mpool_ctx_usable_size(ctx, strings.back().data()) > 0);
+
+    ptr = res.allocate(100, 256);
+    check((reinterpret_cast<uintptr_t>(ptr) & 255) == 0);
+    check(mpool_ctx_usable_size(ctx, ptr) >= 100);
+    res.deallocate(ptr, 100, 256);
+
+    thrown = false;
+    try {
+        ptr = res.allocate(SIZE_MAX / 2);
+    } catch (std::bad_alloc const &) {
+        thrown = true;
+    }
+
+    check(thrown);
+}
+
+
+static void
+check_make_pooled(void)
+{
+    bool thrown;
+
+    {
+        mpool_ptr<object> obj = make_pooled<object>(42);
+
+        check(obj->value == 42);
+        check(from_pool(obj.get()));
+        check(num_objects == 1);
+    }
+
+    check(num_objects == 0);
+
+    thrown = false;
+    try {
+        mpool_ptr<object> obj = make_pooled<object>(-1);
+    } catch (std::invalid_argument const &) {
+        thrown = true;
+    }
+
+    check(thrown);
+
+    check(num_objects == 0);
+}
+
+
+int
+main(void)
+{
+    struct mpool_ctx * ctx, * other;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 1};
+
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(ctx != NULL);
+    mpool_set_default(ctx);
+
+    check_allocator();
+    check_make_pooled();
+
+    other = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(other != NULL);
+    check_resource(other);
+    mpool_ctx_destroy(other);
+
+    mpool_destroy();
+
+    return 0;
+}
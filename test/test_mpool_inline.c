@@ -0,0 +1,204 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define RESERVE_SIZE (256UL << 20)
+#define CHUNK_SIZE 64
+#define NUM_ALLOCS 4096
+#define NUM_THREADS 4
+
+struct session {
+    uint64_t id;
+    char name[40];
+};
+
+static unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 1};
+static void * ptrs[NUM_ALLOCS];
+
+static struct mpool_class_stats *
+get_class_stats(struct mpool_ctx * ctx, size_t elem_size,
+        struct mpool_stats * stats)
+{
+    unsigned int i;
+
+    check(mpool_ctx_stats_get(ctx, stats) == 0);
+    for (i = 0 ; i < stats->num_classes ; i++) {
+        if (stats->classes[i].elem_size == elem_size)
+            return &stats->classes[i];
+    }
+
+    check(0);
+    return NULL;
+}
+
+
+/* more chunks than the thread cache holds: it is refilled and flushed */
+static void *
+alloc_free(void * arg)
+{
+    size_t i;
+
+    (void) arg;
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        ptrs[i] = mpool_alloc_fast(CHUNK_SIZE);
+        check(ptrs[i] != NULL);
+        check(((uintptr_t) ptrs[i] & (CHUNK_SIZE - 1)) == 0);
+        memset(ptrs[i], 'a', CHUNK_SIZE);
+    }
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++)
+        mpool_free_fast(ptrs[i], CHUNK_SIZE);
+
+    return NULL;
+}
+
+
+static void
+check_sizes(struct mpool_ctx * ctx)
+{
+    void * ptr, * again;
+    struct session * session;
+    size_t volatile size = 200;
+
+    session = mpool_alloc_fast(sizeof(struct session));
+    check(session != NULL);
+    check(mpool_ctx_usable_size(ctx, session) >= sizeof(struct session));
+    session->id = 1;
+    mpool_free_fast(session, sizeof(struct session));
+
+    /* the most recently freed chunk first, whichever form frees it */
+    again = mpool_alloc_fast(sizeof(struct session));
+    check(again == session);
+    mpool_free(again, sizeof(struct session));
+    again = mpool_alloc_fast(sizeof(struct session));
+    check(again == session);
+    mpool_free_ptr(again);
+    again = mpool_alloc(sizeof(struct session), 0);
+    check(again == session);
+    mpool_free_fast(again, sizeof(struct session));
+
+    ptr = mpool_alloc_fast(0);
+    check(ptr != NULL);
+    mpool_free_fast(ptr, 0);
+
+    ptr = mpool_alloc_fast(MPOOL_INLINE_MAX_SIZE);
+    check(ptr != NULL);
+    check(mpool_ctx_usable_size(ctx, ptr) == MPOOL_INLINE_MAX_SIZE);
+    mpool_free_fast(ptr, MPOOL_INLINE_MAX_SIZE);
+
+    /* sizes past the inline ones, or not known at compile time */
+    ptr = mpool_alloc_fast(3 * PAGE_SIZE);
+    check(ptr != NULL);
+    check(mpool_ctx_usable_size(ctx, ptr) >= 3 * PAGE_SIZE);
+    mpool_free_fast(ptr, 3 * PAGE_SIZE);
+
+    ptr = mpool_alloc_fast(size);
+    check(ptr != NULL);
+    check(mpool_ctx_usable_size(ctx, ptr) >= size);
+    mpool_free_fast(ptr, size);
+
+    mpool_free_fast(NULL, CHUNK_SIZE);
+}
+
+
+static void
+check_counts(struct mpool_ctx * ctx)
+{
+    int i;
+    pthread_t threads[NUM_THREADS];
+    struct mpool_stats stats;
+    struct mpool_class_stats * class_stats;
+    size_t allocs;
+
+    class_stats = get_class_stats(ctx, CHUNK_SIZE, &stats);
+    allocs = class_stats->allocs;
+    alloc_free(NULL);
+    class_stats = get_class_stats(ctx, CHUNK_SIZE, &stats);
+    check(class_stats->allocs == allocs + NUM_ALLOCS);
+    check(class_stats->frees == class_stats->allocs);
+    check(class_stats->refills > 0);
+    check(class_stats->flushes > 0);
+
+    /* and the ones of exited threads, run one at a time for ptrs[] */
+    for (i = 0 ; i < NUM_THREADS ; i++) {
+        check(pthread_create(&threads[i], NULL, alloc_free, NULL) == 0);
+        check(pthread_join(threads[i], NULL) == 0);
+    }
+
+    class_stats = get_class_stats(ctx, CHUNK_SIZE, &stats);
+    check(class_stats->allocs == allocs + (NUM_THREADS + 1) * NUM_ALLOCS);
+    check(class_stats->frees == class_stats->allocs);
+    check(class_stats->used <= class_stats->total);
+}
+
+
+int
+main(void)
+{
+    int i;
+    void * ptr;
+    struct mpool_stats stats;
+    struct mpool_ctx * ctx, * other;
+
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(ctx != NULL);
+    mpool_set_default(ctx);
+
+    check_sizes(ctx);
+    if (mpool_ctx_stats_get(ctx, &stats) == 0)
+        check_counts(ctx);
+    else
+        alloc_free(NULL);
+
+    /* another default instance: no chunk of the former one */
+    other = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(other != NULL);
+    mpool_set_default(other);
+    ptr = mpool_alloc_fast(CHUNK_SIZE);
+    check(ptr != NULL);
+    check(mpool_ctx_usable_size(other, ptr) == CHUNK_SIZE);
+    check(mpool_ctx_usable_size(ctx, ptr) == 0);
+    mpool_free_fast(ptr, CHUNK_SIZE);
+
+    /* nor of a destroyed one, which slot the next instance takes */
+    mpool_destroy();
+    other = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(other != NULL);
+    mpool_set_default(other);
+    ptr = mpool_alloc_fast(CHUNK_SIZE);
+    check(ptr != NULL);
+    check(mpool_ctx_usable_size(other, ptr) == CHUNK_SIZE);
+    mpool_free_fast(ptr, CHUNK_SIZE);
+    mpool_destroy();
+
+    /* instances without plain thread caches go through the library */
+    mpool_set_default(ctx);
+    for (i = 0 ; i < 2 ; i++) {
+        other = mpool_ctx_create(NULL, RESERVE_SIZE, weights,
+                arraylen(weights),
+                MPOOL_GROW | (i == 0 ? MPOOL_PERCPU : MPOOL_REMOTE_FREE));
+        if (other == NULL && errno == ENOTSUP)
+            continue;
+
+        check(other != NULL);
+        mpool_set_default(other);
+        check_sizes(other);
+        alloc_free(NULL);
+        mpool_destroy();
+    }
+
+    mpool_set_default(ctx);
+    mpool_destroy();
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define NUM_RUNS 64
+#define RUN_SIZE (3 * PAGE_SIZE + 1)
+
+static int
+is_page_aligned(void const * ptr)
+{
+    return ((uintptr_t) ptr & (PAGE_SIZE - 1)) == 0;
+}
+
+int
+main(void)
+{
+    int rv;
+    size_t i, j, size;
+    void * ptr, * tmp;
+    void * runs[NUM_RUNS];
+    void * holes[NUM_RUNS / 2];
+    void * arena;
+    size_t arena_size;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 8};
+
+    arena_size = 1 << 22;
+    arena = mmap(NULL, arena_size,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_SHARED,
+            -1, 0);
+    check(arena != MAP_FAILED);
+
+    rv = mpool_create(arena, arena_size, weights, arraylen(weights));
+    check(rv == 0);
+
+    /* smoke test */
+    for (size = PAGE_SIZE + 1 ; size <= (1 << 20) ; size <<= 1) {
+        ptr = mpool_alloc(size, 0);
+        check(ptr != NULL);
+        check(is_page_aligned(ptr));
+        memset(ptr, 'a', size);
+        mpool_free(ptr, size);
+    }
+
+    /* small sizes are still served by the size classes */
+    ptr = mpool_alloc(PAGE_SIZE, 0);
+    check(ptr != NULL);
+    mpool_free(ptr, PAGE_SIZE);
+
+    /* fill the tier with runs, and free every other one */
+    for (i = 0 ; i < NUM_RUNS ; i++) {
+        runs[i] = mpool_alloc(RUN_SIZE, 0);
+        check(runs[i] != NULL);
+        memset(runs[i], (int) i, RUN_SIZE);
+    }
+
+    for (i = 0 ; i < NUM_RUNS ; i += 2) {
+        holes[i / 2] = runs[i];
+        mpool_free(runs[i], RUN_SIZE);
+    }
+
+    /* the best fitting free runs are the holes, not the tier's tail */
+    for (i = 0 ; i < NUM_RUNS ; i += 2) {
+        runs[i] = mpool_alloc(RUN_SIZE, 0);
+        check(runs[i] != NULL);
+        for (j = 0 ; j < NUM_RUNS / 2 ; j++)
+            if (runs[i] == holes[j])
+                break;
+
+        check(j < NUM_RUNS / 2);
+    }
+
+    for (i = 0 ; i < NUM_RUNS ; i++)
+        mpool_free(runs[i], RUN_SIZE);
+
+    /* everything coalesced back: the whole tier is a single run again */
+    for (size = arena_size ; size > PAGE_SIZE ; size -= PAGE_SIZE) {
+        ptr = mpool_alloc(size, 0);
+        if (ptr != NULL)
+            break;
+    }
+
+    check(ptr != NULL);
+    check(mpool_alloc(PAGE_SIZE + 1, 0) == NULL);
+    mpool_free(ptr, size);
+    ptr = mpool_alloc(size, 0);
+    check(ptr != NULL);
+
+    /* in place realloc */
+    tmp = mpool_realloc(ptr, size, 2 * PAGE_SIZE, 0);
+    check(tmp == ptr);
+    tmp = mpool_realloc(ptr, 2 * PAGE_SIZE, 3 * PAGE_SIZE, 0);
+    check(tmp == ptr);
+
+    /* realloc across the small and the large allocators keeps the data */
+    memset(ptr, 'b', 3 * PAGE_SIZE);
+    ptr = mpool_realloc(ptr, 3 * PAGE_SIZE, 100, 0);
+    check(ptr != NULL);
+    check(((char *) ptr)[99] == 'b');
+    ptr = mpool_realloc(ptr, 100, 5 * PAGE_SIZE, 0);
+    check(ptr != NULL);
+    check(is_page_aligned(ptr));
+    check(((char *) ptr)[99] == 'b');
+    mpool_free(ptr, 5 * PAGE_SIZE);
+
+    mpool_stats();
+
+    mpool_destroy();
+    munmap(arena, arena_size);
+
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define CHUNK_SIZE 64
+#define NUM_ALLOCS 4096
+#define NUM_THREADS 4
+#define RESERVE_SIZE (64 << 20)
+
+static struct mpool_ctx * ctx;
+
+static void *
+alloc_free(void * arg)
+{
+    size_t i;
+    void ** p;
+
+    (void) arg;
+
+    p = malloc(NUM_ALLOCS * sizeof(void *));
+    check(p != NULL);
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        p[i] = mpool_ctx_alloc(ctx, CHUNK_SIZE, 0);
+        check(p[i] != NULL);
+    }
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++)
+        mpool_ctx_free(ctx, p[i], CHUNK_SIZE);
+
+    free(p);
+
+    return NULL;
+}
+
+
+/* fast and slow path calls of a size class */
+static size_t
+get_count(size_t size, int call, size_t * slow)
+{
+    struct mpool_latency fast, latency;
+
+    check(mpool_ctx_latency_get(ctx, size, call, 0, &fast) == 0);
+    check(mpool_ctx_latency_get(ctx, size, call, 1, &latency) == 0);
+    check(fast.elem_size == latency.elem_size);
+    if (slow != NULL)
+        *slow = latency.count;
+
+    return fast.count + latency.count;
+}
+
+
+static void
+check_percentiles(size_t size, int call, int slow)
+{
+    struct mpool_latency latency;
+
+    check(mpool_ctx_latency_get(ctx, size, call, slow, &latency) == 0);
+    check(latency.count > 0);
+    check(latency.p50 <= latency.p99);
+    check(latency.p99 <= latency.p999);
+    check(latency.p999 <= latency.max);
+    check(latency.max > 0);
+}
+
+
+int
+main(void)
+{
+    size_t i, slow;
+    void * ptr;
+    pthread_t threads[NUM_THREADS];
+    struct mpool_latency latency;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 1};
+
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(ctx != NULL);
+
+    /* built without the histograms */
+    if (mpool_ctx_latency_get(ctx, CHUNK_SIZE, MPOOL_LATENCY_ALLOC, 0,
+            &latency) == ENOTSUP)
+        return 0;
+
+    check(latency.elem_size == CHUNK_SIZE);
+    check(latency.count == 0);
+    check(mpool_ctx_latency_get(ctx, CHUNK_SIZE, MPOOL_LATENCY_CALLS, 0,
+            &latency) == EINVAL);
+    check(mpool_ctx_latency_get(ctx, CHUNK_SIZE, MPOOL_LATENCY_ALLOC, 2,
+            &latency) == EINVAL);
+
+    /* the calls of the calling thread, the first ones refill its cache and
+     * the last ones flush it */
+    alloc_free(NULL);
+    check(get_count(CHUNK_SIZE, MPOOL_LATENCY_ALLOC, &slow) == NUM_ALLOCS);
+    check(slow > 0);
+    check(slow < NUM_ALLOCS);
+    check_percentiles(CHUNK_SIZE, MPOOL_LATENCY_ALLOC, 0);
+    check_percentiles(CHUNK_SIZE, MPOOL_LATENCY_ALLOC, 1);
+    check(get_count(CHUNK_SIZE, MPOOL_LATENCY_FREE, &slow) == NUM_ALLOCS);
+    check(slow > 0);
+    check_percentiles(CHUNK_SIZE, MPOOL_LATENCY_FREE, 0);
+
+    /* a realloc is a single call, whatever it does */
+    ptr = mpool_ctx_realloc(ctx, NULL, 0, CHUNK_SIZE, 0);
+    check(ptr != NULL);
+    ptr = mpool_ctx_realloc(ctx, ptr, CHUNK_SIZE, 4 * CHUNK_SIZE, 0);
+    check(ptr != NULL);
+    mpool_ctx_free_ptr(ctx, ptr);
+    check(get_count(CHUNK_SIZE, MPOOL_LATENCY_REALLOC, NULL) == 1);
+    check(get_count(4 * CHUNK_SIZE, MPOOL_LATENCY_REALLOC, NULL) == 1);
+    check(get_count(4 * CHUNK_SIZE, MPOOL_LATENCY_FREE, NULL) == 1);
+    check(get_count(CHUNK_SIZE, MPOOL_LATENCY_ALLOC, NULL) == NUM_ALLOCS);
+    check(get_count(CHUNK_SIZE, MPOOL_LATENCY_FREE, NULL) == NUM_ALLOCS);
+
+    /* the large tier */
+    ptr = mpool_ctx_alloc(ctx, 2 * PAGE_SIZE, 0);
+    check(ptr != NULL);
+    mpool_ctx_free_ptr(ctx, ptr);
+    check(mpool_ctx_latency_get(ctx, 2 * PAGE_SIZE, MPOOL_LATENCY_ALLOC, 0,
+            &latency) == 0);
+    check(latency.elem_size == 0);
+    check(get_count(2 * PAGE_SIZE, MPOOL_LATENCY_ALLOC, NULL) == 1);
+    check(get_count(2 * PAGE_SIZE, MPOOL_LATENCY_FREE, NULL) == 1);
+
+    /* and the calls of exited threads, which histograms the next ones take
+     * over */
+    for (i = 0 ; i < NUM_THREADS ; i++)
+        check(pthread_create(&threads[i], NULL, alloc_free, NULL) == 0);
+
+    for (i = 0 ; i < NUM_THREADS ; i++)
+        check(pthread_join(threads[i], NULL) == 0);
+
+    check(get_count(CHUNK_SIZE, MPOOL_LATENCY_ALLOC, NULL)
+          == (NUM_THREADS + 1) * NUM_ALLOCS);
+    check(get_count(CHUNK_SIZE, MPOOL_LATENCY_FREE, NULL)
+          == (NUM_THREADS + 1) * NUM_ALLOCS);
+
+    mpool_latency_reset();
+    check(get_count(CHUNK_SIZE, MPOOL_LATENCY_ALLOC, NULL) == 0);
+    check(mpool_ctx_latency_get(ctx, CHUNK_SIZE, MPOOL_LATENCY_FREE, 1,
+            &latency) == 0);
+    check(latency.max == 0);
+    check(latency.p999 == 0);
+
+    mpool_ctx_destroy(ctx);
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define ARENA_SIZE ((1 << 22) + 1)
+
+static unsigned char resident[(ARENA_SIZE + PAGE_SIZE - 1) / PAGE_SIZE];
+
+static void
+check_map(int flags)
+{
+    int got;
+    size_t i;
+    void * arena, * ptr;
+    struct mpool_ctx * ctx;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 1};
+
+    got = flags;
+    arena = mpool_arena_map(ARENA_SIZE, &got);
+    check(arena != NULL);
+    check(((uintptr_t) arena & (HUGE_PAGE_SIZE - 1)) == 0);
+
+    /* explicit huge pages fall back to transparent ones, and those to small
+     * pages, populating always succeeds */
+    check((got & ~(flags | MPOOL_MAP_THP)) == 0);
+    check((got & MPOOL_MAP_POPULATE) == (flags & MPOOL_MAP_POPULATE));
+
+    if (got & MPOOL_MAP_POPULATE) {
+        check(mincore(arena, ARENA_SIZE, resident) == 0);
+        for (i = 0 ; i < arraylen(resident) ; i++)
+            check(resident[i] & 1);
+    }
+
+    /* the whole rounded up size is usable */
+    memset(arena, 'a', 3 * HUGE_PAGE_SIZE);
+
+    ctx = mpool_ctx_create(arena, ARENA_SIZE, weights, arraylen(weights), 0);
+    check(ctx != NULL);
+    ptr = mpool_ctx_alloc(ctx, 100, 0);
+    check(ptr != NULL);
+    mpool_ctx_free(ctx, ptr, 100);
+    mpool_ctx_destroy(ctx);
+
+    mpool_arena_unmap(arena, ARENA_SIZE);
+}
+
+
+int
+main(void)
+{
+    int flags;
+
+    check_map(0);
+    check_map(MPOOL_MAP_POPULATE);
+    check_map(MPOOL_MAP_THP);
+    check_map(MPOOL_MAP_THP | MPOOL_MAP_POPULATE);
+    check_map(MPOOL_MAP_HUGETLB);
+    check_map(MPOOL_MAP_HUGETLB | MPOOL_MAP_POPULATE);
+    check_map(MPOOL_MAP_THP | MPOOL_MAP_POPULATE | MPOOL_MAP_LOCK);
+
+    flags = 0;
+    check(mpool_arena_map(0, &flags) == NULL);
+
+    return 0;
+}
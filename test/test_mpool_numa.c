@@ -0,0 +1,112 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define RESERVE_SIZE (1UL << 28)
+#define NUM_ALLOCS 1024
+
+static void * local[NUM_ALLOCS];
+static void * remote[NUM_ALLOCS];
+
+static void *
+other_node(void * arg)
+{
+    size_t i;
+    struct mpool_ctx * ctx = arg;
+
+    /* the second thread gets the second fake node: it frees its own chunks,
+     * and the ones of the first node */
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        local[i] = mpool_ctx_alloc(ctx, 64, 0);
+        check(local[i] != NULL);
+        check(mpool_ctx_usable_size(ctx, local[i]) == 64);
+    }
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        mpool_ctx_free(ctx, local[i], 64);
+        mpool_ctx_free_ptr(ctx, remote[i]);
+    }
+
+    return NULL;
+}
+
+
+static void
+check_numa(struct mpool_ctx * ctx, size_t remote_frees)
+{
+    size_t i, local_frees, num_remote;
+    void * ptr;
+    pthread_t thread;
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        remote[i] = mpool_ctx_alloc(ctx, i & 1 ? 64 : 2 * PAGE_SIZE, 0);
+        check(remote[i] != NULL);
+        memset(remote[i], 'a', 64);
+    }
+
+    check(pthread_create(&thread, NULL, other_node, ctx) == 0);
+    check(pthread_join(thread, NULL) == 0);
+
+    check(mpool_ctx_numa_stats(ctx, &local_frees, &num_remote) == 0);
+    check(num_remote == remote_frees);
+    check(local_frees == 2 * NUM_ALLOCS - remote_frees);
+
+    /* realloc and free_bulk find the node of the chunks too */
+    ptr = mpool_ctx_alloc(ctx, 2 * PAGE_SIZE, 0);
+    check(ptr != NULL);
+    ptr = mpool_ctx_realloc(ctx, ptr, 2 * PAGE_SIZE, 3 * PAGE_SIZE, 0);
+    check(ptr != NULL);
+    check(mpool_ctx_usable_size(ctx, ptr) == 3 * PAGE_SIZE);
+    mpool_ctx_free_ptr(ctx, ptr);
+
+    check(mpool_ctx_alloc_bulk(ctx, 64, NUM_ALLOCS, local) == 0);
+    mpool_ctx_free_bulk(ctx, 64, NUM_ALLOCS, local);
+
+    mpool_ctx_stats(ctx);
+}
+
+
+int
+main(void)
+{
+    size_t local_frees, remote_frees;
+    struct mpool_ctx * ctx;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 1};
+
+    /* NUMA needs a growable instance */
+    check(mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_NUMA) == NULL);
+
+    /* two fake nodes: the chunks of the first thread are remote to the
+     * second one */
+    check(setenv("MPOOL_NUMA_NODES", "2", 1) == 0);
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW | MPOOL_NUMA);
+    check(ctx != NULL);
+    check_numa(ctx, NUM_ALLOCS);
+    mpool_ctx_destroy(ctx);
+
+    /* the real nodes */
+    check(unsetenv("MPOOL_NUMA_NODES") == 0);
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW | MPOOL_NUMA);
+    check(ctx != NULL);
+    check(mpool_ctx_numa_stats(ctx, &local_frees, &remote_frees) == 0);
+    check(local_frees == 0 && remote_frees == 0);
+    mpool_ctx_destroy(ctx);
+
+    /* other instances count nothing */
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(ctx != NULL);
+    check(mpool_ctx_numa_stats(ctx, &local_frees, &remote_frees) == EINVAL);
+    mpool_ctx_destroy(ctx);
+
+    return 0;
+}
@@ -0,0 +1,279 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define RESERVE_SIZE (1UL << 30)
+#define NUM_OBJS 10000
+#define NUM_THREADS 4
+#define NUM_ROUNDS 200
+#define CONN_MAGIC 0xc0ffee
+
+/* 120 bytes, which a size class would take as 128 */
+struct conn {
+    uint32_t magic;
+    uint32_t uses;
+    char buf[112];
+};
+
+static size_t num_ctor;
+static size_t num_dtor;
+
+static void
+conn_ctor(void * obj)
+{
+    struct conn * conn = obj;
+
+    conn->magic = CONN_MAGIC;
+    conn->uses = 0;
+    memset(conn->buf, 'c', sizeof(conn->buf));
+    __atomic_fetch_add(&num_ctor, 1, __ATOMIC_RELAXED);
+}
+
+
+static void
+conn_dtor(void * obj)
+{
+    struct conn * conn = obj;
+
+    check(conn->magic == CONN_MAGIC);
+    conn->magic = 0;
+    __atomic_fetch_add(&num_dtor, 1, __ATOMIC_RELAXED);
+}
+
+
+/* freed objects come back as they were left, constructed once */
+static void
+check_constructed(struct mpool_ctx * ctx)
+{
+    size_t i;
+    struct conn * conn, * again;
+    struct conn ** conns;
+    struct mpool_objcache * cache;
+    struct mpool_class_stats stats;
+
+    num_ctor = 0;
+    num_dtor = 0;
+    cache = mpool_ctx_objcache_create(ctx, "conn", sizeof(struct conn), 0,
+            conn_ctor, conn_dtor);
+    check(cache != NULL);
+
+    conn = mpool_objcache_alloc(cache);
+    check(conn != NULL);
+    check(conn->magic == CONN_MAGIC);
+    check(conn->uses == 0);
+    check(num_ctor > 0);
+    conn->uses = 1;
+    mpool_objcache_free(cache, conn);
+
+    again = mpool_objcache_alloc(cache);
+    check(again == conn);
+    check(again->magic == CONN_MAGIC);
+    check(again->uses == 1);
+    mpool_objcache_free(cache, again);
+
+    /* over many slabs, each object constructed once */
+    conns = malloc(NUM_OBJS * sizeof(*conns));
+    check(conns != NULL);
+    for (i = 0 ; i < NUM_OBJS ; i++) {
+        conns[i] = mpool_objcache_alloc(cache);
+        check(conns[i] != NULL);
+        check(((uintptr_t) conns[i] & 15) == 0);
+        check(conns[i]->magic == CONN_MAGIC);
+        check(conns[i]->buf[0] == 'c');
+        conns[i]->uses++;
+    }
+
+    check(num_ctor >= NUM_OBJS);
+    check(num_ctor < 2 * NUM_OBJS);
+    for (i = 0 ; i < NUM_OBJS ; i++)
+        mpool_objcache_free(cache, conns[i]);
+
+    for (i = 0 ; i < NUM_OBJS ; i++) {
+        conns[i] = mpool_objcache_alloc(cache);
+        check(conns[i]->magic == CONN_MAGIC);
+    }
+
+    check(num_ctor < 2 * NUM_OBJS);
+    for (i = 0 ; i < NUM_OBJS ; i++)
+        mpool_objcache_free(cache, conns[i]);
+
+    /* the object size rounded up to 16 bytes, and the free list link */
+    if (mpool_objcache_stats_get(cache, &stats) == 0) {
+        check(stats.elem_size == 128 + 16);
+        check(stats.allocs == 2 * NUM_OBJS + 2);
+        check(stats.frees == stats.allocs);
+        check(stats.used <= stats.total);
+        check(stats.total >= num_ctor);
+    }
+
+    mpool_objcache_destroy(cache);
+    check(num_dtor == num_ctor);
+    free(conns);
+}
+
+
+/* objects without a constructor are packed at their size */
+static void
+check_packed(struct mpool_ctx * ctx)
+{
+    size_t i;
+    uint8_t * objs[64];
+    struct mpool_objcache * cache;
+
+    cache = mpool_ctx_objcache_create(ctx, "timer", 40, 0, NULL, NULL);
+    check(cache != NULL);
+
+    for (i = 0 ; i < arraylen(objs) ; i++) {
+        objs[i] = mpool_objcache_alloc(cache);
+        check(objs[i] != NULL);
+        memset(objs[i], 'a', 40);
+    }
+
+    /* carved in address order from the first slab */
+    for (i = 1 ; i < arraylen(objs) ; i++)
+        check(objs[i] == objs[i - 1] + 48);
+
+    for (i = 0 ; i < arraylen(objs) ; i++)
+        mpool_objcache_free(cache, objs[i]);
+
+    mpool_objcache_free(cache, NULL);
+    mpool_objcache_destroy(cache);
+}
+
+
+static void
+check_aligned(struct mpool_ctx * ctx)
+{
+    size_t i;
+    uint8_t * objs[64];
+    struct mpool_objcache * cache;
+
+    cache = mpool_ctx_objcache_create(ctx, "aligned", sizeof(struct conn),
+            CACHELINE_SIZE, conn_ctor, NULL);
+    check(cache != NULL);
+
+    for (i = 0 ; i < arraylen(objs) ; i++) {
+        objs[i] = mpool_objcache_alloc(cache);
+        check(objs[i] != NULL);
+        check(((uintptr_t) objs[i] & (CACHELINE_SIZE - 1)) == 0);
+        check(((struct conn *) objs[i])->magic == CONN_MAGIC);
+    }
+
+    for (i = 0 ; i < arraylen(objs) ; i++)
+        mpool_objcache_free(cache, objs[i]);
+
+    mpool_objcache_destroy(cache);
+}
+
+
+static void *
+worker_thread(void * arg)
+{
+    int i, j;
+    struct conn * conns[64];
+    struct mpool_objcache * cache = arg;
+
+    for (i = 0 ; i < NUM_ROUNDS ; i++) {
+        for (j = 0 ; j < (int) arraylen(conns) ; j++) {
+            conns[j] = mpool_objcache_alloc(cache);
+            check(conns[j] != NULL);
+            check(conns[j]->magic == CONN_MAGIC);
+            conns[j]->uses++;
+        }
+
+        for (j = 0 ; j < (int) arraylen(conns) ; j++)
+            mpool_objcache_free(cache, conns[j]);
+    }
+
+    return NULL;
+}
+
+
+static void
+check_threads(struct mpool_ctx * ctx)
+{
+    int i;
+    pthread_t threads[NUM_THREADS];
+    struct mpool_objcache * cache;
+    struct mpool_class_stats stats;
+
+    num_ctor = 0;
+    num_dtor = 0;
+    cache = mpool_ctx_objcache_create(ctx, "shared", sizeof(struct conn), 0,
+            conn_ctor, conn_dtor);
+    check(cache != NULL);
+
+    for (i = 0 ; i < NUM_THREADS ; i++)
+        check(pthread_create(&threads[i], NULL, worker_thread, cache) == 0);
+
+    for (i = 0 ; i < NUM_THREADS ; i++)
+        check(pthread_join(threads[i], NULL) == 0);
+
+    /* the exiting threads gave their objects back */
+    if (mpool_objcache_stats_get(cache, &stats) == 0) {
+        check(stats.allocs == NUM_THREADS * NUM_ROUNDS * 64);
+        check(stats.frees == stats.allocs);
+        check(stats.used == 0);
+    }
+
+    mpool_objcache_destroy(cache);
+    check(num_dtor == num_ctor);
+}
+
+
+static void
+check_invalid(struct mpool_ctx * ctx)
+{
+    struct mpool_ctx * small_ctx;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1};
+
+    check(mpool_ctx_objcache_create(ctx, "empty", 0, 0, NULL, NULL) == NULL);
+    check(mpool_ctx_objcache_create(ctx, "align", 64, 24, NULL, NULL) == NULL);
+    check(mpool_ctx_objcache_create(ctx, "align", 64, 2 * PAGE_SIZE, NULL,
+            NULL) == NULL);
+
+    /* slabs come from the large tier */
+    small_ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights,
+            arraylen(weights), MPOOL_GROW);
+    check(small_ctx != NULL);
+    check(mpool_ctx_objcache_create(small_ctx, "none", 64, 0, NULL, NULL)
+          == NULL);
+    mpool_ctx_destroy(small_ctx);
+}
+
+
+int
+main(void)
+{
+    void * obj;
+    struct mpool_ctx * ctx;
+    struct mpool_objcache * cache;
+    unsigned int weights[] = {1, 1, 1, 1, 1, 1, 1, 1};
+
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(ctx != NULL);
+
+    check_constructed(ctx);
+    check_packed(ctx);
+    check_aligned(ctx);
+    check_threads(ctx);
+    check_invalid(ctx);
+
+    /* the default instance */
+    mpool_set_default(ctx);
+    cache = mpool_objcache_create("default", 24, 0, NULL, NULL);
+    check(cache != NULL);
+    obj = mpool_objcache_alloc(cache);
+    check(obj != NULL);
+    mpool_objcache_free(cache, obj);
+    mpool_objcache_destroy(cache);
+
+    mpool_destroy();
+
+    return 0;
+}
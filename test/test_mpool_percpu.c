@@ -0,0 +1,183 @@
+#define _GNU_SOURCE /* syscall() */
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+#include "mpool_rseq.h"
+
+#define ARENA_SIZE (1 << 20)
+#define NUM_CHUNKS (ARENA_SIZE / 64)
+#define NUM_THREADS 4096
+#define NUM_WORKERS 4
+#define NUM_ALLOCS 32
+#define NUM_ITERS 2000
+
+static void * ptrs[NUM_CHUNKS];
+
+static void *
+short_thread(void * arg)
+{
+    size_t i;
+    void * ptr[NUM_ALLOCS];
+    struct mpool_ctx * ctx = arg;
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        ptr[i] = mpool_ctx_alloc(ctx, 64, 0);
+        check(ptr[i] != NULL);
+        memset(ptr[i], 'a', 64);
+    }
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++)
+        mpool_ctx_free(ctx, ptr[i], 64);
+
+    return NULL;
+}
+
+
+/* chunks are not shared between threads until freed */
+static void *
+worker_thread(void * arg)
+{
+    size_t i, j, size;
+    uint8_t * ptr[NUM_ALLOCS];
+    uint8_t tag;
+
+    tag = (uint8_t) (uintptr_t) arg;
+    for (i = 0 ; i < NUM_ITERS ; i++) {
+        for (j = 0 ; j < NUM_ALLOCS ; j++) {
+            size = 16 + (i * 7 + j * 13) % 1000;
+            ptr[j] = mpool_alloc(size, 0);
+            check(ptr[j] != NULL);
+            memset(ptr[j], tag, size);
+        }
+
+        for (j = 0 ; j < NUM_ALLOCS ; j++) {
+            size = 16 + (i * 7 + j * 13) % 1000;
+            check(ptr[j][0] == tag && ptr[j][size - 1] == tag);
+            mpool_free(ptr[j], size);
+        }
+    }
+
+    return NULL;
+}
+
+
+/* the library can use restartable sequences: the kernel knows them and
+ * nothing asks for the locks */
+static int
+rseq_expected(void)
+{
+#if MPOOL_HAS_RSEQ && defined(SYS_rseq)
+    if (getenv("MPOOL_PERCPU_LOCKED") != NULL)
+        return 0;
+
+    /* an invalid registration fails with EINVAL where rseq is supported */
+    return syscall(SYS_rseq, NULL, 0, 0, 0) != 0 && errno == EINVAL;
+#else
+    return 0;
+#endif
+}
+
+
+static void
+check_percpu(void * arena)
+{
+    size_t i, num, num_cpus;
+    pthread_t thread[NUM_WORKERS];
+    struct mpool_ctx * ctx;
+    struct mpool_cache_info info;
+    struct mpool_stats stats;
+    unsigned int weights[] = {1};
+    unsigned int default_weights[] = {1, 1, 1, 1, 1, 1, 1};
+
+    ctx = mpool_ctx_create(arena, ARENA_SIZE, weights, arraylen(weights),
+            MPOOL_PERCPU);
+    check(ctx != NULL);
+
+    /* the caches do not grow with the number of threads */
+    for (i = 0 ; i < NUM_THREADS ; i++) {
+        check(pthread_create(&thread[0], NULL, short_thread, ctx) == 0);
+        check(pthread_join(thread[0], NULL) == 0);
+    }
+
+    mpool_ctx_stats(ctx);
+
+    /* counted per CPU, all the threads are gone */
+    if (mpool_ctx_stats_get(ctx, &stats) == 0) {
+        check(stats.classes[0].allocs == NUM_THREADS * NUM_ALLOCS);
+        check(stats.classes[0].frees == NUM_THREADS * NUM_ALLOCS);
+    }
+
+    check(mpool_ctx_cache_info(ctx, 64, &info) == 0);
+    check(info.elem_size == 64);
+    check(info.batch > 0);
+    check(info.num_free <= 2 * info.batch);
+    check(info.rseq == rseq_expected());
+
+    for (num = 0 ; num < NUM_CHUNKS ; num++) {
+        ptrs[num] = mpool_ctx_alloc(ctx, 64, 0);
+        if (ptrs[num] == NULL)
+            break;
+    }
+
+    num_cpus = (size_t) MIN(MAX(sysconf(_SC_NPROCESSORS_CONF), 1), NR_CPUS);
+    check(num + (num_cpus - 1) * 2 * info.batch >= NUM_CHUNKS);
+
+    for (i = 0 ; i < num ; i++)
+        mpool_ctx_free(ctx, ptrs[i], 64);
+
+    mpool_ctx_destroy(ctx);
+
+    /* threads sharing the CPUs, through the default instance functions */
+    ctx = mpool_ctx_create(NULL, 1UL << 28, default_weights,
+            arraylen(default_weights), MPOOL_GROW | MPOOL_PERCPU);
+    check(ctx != NULL);
+    mpool_set_default(ctx);
+
+    for (i = 0 ; i < NUM_WORKERS ; i++) {
+        check(pthread_create(&thread[i], NULL, worker_thread,
+                (void *) (uintptr_t) (i + 1)) == 0);
+    }
+
+    for (i = 0 ; i < NUM_WORKERS ; i++)
+        check(pthread_join(thread[i], NULL) == 0);
+
+    check(mpool_alloc_bulk(64, NUM_ALLOCS, ptrs) == 0);
+    mpool_free_bulk(64, NUM_ALLOCS, ptrs);
+
+    mpool_stats();
+    mpool_destroy();
+}
+
+
+int
+main(void)
+{
+    void * arena;
+
+    arena = mmap(NULL, ARENA_SIZE,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_SHARED,
+            -1, 0);
+    check(arena != MAP_FAILED);
+
+    /* with restartable sequences where available */
+    check_percpu(arena);
+
+    /* and with the per-CPU locks */
+    check(setenv("MPOOL_PERCPU_LOCKED", "1", 1) == 0);
+    check_percpu(arena);
+
+    munmap(arena, ARENA_SIZE);
+
+    return 0;
+}
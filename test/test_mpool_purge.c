@@ -0,0 +1,182 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define ARENA_SIZE (16 << 20)
+#define CHUNK_SIZE 64
+#define NUM_CHUNKS (ARENA_SIZE / CHUNK_SIZE)
+#define DECAY_MS 10
+#define MAX_RESIDENT (ARENA_SIZE / PAGE_SIZE / 4)
+#define NUM_ALLOCS 4096
+#define NUM_ROUNDS 500
+
+static void * ptrs[NUM_CHUNKS];
+static int stop;
+
+static size_t
+resident_pages(void * addr, size_t size)
+{
+    size_t i, num;
+    unsigned char * vec;
+
+    vec = malloc(size / PAGE_SIZE);
+    check(vec != NULL);
+    check(mincore(addr, size, vec) == 0);
+
+    num = 0;
+    for (i = 0 ; i < size / PAGE_SIZE ; i++)
+        num += vec[i] & 1;
+
+    free(vec);
+
+    return num;
+}
+
+static int
+cmp_ptr(void const * a, void const * b)
+{
+    uintptr_t x = (uintptr_t) *(void * const *) a;
+    uintptr_t y = (uintptr_t) *(void * const *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* allocate every chunk, each one only once */
+static size_t
+alloc_all(struct mpool_ctx * ctx)
+{
+    size_t i, num;
+
+    for (num = 0 ; num < NUM_CHUNKS ; num++) {
+        ptrs[num] = mpool_ctx_alloc(ctx, CHUNK_SIZE, 0);
+        if (ptrs[num] == NULL)
+            break;
+
+        memset(ptrs[num], 'a', CHUNK_SIZE);
+    }
+
+    qsort(ptrs, num, sizeof(void *), cmp_ptr);
+    for (i = 1 ; i < num ; i++)
+        check(ptrs[i - 1] != ptrs[i]);
+
+    return num;
+}
+
+static void *
+purge_thread(void * arg)
+{
+    struct mpool_ctx * ctx = arg;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED))
+        (void) mpool_ctx_purge(ctx);
+
+    return NULL;
+}
+
+
+static void
+free_all(struct mpool_ctx * ctx, size_t num)
+{
+    size_t i;
+
+    /* every other chunk first, the pages cannot be purged until the rest is
+     * freed */
+    for (i = 0 ; i < num ; i += 2)
+        mpool_ctx_free(ctx, ptrs[i], CHUNK_SIZE);
+
+    check(mpool_ctx_purge(ctx) == 0);
+
+    for (i = 1 ; i < num ; i += 2)
+        mpool_ctx_free(ctx, ptrs[i], CHUNK_SIZE);
+}
+
+int
+main(void)
+{
+    size_t i, j, num, purged;
+    void * arena;
+    pthread_t purger;
+    struct mpool_ctx * ctx;
+    unsigned int weights[] = {1};
+
+    arena = mmap(NULL, ARENA_SIZE,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE,
+            -1, 0);
+    check(arena != MAP_FAILED);
+
+    ctx = mpool_ctx_create(arena, ARENA_SIZE, weights, arraylen(weights), 0);
+    check(ctx != NULL);
+
+    /* a spike, then the pages of the free chunks go back */
+    num = alloc_all(ctx);
+    check(num > 0);
+    check(resident_pages(arena, ARENA_SIZE) >= num * CHUNK_SIZE / PAGE_SIZE);
+
+    free_all(ctx, num);
+    purged = mpool_ctx_purge(ctx);
+    check(purged >= ARENA_SIZE / 2);
+    check(resident_pages(arena, ARENA_SIZE) <= (ARENA_SIZE - purged)
+          / PAGE_SIZE);
+    check(mpool_ctx_purge(ctx) == 0);
+    mpool_ctx_stats(ctx);
+
+    /* and no chunk is lost */
+    check(alloc_all(ctx) == num);
+
+    /* purges driven by the decay period */
+    free_all(ctx, num);
+    mpool_ctx_set_decay(ctx, DECAY_MS);
+    for (i = 0 ; i < 100 && resident_pages(arena, ARENA_SIZE) > MAX_RESIDENT ;
+         i++) {
+        usleep(DECAY_MS * 1000);
+        check(mpool_ctx_alloc_bulk(ctx, CHUNK_SIZE, 1024, ptrs) == 0);
+        mpool_ctx_free_bulk(ctx, CHUNK_SIZE, 1024, ptrs);
+    }
+
+    check(resident_pages(arena, ARENA_SIZE) <= MAX_RESIDENT);
+    mpool_ctx_set_decay(ctx, 0);
+    check(alloc_all(ctx) == num);
+
+    /* purges do not take the free chunks away from allocations */
+    free_all(ctx, num);
+    check(pthread_create(&purger, NULL, purge_thread, ctx) == 0);
+    for (i = 0 ; i < NUM_ROUNDS ; i++) {
+        for (j = 0 ; j < NUM_ALLOCS ; j++) {
+            ptrs[j] = mpool_ctx_alloc(ctx, CHUNK_SIZE, 0);
+            check(ptrs[j] != NULL);
+        }
+
+        for (j = 0 ; j < NUM_ALLOCS ; j++)
+            mpool_ctx_free(ctx, ptrs[j], CHUNK_SIZE);
+    }
+
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    check(pthread_join(purger, NULL) == 0);
+    check(alloc_all(ctx) == num);
+
+    mpool_ctx_destroy(ctx);
+    munmap(arena, ARENA_SIZE);
+
+    /* growable instances */
+    ctx = mpool_ctx_create(NULL, ARENA_SIZE, weights, arraylen(weights),
+            MPOOL_GROW);
+    check(ctx != NULL);
+    num = alloc_all(ctx);
+    check(num > 0);
+    free_all(ctx, num);
+    check(mpool_ctx_purge(ctx) > 0);
+    check(alloc_all(ctx) == num);
+    free_all(ctx, num);
+    mpool_ctx_destroy(ctx);
+
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define ARENA_SIZE (1 << 22)
+#define CHUNK_SIZE 64
+#define NUM_CHUNKS (ARENA_SIZE / CHUNK_SIZE)
+#define NUM_ALLOCS 4096
+
+struct producer {
+    pthread_t thread;
+    void * ptrs[NUM_ALLOCS];
+    size_t num_back; /* chunks of ptrs allocated again */
+};
+
+static struct mpool_ctx * ctx;
+static struct producer producers[2];
+static pthread_barrier_t barrier;
+static void * all[NUM_CHUNKS];
+
+static int
+cmp_ptr(void const * a, void const * b)
+{
+    uintptr_t x = (uintptr_t) *(void * const *) a;
+    uintptr_t y = (uintptr_t) *(void * const *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void *
+producer_thread(void * arg)
+{
+    size_t i;
+    void * ptr[NUM_ALLOCS];
+    struct producer * p = arg;
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        p->ptrs[i] = mpool_ctx_alloc(ctx, CHUNK_SIZE, 0);
+        check(p->ptrs[i] != NULL);
+        memset(p->ptrs[i], 'p', CHUNK_SIZE);
+    }
+
+    /* the consumer frees them */
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+
+    /* and they come back to their owner */
+    qsort(p->ptrs, NUM_ALLOCS, sizeof(void *), cmp_ptr);
+    p->num_back = 0;
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        ptr[i] = mpool_ctx_alloc(ctx, CHUNK_SIZE, 0);
+        check(ptr[i] != NULL);
+        if (bsearch(&ptr[i], p->ptrs, NUM_ALLOCS, sizeof(void *), cmp_ptr))
+            p->num_back++;
+    }
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++)
+        mpool_ctx_free(ctx, ptr[i], CHUNK_SIZE);
+
+    return NULL;
+}
+
+
+static void *
+consumer_thread(void * arg)
+{
+    size_t i, j;
+
+    (void) arg;
+
+    for (i = 0 ; i < arraylen(producers) ; i++) {
+        for (j = 0 ; j < NUM_ALLOCS ; j++)
+            mpool_ctx_free_ptr(ctx, producers[i].ptrs[j]);
+    }
+
+    return NULL;
+}
+
+
+static size_t
+alloc_all(void)
+{
+    size_t i, num;
+
+    for (num = 0 ; num < NUM_CHUNKS ; num++) {
+        all[num] = mpool_ctx_alloc(ctx, CHUNK_SIZE, 0);
+        if (all[num] == NULL)
+            break;
+    }
+
+    for (i = 0 ; i < num ; i++)
+        mpool_ctx_free(ctx, all[i], CHUNK_SIZE);
+
+    return num;
+}
+
+
+int
+main(void)
+{
+    size_t i, num;
+    void * arena;
+    pthread_t consumer;
+    unsigned int weights[] = {1};
+
+    arena = mmap(NULL, ARENA_SIZE,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_SHARED,
+            -1, 0);
+    check(arena != MAP_FAILED);
+
+    ctx = mpool_ctx_create(arena, ARENA_SIZE, weights, arraylen(weights),
+            MPOOL_REMOTE_FREE);
+
+    /* built without remote frees */
+    if (ctx == NULL && errno == ENOTSUP) {
+        munmap(arena, ARENA_SIZE);
+        return 0;
+    }
+
+    check(ctx != NULL);
+
+    num = alloc_all();
+    check(num > 0);
+
+    check(pthread_barrier_init(&barrier, NULL, arraylen(producers) + 1) == 0);
+    for (i = 0 ; i < arraylen(producers) ; i++) {
+        check(pthread_create(&producers[i].thread, NULL, producer_thread,
+                &producers[i]) == 0);
+    }
+
+    /* the chunks of both producers go through a thread of their own, the
+     * ones of the second producer are freed last */
+    pthread_barrier_wait(&barrier);
+    check(pthread_create(&consumer, NULL, consumer_thread, NULL) == 0);
+    check(pthread_join(consumer, NULL) == 0);
+    pthread_barrier_wait(&barrier);
+
+    for (i = 0 ; i < arraylen(producers) ; i++) {
+        check(pthread_join(producers[i].thread, NULL) == 0);
+        check(producers[i].num_back >= NUM_ALLOCS / 2);
+    }
+
+    pthread_barrier_destroy(&barrier);
+
+    /* no chunk is left behind in the owner queues */
+    check(alloc_all() == num);
+
+    mpool_ctx_stats(ctx);
+    mpool_ctx_destroy(ctx);
+    munmap(arena, ARENA_SIZE);
+
+    return 0;
+}
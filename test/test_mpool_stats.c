@@ -0,0 +1,156 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define ARENA_SIZE (1 << 22)
+#define CHUNK_SIZE 64
+#define NUM_ALLOCS 4096
+#define NUM_THREADS 4
+#define RESERVE_SIZE (64 << 20)
+
+static struct mpool_ctx * ctx;
+static void * ptrs[ARENA_SIZE / CHUNK_SIZE + 1];
+static struct mpool_stats stats;
+
+static void *
+alloc_free(void * arg)
+{
+    size_t i;
+    void ** p;
+
+    (void) arg;
+
+    p = malloc(NUM_ALLOCS * sizeof(void *));
+    check(p != NULL);
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        p[i] = mpool_ctx_alloc(ctx, CHUNK_SIZE, 0);
+        check(p[i] != NULL);
+    }
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++)
+        mpool_ctx_free(ctx, p[i], CHUNK_SIZE);
+
+    free(p);
+
+    return NULL;
+}
+
+
+static struct mpool_class_stats *
+get_class_stats(size_t elem_size)
+{
+    unsigned int i;
+
+    check(mpool_ctx_stats_get(ctx, &stats) == 0);
+    for (i = 0 ; i < stats.num_classes ; i++) {
+        if (stats.classes[i].elem_size == elem_size)
+            return &stats.classes[i];
+    }
+
+    check(0);
+    return NULL;
+}
+
+
+int
+main(void)
+{
+    size_t i, num;
+    void * arena, * ptr;
+    pthread_t threads[NUM_THREADS];
+    struct mpool_class_stats * class_stats;
+    unsigned int weights[] = {1};
+    unsigned int large_weights[] = {1, 0, 0, 0, 0, 0, 0, 1};
+
+    arena = mmap(NULL, ARENA_SIZE,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE,
+            -1, 0);
+    check(arena != MAP_FAILED);
+
+    ctx = mpool_ctx_create(arena, ARENA_SIZE, weights, arraylen(weights), 0);
+    check(ctx != NULL);
+
+    /* built without the counters */
+    if (mpool_ctx_stats_get(ctx, &stats) == ENOTSUP)
+        return 0;
+
+    check(stats.num_classes > 0);
+    check(stats.classes[0].allocs == 0);
+    check(stats.classes[0].total > 0);
+
+    /* the counts of the calling thread */
+    alloc_free(NULL);
+    class_stats = get_class_stats(CHUNK_SIZE);
+    check(class_stats->allocs == NUM_ALLOCS);
+    check(class_stats->frees == NUM_ALLOCS);
+    check(class_stats->cache_misses > 0);
+    check(class_stats->cache_hits + class_stats->cache_misses
+          == NUM_ALLOCS);
+    check(class_stats->refills >= class_stats->cache_misses);
+    check(class_stats->flushes > 0);
+    check(class_stats->enomem == 0);
+    check(class_stats->high_water >= NUM_ALLOCS);
+    check(class_stats->used <= class_stats->total);
+
+    /* and the ones of exited threads */
+    for (i = 0 ; i < NUM_THREADS ; i++)
+        check(pthread_create(&threads[i], NULL, alloc_free, NULL) == 0);
+
+    for (i = 0 ; i < NUM_THREADS ; i++)
+        check(pthread_join(threads[i], NULL) == 0);
+
+    class_stats = get_class_stats(CHUNK_SIZE);
+    check(class_stats->allocs == (NUM_THREADS + 1) * NUM_ALLOCS);
+    check(class_stats->frees == (NUM_THREADS + 1) * NUM_ALLOCS);
+
+    /* exhaustion */
+    for (num = 0 ; num < arraylen(ptrs) ; num++) {
+        ptrs[num] = mpool_ctx_alloc(ctx, CHUNK_SIZE, 0);
+        if (ptrs[num] == NULL)
+            break;
+    }
+
+    class_stats = get_class_stats(CHUNK_SIZE);
+    check(num == class_stats->total);
+    check(class_stats->used == class_stats->total);
+    check(class_stats->high_water == class_stats->total);
+    check(class_stats->enomem == 1);
+
+    for (i = 0 ; i < num ; i++)
+        mpool_ctx_free(ctx, ptrs[i], CHUNK_SIZE);
+
+    mpool_ctx_stats(ctx);
+    mpool_ctx_destroy(ctx);
+    munmap(arena, ARENA_SIZE);
+
+    /* the large tier */
+    ctx = mpool_ctx_create(NULL, RESERVE_SIZE, large_weights,
+            arraylen(large_weights), MPOOL_GROW);
+    check(ctx != NULL);
+
+    ptr = mpool_ctx_alloc(ctx, 2 * PAGE_SIZE, 0);
+    check(ptr != NULL);
+    check(mpool_ctx_stats_get(ctx, &stats) == 0);
+    check(stats.large.allocs == 1);
+    check(stats.large.used_pages >= 2);
+    check(stats.large.total_pages >= stats.large.used_pages);
+
+    mpool_ctx_free(ctx, ptr, 2 * PAGE_SIZE);
+    check(mpool_ctx_stats_get(ctx, &stats) == 0);
+    check(stats.large.frees == 1);
+    check(stats.large.used_pages == 0);
+
+    mpool_ctx_destroy(ctx);
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "check.h"
+#include "common.h"
+#include "mpool.h"
+
+#define ARENA_SIZE (1 << 20)
+#define NUM_CHUNKS (ARENA_SIZE / 64)
+#define NUM_THREADS 4096
+#define NUM_ALLOCS 32
+
+static void * ptrs[NUM_CHUNKS];
+
+static void *
+mpool_test_thread(void * arg)
+{
+    size_t i;
+    void * ptr[NUM_ALLOCS];
+    struct mpool_ctx * ctx = arg;
+
+    /* leave some chunks in the thread cache on exit */
+    for (i = 0 ; i < NUM_ALLOCS ; i++) {
+        ptr[i] = mpool_ctx_alloc(ctx, 64, 0);
+        check(ptr[i] != NULL);
+        memset(ptr[i], 'a', 64);
+    }
+
+    for (i = 0 ; i < NUM_ALLOCS ; i++)
+        mpool_ctx_free(ctx, ptr[i], 64);
+
+    return NULL;
+}
+
+
+int
+main(void)
+{
+    int rv;
+    size_t i, num;
+    void * arena;
+    pthread_t thread;
+    struct mpool_ctx * ctx;
+    unsigned int weights[] = {1};
+
+    arena = mmap(NULL, ARENA_SIZE,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_SHARED,
+            -1, 0);
+    check(arena != MAP_FAILED);
+
+    ctx = mpool_ctx_create(arena, ARENA_SIZE, weights, arraylen(weights), 0);
+    check(ctx != NULL);
+
+    /* without a flush at thread exit, the pool would be drained many times
+     * over */
+    for (i = 0 ; i < NUM_THREADS ; i++) {
+        rv = pthread_create(&thread, NULL, mpool_test_thread, ctx);
+        check(rv == 0);
+        rv = pthread_join(thread, NULL);
+        check(rv == 0);
+    }
+
+    mpool_ctx_stats(ctx);
+
+    /* every chunk is available again */
+    for (num = 0 ; num < NUM_CHUNKS ; num++) {
+        ptrs[num] = mpool_ctx_alloc(ctx, 64, 0);
+        if (ptrs[num] == NULL)
+            break;
+    }
+
+    check(num == NUM_CHUNKS);
+    check(mpool_ctx_alloc(ctx, 64, 0) == NULL);
+
+    for (i = 0 ; i < num ; i++)
+        mpool_ctx_free(ctx, ptrs[i], 64);
+
+    mpool_ctx_destroy(ctx);
+    munmap(arena, ARENA_SIZE);
+
+    return 0;
+}
@@ -1,3 +1,7 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,43 +10,51 @@
 
 #define NUM_PTRS (1 << 10)
 #define NUM_ALLOCS 1000
+#define NUM_THREADS 4
 #define MAX_SIZE (1 << 14) /* 16KB */
 
-static inline size_t random_size(void)
+static inline size_t random_size(unsigned int * seed)
 {
-	return rand() % MAX_SIZE;
+	return rand_r(seed) % MAX_SIZE;
 }
 
-static inline int random_ptr(void)
+static inline int random_ptr(unsigned int * seed)
 {
-	return rand() % NUM_PTRS;
+	return rand_r(seed) % NUM_PTRS;
 }
 
-
-int
-main(int argc, char ** argv)
+static void * alloc_loop(void * arg)
 {
 	int i;
 	int size;
 	int ptr_index;
+	size_t alignment;
+	unsigned int seed;
 	void * ptr;
-	void * ptr_array[NUM_PTRS] = {0};
+	void ** ptr_array;
 
-	if (argc == 2)
-		srand(atoi(argv[1]));
+	seed = (unsigned int) (uintptr_t) arg;
+	ptr_array = calloc(NUM_PTRS, sizeof(void *));
+	check(ptr_array != NULL);
 
 	for (i = 0 ; i < NUM_ALLOCS ; i++) {
-		ptr_index = random_ptr();
-		size = random_size();
+		ptr_index = random_ptr(&seed);
+		size = random_size(&seed);
 		ptr = ptr_array[ptr_index];
 
 		if ((size % 17) == 0) {
 			free(ptr);
 			ptr = malloc(size);
+		} else if ((size % 17) == 1) {
+			free(ptr);
+			alignment = sizeof(void *) << (size % 13);
+			check(posix_memalign(&ptr, alignment, size) == 0);
+			check(((uintptr_t) ptr & (alignment - 1)) == 0);
 		} else {
 			ptr = realloc(ptr, size);
 		}
 		check(ptr != NULL);
+		check(malloc_usable_size(ptr) >= (size_t) size);
 		memset(ptr, 'x', size);
 		ptr_array[ptr_index] = ptr;
 	}
@@ -50,5 +62,49 @@ main(int argc, char ** argv)
 	for (i = 0 ; i < NUM_PTRS ; i++)
 		free(ptr_array[i]);
 
+	free(ptr_array);
+
+	return NULL;
+}
+
+
+int
+main(int argc, char ** argv)
+{
+	int i;
+	unsigned int seed = 1;
+	void * ptr;
+	/* out of sight of the compiler size checks */
+	size_t volatile num = SIZE_MAX / 2;
+	pthread_t threads[NUM_THREADS];
+
+	if (argc == 2)
+		seed = atoi(argv[1]);
+
+	/* overflowing sizes */
+	errno = 0;
+	check(calloc(num, 4) == NULL);
+	check(errno == ENOMEM);
+
+	errno = 0;
+	check(reallocarray(NULL, num, 4) == NULL);
+	check(errno == ENOMEM);
+
+	ptr = malloc(16);
+	check(ptr != NULL);
+	ptr = reallocarray(ptr, 8, 4);
+	check(ptr != NULL);
+	check(malloc_usable_size(ptr) >= 32);
+	free(ptr);
+
+	alloc_loop((void *) (uintptr_t) seed);
+
+	for (i = 0 ; i < NUM_THREADS ; i++)
+		check(pthread_create(&threads[i], NULL, alloc_loop,
+				     (void *) (uintptr_t) (seed + i + 1)) == 0);
+
+	for (i = 0 ; i < NUM_THREADS ; i++)
+		check(pthread_join(threads[i], NULL) == 0);
+
 	return 0;
 }
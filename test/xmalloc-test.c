@@ -32,27 +32,25 @@
 #include "mpool.h"
 
 
-#define GUARD 0x4242
-
-struct memhdr {
-    uint16_t guard;
-    uint16_t length;
-} PACKED;
-
 static void * arena;
 static size_t arena_size;
+static unsigned int weights[] = {10, 1, 1, 1, 1, 1, 1, 2};
+
+/* address space reserved by -g, the batches in flight take hundreds of MB */
+#define GROW_SIZE (8UL << 30)
 static void __attribute__((constructor))
 alloc_overload_init(void)
 {
 
     int rv;
-    unsigned int weights[] = {10, 1, 1, 1, 1, 1, 1};
+    int map_flags = MPOOL_MAP_THP;
 
-    arena_size = 1 << 24;  /* 16 MBytes */
-    arena = mmap(NULL, arena_size,
-            PROT_READ | PROT_WRITE,
-            MAP_ANONYMOUS | MAP_SHARED,
-            -1, 0);
+    arena_size = 1 << 26;  /* 64 MBytes */
+    arena = mpool_arena_map(arena_size, &map_flags);
+    if (arena == NULL) {
+        fprintf(stderr, "mpool_arena_map() failed\n");
+        exit(EXIT_FAILURE);
+    }
 
     rv = mpool_create(arena, arena_size, weights, arraylen(weights));
     if (rv != 0) {
@@ -68,20 +66,13 @@ alloc_overload_init(void)
 static ALWAYS_INLINE
 void * _malloc_inline(size_t size)
 {
-    struct memhdr * result;
-
-    size += sizeof(struct memhdr);
+    void * result;
 
     result = mpool_alloc(size, 0);
     if (result == NULL)
         return malloc(size);
 
-    *result = (struct memhdr) {
-        .guard = GUARD,
-        .length = (uint16_t) size,
-    };
-
-    return result + 1;
+    return result;
 }
 
 static inline
@@ -93,19 +84,15 @@ void * xmalloc(size_t size)
 static
 void xfree(void * ptr)
 {
-    struct memhdr * hdr;
-
     if (ptr == NULL)
         return;
 
-    hdr = (struct memhdr *) ptr - 1;
-    if (unlikely(hdr->guard != GUARD)) {
+    if (unlikely(mpool_usable_size(ptr) == 0)) {
         free(ptr);
         return;
     }
 
-    hdr->guard = 0x0000;
-    mpool_free(hdr, hdr->length);
+    mpool_free_ptr(ptr);
 }
 
 #define LRAN2_MAX 714025l /* constants for portable */
@@ -386,7 +373,7 @@ int run_memory_free_test(void)
 static
 void usage(char * prog)
 {
-    printf("%s [-w workers] [-t run_time] [-d] [-v]\n", prog);
+    printf("%s [-w workers] [-t run_time] [-g] [-r] [-d] [-v]\n", prog);
     printf(
             "\t -w number of producer threads (and number of consumer threads), default %d\n",
             num_workers_default);
@@ -394,6 +381,9 @@ void usage(char * prog)
     printf(
             "\t -s size of object to allocate (default %d bytes) (specify -1 to get many different object sizes)\n",
             DEFAULT_OBJECT_SIZE);
+    printf("\t -g growable instance instead of the %zu MB arena\n",
+            arena_size >> 20);
+    printf("\t -r free the chunks back to the threads they come from\n");
     printf("\t -d debug mode\n");
     printf("\t -v verbose mode (-v -v produces more verbose)\n");
     exit(1);
@@ -401,8 +391,10 @@ void usage(char * prog)
 
 int main(int argc, char ** argv)
 {
-    int c;
-    while ((c = getopt(argc, argv, "w:t:ds:v")) != -1) {
+    int c, ctx_flags = 0;
+    struct mpool_ctx * ctx;
+
+    while ((c = getopt(argc, argv, "w:t:ds:grv")) != -1) {
 
         switch (c) {
 
@@ -418,6 +410,12 @@ int main(int argc, char ** argv)
         case 's':
             object_size = atoi(optarg);
             break;
+        case 'g':
+            ctx_flags |= MPOOL_GROW;
+            break;
+        case 'r':
+            ctx_flags |= MPOOL_REMOTE_FREE;
+            break;
         case 'v':
             verbose_flag++;
             break;
@@ -426,6 +424,24 @@ int main(int argc, char ** argv)
         }
     }
 
+    /* replace the default instance */
+    if (ctx_flags != 0) {
+        mpool_destroy();
+        if (ctx_flags & MPOOL_GROW)
+            ctx = mpool_ctx_create(NULL, GROW_SIZE, weights,
+                    arraylen(weights), ctx_flags);
+        else
+            ctx = mpool_ctx_create(arena, arena_size, weights,
+                    arraylen(weights), ctx_flags);
+
+        if (ctx == NULL) {
+            fprintf(stderr, "mpool_ctx_create() failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        mpool_set_default(ctx);
+    }
+
     /* allocate memory for working arrays */
     thread_ids = (pthread_t *) xmalloc(sizeof(pthread_t) * num_workers * 2);
     counters = (struct counter *) xmalloc(sizeof(*counters) * num_workers);